@@ -0,0 +1,393 @@
+/* vi: set sw=4 ts=4:
+ *
+ * capture.c
+ *
+ * Binary session capture.
+ *
+ * Documentation can be found in the header file "capture.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "logfile.h"
+#include "capture.h"
+
+/**********************************************************************/
+
+#define CAP_MAGIC "PICOCAP"
+#define CAP_IDX_MAGIC "PICOIDX"
+#define CAP_VERSION 1
+
+#define CAP_HDR_SZ 24
+#define CAP_REC_SZ 16
+#define CAP_FTR_SZ 24
+
+/* iovecs accepted by cap_put, besides the record header */
+#define CAP_IOV_MAX 4
+
+static void
+put_le32 (unsigned char *p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void
+put_le64 (unsigned char *p, uint64_t v)
+{
+	put_le32(p, (uint32_t)v);
+	put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t
+get_le32 (const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t
+get_le64 (const unsigned char *p)
+{
+	return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static uint64_t
+cap_clock (clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**********************************************************************/
+
+static struct {
+	int open;
+	char *path;
+	uint64_t mono0;      /* CLOCK_MONOTONIC at t = 0 */
+	uint64_t off;        /* bytes handed to the log so far */
+	uint64_t lost;       /* data bytes lost, not yet reported */
+	uint64_t idx_next;   /* time of the next index entry */
+	uint64_t *idx;       /* t, offset, t, offset, ... */
+	size_t nidx;
+	size_t idx_sz;
+} cap;
+
+static void
+cap_index (uint64_t t, uint64_t off)
+{
+	uint64_t *p;
+	size_t sz;
+
+	if ( t < cap.idx_next ) return;
+
+	if ( cap.nidx == cap.idx_sz ) {
+		sz = cap.idx_sz ? cap.idx_sz * 2 : 1024;
+		p = realloc(cap.idx, sz * 2 * sizeof(*p));
+		/* without memory, keep an index that covers less */
+		if ( ! p ) return;
+		cap.idx = p;
+		cap.idx_sz = sz;
+	}
+	cap.idx[2 * cap.nidx] = t;
+	cap.idx[2 * cap.nidx + 1] = off;
+	cap.nidx++;
+	cap.idx_next = t - t % CAP_IDX_NSEC + CAP_IDX_NSEC;
+}
+
+/* append a record; returns negative if it was dropped */
+static int
+cap_append (int type, int port, uint64_t t,
+			const struct iovec *iov, int iovcnt, size_t len)
+{
+	unsigned char h[CAP_REC_SZ];
+	struct iovec v[CAP_IOV_MAX + 1];
+	size_t l;
+	int i, n;
+
+	put_le64(h, t);
+	put_le32(h + 8, len);
+	h[12] = type;
+	h[13] = port;
+	h[14] = h[15] = 0;
+	v[0].iov_base = h;
+	v[0].iov_len = sizeof(h);
+	n = 1;
+	for (i = 0, l = len; i < iovcnt && i < CAP_IOV_MAX && l; i++) {
+		v[n].iov_base = iov[i].iov_base;
+		v[n].iov_len = ( iov[i].iov_len < l ) ? iov[i].iov_len : l;
+		l -= v[n].iov_len;
+		n++;
+	}
+	if ( l ) return -1;
+
+	if ( logfile_writev(v, n) < 0 ) return -1;
+	cap_index(t, cap.off);
+	cap.off += sizeof(h) + len;
+
+	return 0;
+}
+
+int
+cap_open (const char *path, size_t bufsz, int flush_ms)
+{
+	unsigned char h[CAP_HDR_SZ];
+
+	if ( cap.open ) { errno = EBUSY; return -1; }
+
+	cap.path = strdup(path);
+	if ( ! cap.path ) return -1;
+	if ( logfile_open(path, O_TRUNC, bufsz, flush_ms) < 0 ) {
+		free(cap.path);
+		return -1;
+	}
+
+	cap.mono0 = cap_clock(CLOCK_MONOTONIC);
+	memset(h, 0, sizeof(h));
+	memcpy(h, CAP_MAGIC, sizeof(CAP_MAGIC));
+	put_le32(h + 8, CAP_VERSION);
+	put_le64(h + 16, cap_clock(CLOCK_REALTIME));
+	/* the buffers are empty, this cannot be dropped */
+	logfile_write(h, sizeof(h));
+
+	cap.off = sizeof(h);
+	cap.lost = 0;
+	cap.idx_next = 0;
+	cap.nidx = 0;
+	cap.open = 1;
+
+	return 0;
+}
+
+void
+cap_put (int type, int port,
+		 const struct iovec *iov, int iovcnt, size_t len)
+{
+	unsigned char d[8];
+	struct iovec v;
+	uint64_t t;
+
+	if ( ! cap.open ) return;
+
+	t = cap_clock(CLOCK_MONOTONIC) - cap.mono0;
+	if ( cap.lost ) {
+		/* report the loss before anything that follows it */
+		put_le64(d, cap.lost);
+		v.iov_base = d;
+		v.iov_len = sizeof(d);
+		if ( cap_append(CAP_DROP, 0, t, &v, 1, sizeof(d)) < 0 ) {
+			cap.lost += len;
+			return;
+		}
+		cap.lost = 0;
+	}
+	if ( cap_append(type, port, t, iov, iovcnt, len) < 0 )
+		cap.lost += len;
+}
+
+void
+cap_close (void)
+{
+	unsigned char b[16];
+	size_t i;
+	int fd;
+
+	if ( ! cap.open ) return;
+	cap.open = 0;
+
+	logfile_close();
+
+	/* the index is useless if the file does not hold exactly what
+	   was handed to the log (e.g. after a write error) */
+	fd = open(cap.path, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if ( fd >= 0 && lseek(fd, 0, SEEK_END) == (off_t)cap.off ) {
+		for (i = 0; i < cap.nidx; i++) {
+			put_le64(b, cap.idx[2 * i]);
+			put_le64(b + 8, cap.idx[2 * i + 1]);
+			if ( write(fd, b, sizeof(b)) != sizeof(b) ) break;
+		}
+		if ( i == cap.nidx ) {
+			unsigned char f[CAP_FTR_SZ];
+
+			memcpy(f, CAP_IDX_MAGIC, sizeof(CAP_IDX_MAGIC));
+			put_le64(f + 8, cap.off);
+			put_le64(f + 16, cap.nidx);
+			if ( write(fd, f, sizeof(f)) == sizeof(f) )
+				fdatasync(fd);
+		}
+	}
+	if ( fd >= 0 ) close(fd);
+
+	free(cap.idx);
+	cap.idx = NULL;
+	cap.nidx = cap.idx_sz = 0;
+	free(cap.path);
+	cap.path = NULL;
+}
+
+/**********************************************************************/
+
+/* load the index, if the file ends with a valid one */
+static int
+cap_rd_index (struct cap_rd_s *rd, off_t size)
+{
+	unsigned char f[CAP_FTR_SZ], b[16];
+	uint64_t off, n;
+	size_t i;
+
+	rd->end = size;
+	if ( size < CAP_HDR_SZ + CAP_FTR_SZ ) return 0;
+	if ( fseeko(rd->f, size - CAP_FTR_SZ, SEEK_SET) < 0 ) return -1;
+	if ( fread(f, sizeof(f), 1, rd->f) != 1 ) return -1;
+	if ( memcmp(f, CAP_IDX_MAGIC, sizeof(CAP_IDX_MAGIC)) != 0 ) return 0;
+	off = get_le64(f + 8);
+	n = get_le64(f + 16);
+	if ( off < CAP_HDR_SZ || n > (uint64_t)size / 16
+		 || off + n * 16 + CAP_FTR_SZ != (uint64_t)size )
+		return 0;
+
+	rd->idx = malloc(n * 2 * sizeof(*rd->idx) + 1);
+	if ( ! rd->idx ) return -1;
+	if ( fseeko(rd->f, off, SEEK_SET) < 0 ) return -1;
+	for (i = 0; i < n; i++) {
+		if ( fread(b, sizeof(b), 1, rd->f) != 1 ) return -1;
+		rd->idx[2 * i] = get_le64(b);
+		rd->idx[2 * i + 1] = get_le64(b + 8);
+	}
+	rd->nidx = n;
+	rd->end = off;
+
+	return 0;
+}
+
+int
+cap_rd_open (struct cap_rd_s *rd, const char *path, uint64_t *t0_real)
+{
+	unsigned char h[CAP_HDR_SZ];
+	off_t size;
+
+	memset(rd, 0, sizeof(*rd));
+	rd->f = fopen(path, "rb");
+	if ( ! rd->f ) return -1;
+
+	if ( fread(h, sizeof(h), 1, rd->f) != 1
+		 || memcmp(h, CAP_MAGIC, sizeof(CAP_MAGIC)) != 0
+		 || get_le32(h + 8) != CAP_VERSION ) {
+		cap_rd_close(rd);
+		errno = EINVAL;
+		return -1;
+	}
+	rd->t0_real = get_le64(h + 16);
+	if ( t0_real ) *t0_real = rd->t0_real;
+
+	if ( fseeko(rd->f, 0, SEEK_END) < 0
+		 || (size = ftello(rd->f)) < 0
+		 || cap_rd_index(rd, size) < 0
+		 || fseeko(rd->f, CAP_HDR_SZ, SEEK_SET) < 0 ) {
+		cap_rd_close(rd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+cap_rd_seek (struct cap_rd_s *rd, uint64_t t)
+{
+	uint64_t off;
+	size_t lo, hi, mid;
+
+	/* the last entry not after "t" */
+	off = CAP_HDR_SZ;
+	lo = 0;
+	hi = rd->nidx;
+	while ( lo < hi ) {
+		mid = lo + (hi - lo) / 2;
+		if ( rd->idx[2 * mid] <= t ) {
+			off = rd->idx[2 * mid + 1];
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if ( fseeko(rd->f, off, SEEK_SET) < 0 ) return -1;
+	rd->from = t;
+
+	return 0;
+}
+
+int
+cap_rd_next (struct cap_rd_s *rd, struct cap_rec_s *rec,
+			 void *buf, size_t sz)
+{
+	unsigned char h[CAP_REC_SZ];
+	off_t pos;
+
+	for (;;) {
+		pos = ftello(rd->f);
+		if ( pos < 0 ) return -1;
+		if ( pos >= rd->end ) return 0;
+		if ( fread(h, sizeof(h), 1, rd->f) != 1 ) {
+			errno = EINVAL;
+			return -1;
+		}
+		rec->t = get_le64(h);
+		rec->len = get_le32(h + 8);
+		rec->type = h[12];
+		rec->port = h[13];
+		if ( rec->t < rd->from ) {
+			if ( fseeko(rd->f, rec->len, SEEK_CUR) < 0 ) return -1;
+			continue;
+		}
+		if ( rec->len > sz ) {
+			/* skip it, so that the caller may go on */
+			fseeko(rd->f, rec->len, SEEK_CUR);
+			errno = EMSGSIZE;
+			return -1;
+		}
+		if ( rec->len && fread(buf, rec->len, 1, rd->f) != 1 ) {
+			errno = EINVAL;
+			return -1;
+		}
+		return 1;
+	}
+}
+
+void
+cap_rd_close (struct cap_rd_s *rd)
+{
+	if ( rd->f ) fclose(rd->f);
+	free(rd->idx);
+	memset(rd, 0, sizeof(*rd));
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
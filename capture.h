@@ -0,0 +1,192 @@
+/* vi: set sw=4 ts=4:
+ *
+ * capture.h
+ *
+ * Binary session capture. Records every chunk of data read from, or
+ * written to the port, with a monotonic timestamp, into a file that
+ * can be searched by time without reading it from the start.
+ *
+ * File format (all integers are little-endian):
+ *
+ *   header:  "PICOCAP\0", u32 version (1), u32 zero,
+ *            u64 wall-clock (CLOCK_REALTIME) time of t = 0, in nsec
+ *   records: u64 t, u32 len, u8 type, u8 port, u8[2] zero,
+ *            len bytes of data
+ *   index:   u64 t, u64 offset, for each index entry
+ *   footer:  "PICOIDX\0", u64 offset of the index, u64 entries
+ *
+ * Record times ("t") are in nanoseconds on CLOCK_MONOTONIC, counted
+ * from the start of the capture, and never decrease. The record type
+ * is one of the CAP_* constants below, and the port is the index of
+ * the port the data came from or went to, in the order the ports were
+ * given on the command line (so always zero with a single port). A
+ * CAP_DROP record says that records were lost because the disk did
+ * not keep up (see "logfile.h"); its data are the u64 number of data
+ * bytes lost, and its port is zero.
+ *
+ * The index is sparse: it has an entry for the first record written
+ * in every CAP_IDX_NSEC interval, giving the record's time and its
+ * offset from the start of the file. It is written, with the footer,
+ * when the capture is closed. A file without a footer (e.g. if the
+ * program was killed) is still readable, only it cannot be searched
+ * faster than by reading it from the start.
+ *
+ * The capture is written through the asynchronous writer in
+ * "logfile.h", so recording never waits for the disk.
+ *
+ * Interface summary:
+ *
+ * F cap_open - create a capture file and start recording to it
+ * F cap_put - record a chunk of data
+ * F cap_close - stop recording, write the index, close the file
+ * F cap_rd_open - open a capture file for reading
+ * F cap_rd_seek - position a reader at a point in time
+ * F cap_rd_next - read the next record
+ * F cap_rd_close - close a reader
+ * T cap_rec_s - record header, as returned by cap_rd_next
+ * T cap_rd_s - capture reader
+ * M CAP_PORT_MAX - largest port number a record can carry
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* record types */
+enum cap_type_e {
+	CAP_RX = 0,      /* read from the port */
+	CAP_TX = 1,      /* written to the port */
+	CAP_DROP = 2     /* records lost */
+};
+
+/* M CAP_PORT_MAX
+ *
+ * The largest port number a record can carry (a byte).
+ */
+#define CAP_PORT_MAX 255
+
+/* distance between index entries */
+#define CAP_IDX_NSEC 1000000000ULL
+
+/* F cap_open
+ *
+ * Create (or truncate) the capture file "path", write its header,
+ * and make time zero now. "bufsz" and "flush_ms" are passed to
+ * logfile_open(); the capture uses the (only) log file.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int cap_open (const char *path, size_t bufsz, int flush_ms);
+
+/* F cap_put
+ *
+ * Record the first "len" bytes of the data described by "iov" and
+ * "iovcnt", as a record of type "type", for port "port". Never blocks
+ * on I/O. Does nothing if no capture is open.
+ */
+void cap_put (int type, int port,
+			  const struct iovec *iov, int iovcnt, size_t len);
+
+/* F cap_close
+ *
+ * Flush all records to the file, then append the index and footer.
+ * Blocks until done. Does nothing if no capture is open.
+ */
+void cap_close (void);
+
+/* T cap_rec_s
+ *
+ * Record header, as returned by cap_rd_next().
+ */
+struct cap_rec_s {
+	uint64_t t;      /* nsec since the start of the capture */
+	uint32_t len;    /* length of the data */
+	int type;        /* one of CAP_* */
+	int port;        /* index of the port */
+};
+
+/* T cap_rd_s
+ *
+ * Capture reader. The fields are private.
+ */
+struct cap_rd_s {
+	FILE *f;
+	uint64_t t0_real;    /* wall-clock time of t = 0, nsec */
+	uint64_t *idx;       /* index entries: t, offset, t, offset, ... */
+	size_t nidx;
+	off_t end;           /* offset where the records end */
+	uint64_t from;       /* skip records before this time */
+};
+
+/* F cap_rd_open
+ *
+ * Open the capture file "path" for reading, positioned at its first
+ * record. Loads the index, if the file has one. If "t0_real" is not
+ * NULL, the wall-clock time (nsec since the Epoch) of time zero is
+ * stored there.
+ *
+ * Returns negative on failure (errno is set, EINVAL for a file that
+ * is not a capture), non-negative on success.
+ */
+int cap_rd_open (struct cap_rd_s *rd, const char *path, uint64_t *t0_real);
+
+/* F cap_rd_seek
+ *
+ * Position the reader so that the next record returned is the first
+ * one with time "t" or later. With an index, it takes a binary search
+ * and reading at most about CAP_IDX_NSEC worth of records; without
+ * one, the file is read from the start.
+ *
+ * Returns negative on failure, non-negative on success.
+ */
+int cap_rd_seek (struct cap_rd_s *rd, uint64_t t);
+
+/* F cap_rd_next
+ *
+ * Read the next record. Its header is stored in "rec" and its data
+ * in "buf" (which is "sz" bytes large).
+ *
+ * Returns 1 if a record was read, 0 at the end of the records, or
+ * negative on failure (errno is set, EMSGSIZE if the record does not
+ * fit in "buf", EINVAL if the file is corrupt or truncated).
+ */
+int cap_rd_next (struct cap_rd_s *rd, struct cap_rec_s *rec,
+				 void *buf, size_t sz);
+
+/* F cap_rd_close
+ *
+ * Close the reader, and free its resources.
+ */
+void cap_rd_close (struct cap_rd_s *rd);
+
+#endif /* of CAPTURE_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,115 @@
+/* vi: set sw=4 ts=4:
+ *
+ * crc.c
+ *
+ * Cyclic redundancy checks, as used by the file transfer protocols.
+ *
+ * Documentation can be found in the header file "crc.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include "crc.h"
+
+/**********************************************************************/
+
+static uint16_t crc16_tab[256];
+static int crc16_init;
+
+static void
+crc16_mktab (void)
+{
+	uint16_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i << 8;
+		for (j = 0; j < 8; j++)
+			c = ( c & 0x8000 ) ? ( c << 1 ) ^ 0x1021 : c << 1;
+		crc16_tab[i] = c;
+	}
+	crc16_init = 1;
+}
+
+uint16_t
+crc16 (uint16_t crc, const void *buff, size_t len)
+{
+	const unsigned char *p = buff;
+
+	if ( ! crc16_init ) crc16_mktab();
+
+	while ( len-- )
+		crc = ( crc << 8 ) ^ crc16_tab[( crc >> 8 ) ^ *p++];
+
+	return crc;
+}
+
+static uint32_t crc32_tab[8][256];
+static int crc32_init;
+
+static void
+crc32_mktab (void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = ( c & 1 ) ? ( c >> 1 ) ^ 0xedb88320 : c >> 1;
+		crc32_tab[0][i] = c;
+	}
+	/* table "j": the remainder of byte "i" followed by "j" zero bytes */
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32_tab[j][i] = ( crc32_tab[j - 1][i] >> 8 )
+				^ crc32_tab[0][crc32_tab[j - 1][i] & 0xff];
+	crc32_init = 1;
+}
+
+uint32_t
+crc32 (uint32_t crc, const void *buff, size_t len)
+{
+	const unsigned char *p = buff;
+	uint32_t w;
+
+	if ( ! crc32_init ) crc32_mktab();
+
+	crc = ~crc;
+	while ( len >= 8 ) {
+		w = crc ^ ( p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24 );
+		crc = crc32_tab[7][w & 0xff] ^ crc32_tab[6][(w >> 8) & 0xff]
+			^ crc32_tab[5][(w >> 16) & 0xff] ^ crc32_tab[4][w >> 24]
+			^ crc32_tab[3][p[4]] ^ crc32_tab[2][p[5]]
+			^ crc32_tab[1][p[6]] ^ crc32_tab[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while ( len-- )
+		crc = ( crc >> 8 ) ^ crc32_tab[0][( crc ^ *p++ ) & 0xff];
+
+	return ~crc;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
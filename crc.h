@@ -0,0 +1,72 @@
+/* vi: set sw=4 ts=4:
+ *
+ * crc.h
+ *
+ * Cyclic redundancy checks, as used by the file transfer protocols.
+ *
+ * Principles of operation:
+ *
+ * The CRCs are computed with tables of remainders, built on first
+ * use, instead of a bit at a time. CRC-16 goes a byte at a time, with
+ * one table of the remainders of all 256 byte values. CRC-32, used on
+ * the data of fast transfers, goes eight bytes at a time ("slicing by
+ * 8"): eight tables give the contribution of each of the eight bytes,
+ * and the eight lookups are independent of each other, instead of
+ * each waiting for the previous one.
+ *
+ * Interface summary:
+ *
+ * F crc16 - CRC-16/XMODEM of a buffer
+ * F crc32 - CRC-32 (of ZMODEM, and of zlib) of a buffer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* F crc16
+ *
+ * Continue CRC "crc" over the "len" bytes at "buff", and return it.
+ * The CRC of a message is computed starting from zero (polynomial
+ * 0x1021, no reflection, no final XOR: the CRC of XMODEM, YMODEM, and
+ * of the ZMODEM 16-bit frames).
+ */
+uint16_t crc16 (uint16_t crc, const void *buff, size_t len);
+
+/* F crc32
+ *
+ * Continue CRC "crc" over the "len" bytes at "buff", and return it.
+ * The CRC of a message is computed starting from zero (polynomial
+ * 0x04C11DB7, reflected, inverted at the start and at the end: the
+ * CRC of the ZMODEM 32-bit frames, the same as zlib's crc32()).
+ */
+uint32_t crc32 (uint32_t crc, const void *buff, size_t len);
+
+#endif /* of CRC_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,923 @@
+/* vi: set sw=4 ts=4:
+ *
+ * ev.c
+ *
+ * Minimal I/O event-loop layer.
+ *
+ * Documentation can be found in the header file "ev.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif /* of __linux__ */
+#if defined(__linux__) && defined(USE_IO_URING)
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "ev.h"
+
+/**********************************************************************/
+
+/* maximum number of events fetched from the kernel per ev_wait() */
+#define EV_BATCH 32
+
+#ifdef EV_HAVE_URING
+
+/* number of submission-queue entries */
+#define EV_URING_ENTRIES 64
+/* size of the buffer of the read kept queued on a filedes */
+#define EV_RDQ_SZ 8192
+/* size of the buffer used by ev_writev() for a filedes */
+#define EV_WRQ_SZ 65536
+
+/* io_uring per-filedes state. Once allocated it is never freed, as
+   the kernel may still hold references to the buffers. */
+struct ev_uq {
+	/* read kept queued (EV_READ | EV_ET filedes) */
+	unsigned char *rbuff;
+	int rlen, roff;     /* data in rbuff, and how much was consumed */
+	int rqueued;        /* read in flight */
+	int rerr;           /* sticky: errno, or -1 for end-of-file */
+	/* writes submitted by ev_writev() */
+	unsigned char *wbuff;
+	size_t woff, wlen;  /* unwritten data are wbuff[woff..wlen) */
+	int winflight;      /* write in flight */
+	int werr;           /* errno of a failed write, not yet reported */
+};
+
+/* completion tags, stored in the low byte of user_data */
+enum ev_ud_e {
+	UD_POLL_IN,
+	UD_POLL_OUT,
+	UD_LINK_POLL,
+	UD_READ,
+	UD_WRITE,
+	UD_CANCEL
+};
+
+#define UD(fd, tag) (((__u64)(fd) << 8) | (tag))
+
+struct ev_uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned sq_local_tail;  /* tail including sqes not yet published */
+};
+
+#endif /* of EV_HAVE_URING */
+
+/* per-filedes state, indexed by filedes */
+struct ev_fd {
+	int events;     /* registered events, 0 if not in the loop */
+	int armed;      /* edge-triggered events not yet reported */
+#ifdef EV_HAVE_URING
+	int pending;    /* events completed but not yet reported */
+	int polling;    /* events with a poll in flight */
+	struct ev_uq *uq;
+#endif
+};
+
+static struct ev_s {
+	int init;
+	enum ev_backend_e backend;
+	int epfd;
+#ifdef EV_HAVE_URING
+	struct ev_uring ur;
+#endif
+	struct ev_fd *fds;
+	int nfds;       /* allocated slots in fds */
+	int maxfd;      /* highest filedes in the loop, -1 if none */
+} ev;
+
+static const char * const ev_backend_str[] = {
+	[EV_DEFAULT] = "default",
+	[EV_SELECT]  = "select",
+	[EV_EPOLL]   = "epoll",
+	[EV_URING]   = "io_uring"
+};
+
+/**********************************************************************/
+
+static struct ev_fd *
+ev_slot (int fd)
+{
+	struct ev_fd *nfds;
+	int n;
+
+	if ( fd < 0 ) { errno = EBADF; return NULL; }
+
+	if ( fd >= ev.nfds ) {
+		n = ev.nfds ? ev.nfds : 16;
+		while ( n <= fd ) n <<= 1;
+		nfds = realloc(ev.fds, n * sizeof(*nfds));
+		if ( ! nfds ) return NULL;
+		memset(nfds + ev.nfds, 0, (n - ev.nfds) * sizeof(*nfds));
+		ev.fds = nfds;
+		ev.nfds = n;
+	}
+
+	return &ev.fds[fd];
+}
+
+/**********************************************************************/
+
+#ifdef EV_HAVE_URING
+
+static int
+ev_uring_setup (void)
+{
+	struct io_uring_params p;
+	struct ev_uring *u = &ev.ur;
+	size_t sq_sz, cq_sz;
+	unsigned char *sq_ptr, *cq_ptr;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = syscall(__NR_io_uring_setup, EV_URING_ENTRIES, &p);
+	if ( fd < 0 ) return -1;
+	/* needed for waiting with a timeout */
+	if ( ! (p.features & IORING_FEAT_EXT_ARG) ) {
+		close(fd);
+		errno = ENOSYS;
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( cq_sz > sq_sz ) sq_sz = cq_sz;
+		cq_sz = sq_sz;
+	}
+
+	sq_ptr = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if ( sq_ptr == MAP_FAILED ) { close(fd); return -1; }
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if ( cq_ptr == MAP_FAILED ) { close(fd); return -1; }
+	}
+	u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+				   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				   fd, IORING_OFF_SQES);
+	if ( u->sqes == MAP_FAILED ) { close(fd); return -1; }
+
+	u->fd = fd;
+	u->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+	u->sq_entries = (unsigned *)(sq_ptr + p.sq_off.ring_entries);
+	u->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+	u->cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+	u->sq_local_tail = *u->sq_tail;
+
+	return 0;
+}
+
+/* Publish the queued sqes, submit them, and optionally wait for
+   "min_complete" completions for up to "timeout" msecs (-1: forever) */
+static int
+ev_uring_enter (unsigned min_complete, int timeout)
+{
+	struct ev_uring *u = &ev.ur;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned to_submit, flags;
+	int r;
+
+	__atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+
+	flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+	if ( ! to_submit && ! flags ) return 0;
+
+	memset(&arg, 0, sizeof(arg));
+	if ( min_complete && timeout >= 0 ) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		arg.ts = (__u64)(unsigned long)&ts;
+	}
+	flags |= IORING_ENTER_EXT_ARG;
+
+	r = syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete,
+				flags, &arg, sizeof(arg));
+	if ( r < 0 && (errno == ETIME || errno == EINTR) ) r = 0;
+
+	return r;
+}
+
+static struct io_uring_sqe *
+ev_uring_sqe (void)
+{
+	struct ev_uring *u = &ev.ur;
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if ( u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE)
+		 >= *u->sq_entries ) {
+		/* submission queue full, push it to the kernel */
+		if ( ev_uring_enter(0, 0) < 0 ) return NULL;
+		if ( u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE)
+			 >= *u->sq_entries ) {
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+
+	idx = u->sq_local_tail & *u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	u->sq_local_tail++;
+
+	return sqe;
+}
+
+static int
+ev_uring_poll (int fd, int events)
+{
+	struct io_uring_sqe *sqe;
+	int tag;
+
+	tag = (events & EV_READ) ? UD_POLL_IN : UD_POLL_OUT;
+	sqe = ev_uring_sqe();
+	if ( ! sqe ) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = (events & EV_READ) ? POLLIN : POLLOUT;
+	sqe->user_data = UD(fd, tag);
+	ev.fds[fd].polling |= events;
+
+	return 0;
+}
+
+/* queue a read on "fd", linked behind a poll so that it also works on
+   non-blocking filedes */
+static int
+ev_uring_read (int fd)
+{
+	struct ev_uq *uq = ev.fds[fd].uq;
+	struct io_uring_sqe *sqe;
+
+	sqe = ev_uring_sqe();
+	if ( ! sqe ) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = UD(fd, UD_LINK_POLL);
+
+	sqe = ev_uring_sqe();
+	if ( ! sqe ) return -1;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (__u64)(unsigned long)uq->rbuff;
+	sqe->len = EV_RDQ_SZ;
+	sqe->off = (__u64)-1;
+	sqe->user_data = UD(fd, UD_READ);
+	uq->rqueued = 1;
+
+	return 0;
+}
+
+/* queue a write of the buffered data of "fd", linked behind a poll so
+   that it also works on non-blocking filedes */
+static int
+ev_uring_write (int fd)
+{
+	struct ev_uq *uq = ev.fds[fd].uq;
+	struct io_uring_sqe *sqe;
+
+	sqe = ev_uring_sqe();
+	if ( ! sqe ) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLOUT;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = UD(fd, UD_LINK_POLL);
+
+	sqe = ev_uring_sqe();
+	if ( ! sqe ) return -1;
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = fd;
+	sqe->addr = (__u64)(unsigned long)(uq->wbuff + uq->woff);
+	sqe->len = uq->wlen - uq->woff;
+	sqe->off = (__u64)-1;
+	sqe->user_data = UD(fd, UD_WRITE);
+	uq->winflight = 1;
+
+	return 0;
+}
+
+static void
+ev_uring_complete (__u64 ud, int res)
+{
+	struct ev_fd *f;
+	struct ev_uq *uq;
+	int fd, tag;
+
+	fd = ud >> 8;
+	tag = ud & 0xff;
+	if ( fd >= ev.nfds ) return;
+	f = &ev.fds[fd];
+	uq = f->uq;
+
+	switch (tag) {
+	case UD_POLL_IN:
+	case UD_POLL_OUT:
+		f->polling &= ~((tag == UD_POLL_IN) ? EV_READ : EV_WRITE);
+		if ( res == -ECANCELED || ! f->events ) break;
+		if ( res < 0 || (res & (POLLERR | POLLHUP)) )
+			f->pending |= f->events & (EV_READ | EV_WRITE);
+		if ( res > 0 && (res & POLLIN) ) f->pending |= EV_READ;
+		if ( res > 0 && (res & POLLOUT) ) f->pending |= EV_WRITE;
+		break;
+	case UD_READ:
+		uq->rqueued = 0;
+		if ( res > 0 ) {
+			uq->rlen = res;
+			uq->roff = 0;
+		} else if ( res == 0 ) {
+			uq->rerr = -1;
+		} else if ( res == -EAGAIN || res == -EINTR || res == -ECANCELED ) {
+			/* requeued by ev_uring_prepare() */
+			break;
+		} else {
+			uq->rerr = -res;
+		}
+		if ( f->events ) f->pending |= EV_READ;
+		break;
+	case UD_WRITE:
+		uq->winflight = 0;
+		if ( res > 0 ) {
+			uq->woff += res;
+			if ( uq->woff == uq->wlen ) uq->woff = uq->wlen = 0;
+		} else if ( res != -EAGAIN && res != -EINTR && res != -ECANCELED ) {
+			/* drop the data, report the error on the next call */
+			uq->werr = res ? -res : EIO;
+			uq->woff = uq->wlen = 0;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+ev_uring_reap (void)
+{
+	struct ev_uring *u = &ev.ur;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	while ( head != tail ) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		ev_uring_complete(cqe->user_data, cqe->res);
+		head++;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* filedes written with ev_writev() are writable when there is room
+   in their buffer; they are never polled for EV_WRITE */
+static void
+ev_uring_wready (void)
+{
+	struct ev_fd *f;
+	int fd, want;
+
+	for (fd = 0; fd <= ev.maxfd; fd++) {
+		f = &ev.fds[fd];
+		if ( ! f->uq || ! f->uq->wbuff || ! (f->events & EV_WRITE) )
+			continue;
+		want = (f->events & EV_ET) ? f->armed : f->events;
+		if ( (want & EV_WRITE) && f->uq->wlen < EV_WRQ_SZ )
+			f->pending |= EV_WRITE;
+	}
+}
+
+/* queue the polls, reads and writes every filedes needs */
+static int
+ev_uring_prepare (void)
+{
+	struct ev_fd *f;
+	struct ev_uq *uq;
+	int fd, want;
+
+	for (fd = 0; fd < ev.nfds; fd++) {
+		f = &ev.fds[fd];
+		uq = f->uq;
+		if ( uq && uq->wlen > uq->woff && ! uq->winflight )
+			if ( ev_uring_write(fd) < 0 ) return -1;
+		if ( ! f->events ) continue;
+		want = (f->events & EV_ET) ? f->armed : f->events;
+		want &= (EV_READ | EV_WRITE) & ~f->polling & ~f->pending;
+		if ( uq && uq->wbuff )
+			want &= ~EV_WRITE;
+		if ( uq && uq->rbuff ) {
+			/* reads are kept queued instead of polling */
+			want &= ~EV_READ;
+			if ( ! uq->rqueued && uq->roff == uq->rlen && ! uq->rerr )
+				if ( ev_uring_read(fd) < 0 ) return -1;
+		}
+		if ( (want & EV_READ) && ev_uring_poll(fd, EV_READ) < 0 )
+			return -1;
+		if ( (want & EV_WRITE) && ev_uring_poll(fd, EV_WRITE) < 0 )
+			return -1;
+	}
+
+	return 0;
+}
+
+static struct ev_uq *
+ev_uring_uq (int fd)
+{
+	struct ev_fd *f;
+
+	f = ev_slot(fd);
+	if ( ! f ) return NULL;
+	if ( ! f->uq ) {
+		f->uq = calloc(1, sizeof(*f->uq));
+		if ( ! f->uq ) return NULL;
+	}
+
+	return f->uq;
+}
+
+static int
+ev_uring_add (int fd, int events)
+{
+	struct ev_uq *uq;
+
+	if ( (events & EV_ET) && (events & EV_READ) ) {
+		uq = ev_uring_uq(fd);
+		if ( ! uq ) return -1;
+		if ( ! uq->rbuff ) {
+			uq->rbuff = malloc(EV_RDQ_SZ);
+			if ( ! uq->rbuff ) return -1;
+		}
+		uq->rlen = uq->roff = 0;
+		uq->rerr = 0;
+	}
+
+	return 0;
+}
+
+/* cancel the polls and the queued read of "fd", and wait for the read
+   to be gone: nothing reads from "fd" after that. The poll a read is
+   linked behind must be cancelled too, or the read is not found until
+   the poll fires. A write linked behind its poll is cancelled as well,
+   and queued again by ev_uring_prepare() */
+static void
+ev_uring_del (int fd)
+{
+	struct ev_fd *f = &ev.fds[fd];
+	struct io_uring_sqe *sqe;
+	static const int tags[] = {
+		UD_POLL_IN, UD_POLL_OUT, UD_LINK_POLL, UD_READ
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+		sqe = ev_uring_sqe();
+		if ( ! sqe ) break;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = UD(fd, tags[i]);
+		sqe->user_data = UD(fd, UD_CANCEL);
+	}
+	ev_uring_enter(0, 0);
+	while ( f->uq && f->uq->rqueued ) {
+		if ( ev_uring_enter(1, -1) < 0 ) break;
+		ev_uring_reap();
+	}
+	f->pending = 0;
+	if ( f->uq ) {
+		/* the buffer stays allocated, for the read in flight */
+		f->uq->rlen = f->uq->roff = 0;
+		f->uq->rerr = 0;
+	}
+}
+
+static int
+ev_wait_uring (struct ev_event *evs, int maxevs, int timeout)
+{
+	struct ev_fd *f;
+	int fd, n, any, got;
+
+	if ( ev_uring_prepare() < 0 ) return -1;
+	ev_uring_wready();
+
+	any = 0;
+	for (fd = 0; fd <= ev.maxfd && ! any; fd++)
+		if ( ev.fds[fd].pending ) any = 1;
+
+	if ( ev_uring_enter((any || timeout == 0) ? 0 : 1, timeout) < 0 )
+		return -1;
+	ev_uring_reap();
+	ev_uring_wready();
+
+	n = 0;
+	for (fd = 0; fd <= ev.maxfd && n < maxevs; fd++) {
+		f = &ev.fds[fd];
+		got = f->pending & f->events & (EV_READ | EV_WRITE);
+		f->pending = 0;
+		if ( ! got ) continue;
+		if ( f->events & EV_ET )
+			f->armed &= ~got;
+		evs[n].fd = fd;
+		evs[n].events = got;
+		n++;
+	}
+
+	return n;
+}
+
+/* wait until all buffered data of "fd" have been written */
+static int
+ev_uring_flush (int fd)
+{
+	struct ev_uq *uq = ev.fds[fd].uq;
+
+	while ( uq->wlen || uq->winflight ) {
+		if ( ! uq->winflight )
+			if ( ev_uring_write(fd) < 0 ) return -1;
+		if ( ev_uring_enter(1, -1) < 0 ) return -1;
+		ev_uring_reap();
+	}
+	if ( uq->werr ) {
+		errno = uq->werr;
+		uq->werr = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+#endif /* of EV_HAVE_URING */
+
+/**********************************************************************/
+
+int
+ev_init (enum ev_backend_e backend)
+{
+	if ( ev.init ) { errno = EBUSY; return -1; }
+
+	if ( backend == EV_DEFAULT ) {
+#ifdef __linux__
+		backend = EV_EPOLL;
+#else
+		backend = EV_SELECT;
+#endif
+	}
+
+	switch (backend) {
+	case EV_SELECT:
+		break;
+	case EV_EPOLL:
+#ifdef __linux__
+		ev.epfd = epoll_create1(EPOLL_CLOEXEC);
+		if ( ev.epfd < 0 ) return -1;
+		break;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	case EV_URING:
+#ifdef EV_HAVE_URING
+		if ( ev_uring_setup() < 0 ) return -1;
+		break;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	ev.backend = backend;
+	ev.maxfd = -1;
+	ev.init = 1;
+
+	return 0;
+}
+
+const char *
+ev_backend_name (void)
+{
+	return ev_backend_str[ev.backend];
+}
+
+/**********************************************************************/
+
+int
+ev_add (int fd, int events)
+{
+	struct ev_fd *f;
+
+	if ( ! ev.init ) { errno = EINVAL; return -1; }
+
+	f = ev_slot(fd);
+	if ( ! f ) return -1;
+	if ( f->events ) { errno = EEXIST; return -1; }
+
+	switch (ev.backend) {
+	case EV_SELECT:
+		if ( fd >= FD_SETSIZE ) { errno = EINVAL; return -1; }
+		break;
+#ifdef __linux__
+	case EV_EPOLL: {
+		struct epoll_event ee;
+
+		memset(&ee, 0, sizeof(ee));
+		ee.data.fd = fd;
+		if ( events & EV_READ ) ee.events |= EPOLLIN;
+		if ( events & EV_WRITE ) ee.events |= EPOLLOUT;
+		if ( events & EV_ET ) ee.events |= EPOLLET;
+		if ( epoll_ctl(ev.epfd, EPOLL_CTL_ADD, fd, &ee) < 0 )
+			return -1;
+		break;
+	}
+#endif
+#ifdef EV_HAVE_URING
+	case EV_URING:
+		if ( ev_uring_add(fd, events) < 0 ) return -1;
+		f = &ev.fds[fd];
+		break;
+#endif
+	default:
+		break;
+	}
+
+	f->events = events;
+	f->armed = events & (EV_READ | EV_WRITE);
+	if ( fd > ev.maxfd ) ev.maxfd = fd;
+
+	return 0;
+}
+
+int
+ev_del (int fd)
+{
+	if ( ! ev.init ) { errno = EINVAL; return -1; }
+	if ( fd < 0 || fd >= ev.nfds || ! ev.fds[fd].events ) {
+		errno = ENOENT;
+		return -1;
+	}
+
+#ifdef __linux__
+	if ( ev.backend == EV_EPOLL )
+		epoll_ctl(ev.epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+#ifdef EV_HAVE_URING
+	if ( ev.backend == EV_URING )
+		ev_uring_del(fd);
+#endif
+
+	ev.fds[fd].events = 0;
+	ev.fds[fd].armed = 0;
+	while ( ev.maxfd >= 0 && ! ev.fds[ev.maxfd].events )
+		ev.maxfd--;
+
+	return 0;
+}
+
+int
+ev_rearm (int fd, int events)
+{
+	if ( ! ev.init ) { errno = EINVAL; return -1; }
+	if ( fd < 0 || fd >= ev.nfds || ! ev.fds[fd].events ) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	ev.fds[fd].armed |= events & ev.fds[fd].events & (EV_READ | EV_WRITE);
+
+	return 0;
+}
+
+/**********************************************************************/
+
+static int
+ev_wait_select (struct ev_event *evs, int maxevs, int timeout)
+{
+	fd_set rdset, wrset;
+	struct timeval tv, *tvp;
+	int r, fd, n, want, got;
+
+	FD_ZERO(&rdset);
+	FD_ZERO(&wrset);
+	for (fd = 0; fd <= ev.maxfd; fd++) {
+		if ( ! ev.fds[fd].events ) continue;
+		if ( ev.fds[fd].events & EV_ET )
+			want = ev.fds[fd].armed;
+		else
+			want = ev.fds[fd].events;
+		if ( want & EV_READ ) FD_SET(fd, &rdset);
+		if ( want & EV_WRITE ) FD_SET(fd, &wrset);
+	}
+
+	if ( timeout >= 0 ) {
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		tvp = &tv;
+	} else {
+		tvp = NULL;
+	}
+
+	r = select(ev.maxfd + 1, &rdset, &wrset, NULL, tvp);
+	if ( r < 0 ) return ( errno == EINTR ) ? 0 : -1;
+
+	n = 0;
+	for (fd = 0; fd <= ev.maxfd && n < maxevs; fd++) {
+		got = 0;
+		if ( FD_ISSET(fd, &rdset) ) got |= EV_READ;
+		if ( FD_ISSET(fd, &wrset) ) got |= EV_WRITE;
+		if ( ! got ) continue;
+		if ( ev.fds[fd].events & EV_ET )
+			ev.fds[fd].armed &= ~got;
+		evs[n].fd = fd;
+		evs[n].events = got;
+		n++;
+	}
+
+	return n;
+}
+
+#ifdef __linux__
+
+static int
+ev_wait_epoll (struct ev_event *evs, int maxevs, int timeout)
+{
+	struct epoll_event ee[EV_BATCH];
+	int r, i;
+
+	if ( maxevs > EV_BATCH ) maxevs = EV_BATCH;
+
+	r = epoll_wait(ev.epfd, ee, maxevs, timeout);
+	if ( r < 0 ) return ( errno == EINTR ) ? 0 : -1;
+
+	for (i = 0; i < r; i++) {
+		evs[i].fd = ee[i].data.fd;
+		evs[i].events = 0;
+		if ( ee[i].events & EPOLLIN ) evs[i].events |= EV_READ;
+		if ( ee[i].events & EPOLLOUT ) evs[i].events |= EV_WRITE;
+		if ( ee[i].events & (EPOLLERR | EPOLLHUP) )
+			evs[i].events |= EV_READ | EV_WRITE;
+	}
+
+	return r;
+}
+
+#endif /* of __linux__ */
+
+int
+ev_wait (struct ev_event *evs, int maxevs, int timeout)
+{
+	if ( ! ev.init ) { errno = EINVAL; return -1; }
+
+	switch (ev.backend) {
+#ifdef __linux__
+	case EV_EPOLL:
+		return ev_wait_epoll(evs, maxevs, timeout);
+#endif
+#ifdef EV_HAVE_URING
+	case EV_URING:
+		return ev_wait_uring(evs, maxevs, timeout);
+#endif
+	case EV_SELECT:
+		return ev_wait_select(evs, maxevs, timeout);
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+/**********************************************************************/
+
+ssize_t
+ev_read (int fd, void *buff, size_t n)
+{
+#ifdef EV_HAVE_URING
+	struct ev_uq *uq;
+
+	if ( ev.backend == EV_URING && fd >= 0 && fd < ev.nfds
+		 && (uq = ev.fds[fd].uq) && uq->rbuff ) {
+		if ( uq->roff < uq->rlen ) {
+			if ( n > (size_t)(uq->rlen - uq->roff) )
+				n = uq->rlen - uq->roff;
+			memcpy(buff, uq->rbuff + uq->roff, n);
+			uq->roff += n;
+			return n;
+		}
+		if ( uq->rerr < 0 ) return 0;
+		errno = uq->rerr ? uq->rerr : EAGAIN;
+		return -1;
+	}
+#endif
+
+	return read(fd, buff, n);
+}
+
+ssize_t
+ev_writev (int fd, const struct iovec *iov, int cnt)
+{
+#ifdef EV_HAVE_URING
+	struct ev_uq *uq;
+	size_t l, n;
+	int i;
+
+	if ( ev.backend == EV_URING ) {
+		uq = ev_uring_uq(fd);
+		if ( ! uq ) return -1;
+		if ( ! uq->wbuff ) {
+			uq->wbuff = malloc(EV_WRQ_SZ);
+			if ( ! uq->wbuff ) return -1;
+		}
+		if ( uq->werr ) {
+			errno = uq->werr;
+			uq->werr = 0;
+			return -1;
+		}
+		if ( ! uq->winflight && uq->woff ) {
+			memmove(uq->wbuff, uq->wbuff + uq->woff, uq->wlen - uq->woff);
+			uq->wlen -= uq->woff;
+			uq->woff = 0;
+		}
+		n = 0;
+		for (i = 0; i < cnt && uq->wlen < EV_WRQ_SZ; i++) {
+			l = iov[i].iov_len;
+			if ( l > EV_WRQ_SZ - uq->wlen ) l = EV_WRQ_SZ - uq->wlen;
+			memcpy(uq->wbuff + uq->wlen, iov[i].iov_base, l);
+			uq->wlen += l;
+			n += l;
+		}
+		if ( n == 0 && cnt > 0 ) {
+			errno = EAGAIN;
+			return -1;
+		}
+		return n;
+	}
+#endif
+
+	return writev(fd, iov, cnt);
+}
+
+int
+ev_flush (int fd)
+{
+#ifdef EV_HAVE_URING
+	if ( ev.backend == EV_URING && fd >= 0 && fd < ev.nfds
+		 && ev.fds[fd].uq && ev.fds[fd].uq->wbuff )
+		return ev_uring_flush(fd);
+#endif
+
+	return 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
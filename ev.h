@@ -0,0 +1,206 @@
+/* vi: set sw=4 ts=4:
+ *
+ * ev.h
+ *
+ * Minimal I/O event-loop layer. Hides the readiness-notification
+ * mechanism (epoll(7), io_uring(7), or select(2) where neither is
+ * available) behind a small interface, so that file-descriptors are
+ * registered once and not re-scanned on every wakeup.
+ *
+ * Principles of operation:
+ *
+ * File-descriptors are added to the loop with the events the caller
+ * is interested in (EV_READ, EV_WRITE). By default notification is
+ * level-triggered: an event is reported for as long as the condition
+ * holds. If EV_ET is also given, notification is edge-triggered: once
+ * an event has been reported for a filedes, it is not reported again
+ * until the caller has consumed the condition (by reading or writing
+ * until the call would block) and has called ev_rearm() for it. With
+ * the epoll backend ev_rearm() costs nothing, since the kernel
+ * generates the edges; other backends use it to re-enable interest.
+ * Filedes registered with EV_ET should be in non-blocking mode.
+ *
+ * Data should be moved with ev_read() and ev_writev() instead of
+ * read(2) and writev(2). With the select and epoll backends these are
+ * the plain system calls. With the io_uring backend a read is kept
+ * queued on every filedes registered with EV_READ | EV_ET, and
+ * ev_read() hands out the data it returned; ev_writev() copies the
+ * data to a per-filedes buffer, and the write is submitted together
+ * with the next ev_wait(). Such a filedes is reported writable when
+ * there is room in its buffer. ev_flush() waits for the buffered
+ * writes to complete, and must be called before writing to the same
+ * filedes by other means.
+ *
+ * Interface summary:
+ *
+ * F ev_init - initialize the loop with a given backend
+ * F ev_backend_name - name of the backend in use
+ * F ev_add - add a filedes to the loop
+ * F ev_del - remove a filedes from the loop
+ * F ev_rearm - re-enable edge-triggered notification for a filedes
+ * F ev_wait - wait for events
+ * F ev_read - read from a filedes in the loop
+ * F ev_writev - write to a filedes
+ * F ev_flush - wait for the writes submitted by ev_writev
+ * E ev_backend_e - available backends
+ * M EV_READ, EV_WRITE, EV_ET - event flags
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef EV_H
+#define EV_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(USE_IO_URING)
+#define EV_HAVE_URING
+#endif
+
+/* M EV_READ, EV_WRITE, EV_ET
+ *
+ * Event flags. EV_READ and EV_WRITE are both used to register
+ * interest, and to report events. Error and hang-up conditions are
+ * reported as EV_READ | EV_WRITE, so that the following read(2) or
+ * write(2) returns the error. EV_ET is only used when registering.
+ */
+#define EV_READ  (1 << 0)
+#define EV_WRITE (1 << 1)
+#define EV_ET    (1 << 2)
+
+/* E ev_backend_e
+ *
+ * EV_DEFAULT - the best backend available on this system
+ * EV_SELECT - select(2), available everywhere
+ * EV_EPOLL - epoll(7), Linux only
+ * EV_URING - io_uring(7), Linux 5.11 or later, and only if compiled
+ *     with USE_IO_URING. Never selected by default.
+ */
+enum ev_backend_e {
+	EV_DEFAULT,
+	EV_SELECT,
+	EV_EPOLL,
+	EV_URING
+};
+
+/* An event, as reported by ev_wait() */
+struct ev_event {
+	int fd;
+	int events;
+};
+
+/* F ev_init
+ *
+ * Initialize the loop, using backend "backend". Must be called before
+ * any other ev_* function, and only once.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success. Fails with ENOSYS if the backend is not available.
+ */
+int ev_init (enum ev_backend_e backend);
+
+/* F ev_backend_name
+ *
+ * Returns the name of the backend in use.
+ */
+const char *ev_backend_name (void);
+
+/* F ev_add
+ *
+ * Add filedes "fd" to the loop, with interest in "events" (a
+ * combination of EV_READ, EV_WRITE, and EV_ET). Edge-triggered
+ * filedes start armed for all the events given.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int ev_add (int fd, int events);
+
+/* F ev_del
+ *
+ * Remove filedes "fd" from the loop. With the io_uring backend, the
+ * read kept queued on it is cancelled, and waited for; data it had
+ * already returned are discarded. Nothing reads from "fd" afterwards
+ * (e.g. it can be handed to another process), until it is added
+ * again.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int ev_del (int fd);
+
+/* F ev_rearm
+ *
+ * Re-enable notification of "events" for the edge-triggered filedes
+ * "fd". Must be called after the respective condition has been
+ * consumed (e.g. read(2) or write(2) failed with EAGAIN).
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int ev_rearm (int fd, int events);
+
+/* F ev_wait
+ *
+ * Wait for events on the filedes in the loop for up to "timeout"
+ * milliseconds (-1 means forever, 0 means do not block). At most
+ * "maxevs" events are stored in "evs".
+ *
+ * Returns the number of events stored, zero on timeout, or negative
+ * on failure (errno is set). Interruption by a signal is not
+ * considered a failure: zero events are returned instead.
+ */
+int ev_wait (struct ev_event *evs, int maxevs, int timeout);
+
+/* F ev_read
+ *
+ * Read up to "n" bytes from filedes "fd" into "buff". Same semantics
+ * as read(2); fails with EAGAIN if no data are available yet.
+ */
+ssize_t ev_read (int fd, void *buff, size_t n);
+
+/* F ev_writev
+ *
+ * Write the "cnt" buffers described by "iov" to filedes "fd". Same
+ * semantics as writev(2), except that with the io_uring backend the
+ * data are only queued (never blocking; EAGAIN if there is no room),
+ * and errors are reported by a later call to ev_writev() or
+ * ev_flush().
+ */
+ssize_t ev_writev (int fd, const struct iovec *iov, int cnt);
+
+/* F ev_flush
+ *
+ * Wait until all data queued by ev_writev() for filedes "fd" have been
+ * written.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int ev_flush (int fd);
+
+#endif /* of EV_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,294 @@
+/* vi: set sw=4 ts=4:
+ *
+ * frecv.c
+ *
+ * Built-in raw receiver.
+ *
+ * Documentation can be found in the header file "frecv.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "frecv.h"
+
+/**********************************************************************/
+
+static struct {
+	int open;
+	int fd;                     /* the file */
+	int pipe[2];                /* port to file, with splice */
+	int tfd;                    /* timerfd */
+	unsigned long long max;     /* bytes to receive, or 0 */
+	uint64_t idle_ns;           /* or 0 */
+	unsigned char mark[FRECV_MARK_MAX];
+	size_t mlen;                /* or 0 */
+	size_t fail[FRECV_MARK_MAX];    /* KMP failure function */
+	size_t mst;                 /* bytes of the marker matched */
+	const char *end;            /* set once the receive has ended */
+	/* statistics */
+	struct xm_stats_s st;
+	uint64_t t0, t1;            /* first and last data */
+} fr = { .fd = -1, .pipe = { -1, -1 }, .tfd = -1 };
+
+static char fr_errbuf[256];
+
+static uint64_t
+fr_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+fr_fail_errno (const char *what)
+{
+	snprintf(fr_errbuf, sizeof(fr_errbuf), "%s: %s", what, strerror(errno));
+	fr.st.err = fr_errbuf;
+	fr.end = "failed";
+}
+
+/* "n" bytes have been stored */
+static void
+fr_got (size_t n)
+{
+	fr.t1 = fr_now();
+	if ( ! fr.t0 ) fr.t0 = fr.t1;
+	fr.st.bytes += n;
+	if ( fr.max && fr.st.bytes >= fr.max ) fr.end = "byte count reached";
+}
+
+/* Returns the number of the "n" bytes at "p" up to the end of the
+   marker, or "n" if it does not end there */
+static size_t
+fr_scan (const unsigned char *p, size_t n)
+{
+	const unsigned char *q;
+	size_t i = 0;
+
+	while ( i < n ) {
+		if ( fr.mst == 0 ) {
+			q = memchr(p + i, fr.mark[0], n - i);
+			if ( ! q ) return n;
+			i = q - p + 1;
+			fr.mst = 1;
+		} else {
+			while ( fr.mst && p[i] != fr.mark[fr.mst] )
+				fr.mst = fr.fail[fr.mst - 1];
+			if ( p[i] == fr.mark[fr.mst] ) fr.mst++;
+			i++;
+		}
+		if ( fr.mst == fr.mlen ) {
+			fr.end = "end marker received";
+			return i;
+		}
+	}
+
+	return n;
+}
+
+/* Write the "n" bytes at "p" to the file, as far as the end. Returns
+   the number of bytes up to the end */
+static size_t
+fr_store (const unsigned char *p, size_t n)
+{
+	size_t len, left;
+	ssize_t r;
+
+	if ( fr.max && n > fr.max - fr.st.bytes ) n = fr.max - fr.st.bytes;
+	if ( fr.mlen ) n = fr_scan(p, n);
+	for (len = left = n; left; left -= r) {
+		r = write(fr.fd, p, left);
+		if ( r < 0 && errno == EINTR ) { r = 0; continue; }
+		if ( r < 0 ) {
+			fr_fail_errno("write");
+			break;
+		}
+		fr_got(r);
+		p += r;
+	}
+
+	return len;
+}
+
+/**********************************************************************/
+
+int
+frecv_open (const char *path, unsigned long long max, long idle_ms,
+			const void *mark, size_t mlen)
+{
+	struct itimerspec its;
+	long tick_ms;
+	size_t i, k;
+	int e;
+
+	if ( fr.open ) { errno = EBUSY; return -1; }
+	if ( mlen > FRECV_MARK_MAX ) { errno = EINVAL; return -1; }
+
+	memset(&fr, 0, sizeof(fr));
+	fr.fd = fr.pipe[0] = fr.pipe[1] = -1;
+	fr.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if ( fr.tfd < 0 ) goto fail;
+	if ( pipe2(fr.pipe, O_CLOEXEC) < 0 ) goto fail;
+	fr.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if ( fr.fd < 0 ) goto fail;
+
+	fr.max = max;
+	fr.idle_ns = (uint64_t)idle_ms * 1000000;
+	memcpy(fr.mark, mark, mlen);
+	fr.mlen = mlen;
+	/* fail[i]: the longest proper prefix of the marker that is also a
+	   suffix of its first i + 1 bytes */
+	for (i = 1, k = 0; i < mlen; i++) {
+		while ( k && fr.mark[i] != fr.mark[k] ) k = fr.fail[k - 1];
+		if ( fr.mark[i] == fr.mark[k] ) k++;
+		fr.fail[i] = k;
+	}
+
+	tick_ms = ( idle_ms && idle_ms < 4000 ) ? idle_ms / 4 : 1000;
+	if ( tick_ms < 1 ) tick_ms = 1;
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = tick_ms / 1000;
+	its.it_interval.tv_nsec = (tick_ms % 1000) * 1000000;
+	its.it_value = its.it_interval;
+	if ( timerfd_settime(fr.tfd, 0, &its, NULL) < 0 ) goto fail;
+	fr.open = 1;
+
+	return 0;
+
+fail:
+	e = errno;
+	if ( fr.fd >= 0 ) close(fr.fd);
+	if ( fr.pipe[0] >= 0 ) { close(fr.pipe[0]); close(fr.pipe[1]); }
+	if ( fr.tfd >= 0 ) close(fr.tfd);
+	fr.fd = fr.pipe[0] = fr.pipe[1] = fr.tfd = -1;
+	errno = e;
+	return -1;
+}
+
+int
+frecv_timer_fd (void)
+{
+	return fr.open ? fr.tfd : -1;
+}
+
+void
+frecv_tick (void)
+{
+	uint64_t exp;
+
+	if ( ! fr.open ) return;
+	while ( read(fr.tfd, &exp, sizeof(exp)) < 0 && errno == EINTR )
+		/* nothing */ ;
+	if ( ! fr.end && fr.idle_ns && fr.t1 && fr_now() - fr.t1 >= fr.idle_ns )
+		fr.end = "idle time reached";
+}
+
+ssize_t
+frecv_read (int fd, size_t len)
+{
+	ssize_t n, r;
+	size_t left;
+
+	if ( ! fr.open || fr.end ) { errno = EAGAIN; return -1; }
+	if ( fr.mlen ) { errno = EINVAL; return -1; }
+
+	/* leave what follows the byte count in the port */
+	if ( fr.max && len > fr.max - fr.st.bytes ) len = fr.max - fr.st.bytes;
+
+	n = splice(fd, NULL, fr.pipe[1], NULL, len,
+			   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if ( n <= 0 ) return n;
+	/* the pipe was empty, and takes all of it at once */
+	for (left = n; left; left -= r) {
+		r = splice(fr.pipe[0], NULL, fr.fd, NULL, left, SPLICE_F_MOVE);
+		if ( r < 0 && errno == EINTR ) { r = 0; continue; }
+		if ( r <= 0 ) {
+			if ( r == 0 ) errno = EIO;
+			fr_fail_errno("splice");
+			return n;
+		}
+		fr_got(r);
+	}
+
+	return n;
+}
+
+size_t
+frecv_input (const unsigned char *buff, size_t len)
+{
+	if ( ! fr.open || fr.end ) return 0;
+
+	return fr_store(buff, len);
+}
+
+int
+frecv_fill (struct ring *q)
+{
+	return fr.open && ! fr.end;
+}
+
+void
+frecv_cancel (void)
+{
+	if ( fr.open && ! fr.end ) fr.end = "stopped";
+}
+
+void
+frecv_stats (struct xm_stats_s *st)
+{
+	*st = fr.st;
+	st->files = ( fr.end && ! fr.st.err );
+	st->elapsed_ns = fr.t1 - fr.t0;
+	st->end = fr.end;
+}
+
+void
+frecv_close (struct xm_stats_s *st)
+{
+	if ( ! fr.open ) return;
+
+	if ( ! fr.end ) fr.end = "stopped";
+	if ( st ) frecv_stats(st);
+	close(fr.fd);
+	close(fr.pipe[0]);
+	close(fr.pipe[1]);
+	close(fr.tfd);
+	fr.fd = fr.pipe[0] = fr.pipe[1] = fr.tfd = -1;
+	fr.open = 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,168 @@
+/* vi: set sw=4 ts=4:
+ *
+ * frecv.h
+ *
+ * Built-in raw receiver. Stores what a port receives into a file, as
+ * is, until a number of bytes has been received, the port has been
+ * idle for some time, or an end marker has been received; for
+ * example, a memory dump sent by a device. No process is spawned.
+ *
+ * Principles of operation:
+ *
+ * The interface is that of the transfer modules (see "xmodem.h"),
+ * with the same statistics, and two additions. frecv_read() takes the
+ * data from the port itself: it moves them with splice(2), from the
+ * port to a pipe and from the pipe to the file, without copying them
+ * to user space, and never takes more than the byte count left. When
+ * the data must be seen, to look for the end marker, or when the
+ * caller also logs them, the caller reads them, and frecv_input()
+ * stores them; it tells how many belong to the receive, and the rest
+ * are the caller's to show. Either way, nothing after the end is
+ * lost.
+ *
+ * The end marker is looked for with the Knuth-Morris-Pratt algorithm,
+ * so it is found even when split between two reads, and memchr(3)
+ * skips to the candidate positions. The marker is stored too: the
+ * file ends with it.
+ *
+ * The idle time counts from the last byte received, and is checked
+ * by a periodic timer (a timerfd(2), at a quarter of the idle time,
+ * and at least every second); the receiver waits for the first byte
+ * as long as it takes. The time and throughput reported are those
+ * from the first byte received to the last.
+ *
+ * Interface summary:
+ *
+ * F frecv_open - start receiving into a file
+ * F frecv_timer_fd - the idle timer
+ * F frecv_tick - handle the idle timer
+ * F frecv_read - move data from the port to the file
+ * F frecv_input - store data received from the port
+ * F frecv_fill - tell whether the receive has ended
+ * F frecv_cancel - stop receiving
+ * F frecv_stats - get the statistics so far
+ * F frecv_close - end the receive, and get the statistics
+ * M FRECV_MARK_MAX - longest end marker
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef FRECV_H
+#define FRECV_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "ring.h"
+#include "xmodem.h"
+
+/* M FRECV_MARK_MAX
+ *
+ * The longest end marker, in bytes.
+ */
+#define FRECV_MARK_MAX 64
+
+/* F frecv_open
+ *
+ * Start receiving into file "path" (created, or truncated). The
+ * receive ends after "max" bytes, after "idle_ms" msec without data,
+ * or after the "mlen" bytes at "mark" have been received (each one
+ * if non-zero).
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int frecv_open (const char *path, unsigned long long max, long idle_ms,
+				const void *mark, size_t mlen);
+
+/* F frecv_timer_fd
+ *
+ * Returns the filedes of the idle timer, to be watched for reading by
+ * the caller, or negative if no receive is in progress.
+ */
+int frecv_timer_fd (void);
+
+/* F frecv_tick
+ *
+ * Called when the idle timer is readable: ends the receive if the
+ * port has been idle for long enough.
+ */
+void frecv_tick (void);
+
+/* F frecv_read
+ *
+ * Move up to "len" bytes from the port with filedes "fd" (in
+ * non-blocking mode) to the file. Not for receives with an end
+ * marker: their data are given to frecv_input().
+ *
+ * Returns as read(2) does: the number of bytes taken from the port,
+ * zero at end-of-file, and negative on failure (errno is set; EAGAIN
+ * once the receive has ended, EINVAL with an end marker). Failures to
+ * store the data do not make it fail, but end the receive.
+ */
+ssize_t frecv_read (int fd, size_t len);
+
+/* F frecv_input
+ *
+ * Store the "len" bytes at "buff", received from the port, up to the
+ * end of the receive.
+ *
+ * Returns the number of bytes taken: those up to the end. The rest
+ * are not part of the receive.
+ */
+size_t frecv_input (const unsigned char *buff, size_t len);
+
+/* F frecv_fill
+ *
+ * Nothing is ever sent: "q" is left alone. The function is there for
+ * the interface of the transfer modules.
+ *
+ * Returns 1 while the receive is in progress, 0 once it has ended.
+ */
+int frecv_fill (struct ring *q);
+
+/* F frecv_cancel
+ *
+ * Stop receiving. What has been received is kept, and this is not a
+ * failure: without a byte count, idle time or end marker, this is how
+ * a receive ends.
+ */
+void frecv_cancel (void);
+
+/* F frecv_stats
+ *
+ * Store the statistics of the receive in progress at "st".
+ */
+void frecv_stats (struct xm_stats_s *st);
+
+/* F frecv_close
+ *
+ * End the receive, and close the file. If "st" is not NULL, the
+ * statistics of the receive are stored there.
+ */
+void frecv_close (struct xm_stats_s *st);
+
+#endif /* of FRECV_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
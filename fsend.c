@@ -0,0 +1,254 @@
+/* vi: set sw=4 ts=4:
+ *
+ * fsend.c
+ *
+ * Built-in file sender.
+ *
+ * Documentation can be found in the header file "fsend.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "fsend.h"
+
+/**********************************************************************/
+
+static struct {
+	int open;
+	unsigned char *map;
+	size_t size;
+	size_t off;                 /* bytes of the file queued */
+	int ascii;
+	int cr;                     /* the last byte queued was a CR */
+	long char_us;
+	long line_us;
+	int tfd;                    /* timerfd, if paced */
+	int waiting;                /* for the timer */
+	uint64_t t0;
+	unsigned long long queued;
+} fs = { .tfd = -1 };
+
+static uint64_t
+fs_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* wait "us" microseconds before queuing more */
+static void
+fs_wait (long us)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = us / 1000000;
+	its.it_value.tv_nsec = (us % 1000000) * 1000;
+	/* if the timer cannot be set, go on without waiting */
+	if ( timerfd_settime(fs.tfd, 0, &its, NULL) == 0 )
+		fs.waiting = 1;
+}
+
+/* Queue up to "n" bytes of the file in "q", translating line endings
+   in ASCII mode. If "line", stop after the first LF. */
+static void
+fs_copy (struct ring *q, size_t n, int line)
+{
+	const unsigned char *p, *e, *lf;
+	size_t l, sp;
+
+	p = fs.map + fs.off;
+	e = p + n;
+	while ( p < e ) {
+		if ( ! fs.ascii && ! line ) {
+			lf = NULL;
+			l = e - p;
+		} else {
+			lf = memchr(p, '\n', e - p);
+			l = ( lf ? lf : e ) - p;
+		}
+		if ( l ) {
+			sp = ring_space(q);
+			if ( l > sp ) l = sp;
+			if ( ! l ) break;
+			ring_put(q, p, l);
+			fs.queued += l;
+			fs.cr = ( p[l - 1] == '\r' );
+			p += l;
+			if ( p != lf ) break;
+		}
+		/* at a LF */
+		if ( fs.ascii && ! fs.cr ) {
+			if ( ring_space(q) < 2 ) break;
+			ring_put(q, "\r\n", 2);
+			fs.queued += 2;
+		} else {
+			if ( ring_space(q) < 1 ) break;
+			ring_put(q, "\n", 1);
+			fs.queued++;
+		}
+		fs.cr = 0;
+		p++;
+		if ( line ) break;
+	}
+	fs.off = p - fs.map;
+}
+
+/**********************************************************************/
+
+int
+fsend_open (const char *path, int ascii, long char_us, long line_us)
+{
+	struct stat st;
+	int fd, e;
+
+	if ( fs.open ) { errno = EBUSY; return -1; }
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 ) return -1;
+	if ( fstat(fd, &st) < 0 ) goto fail;
+	if ( ! S_ISREG(st.st_mode) ) { errno = EINVAL; goto fail; }
+
+	fs.size = st.st_size;
+	fs.map = NULL;
+	if ( fs.size ) {
+		fs.map = mmap(NULL, fs.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( fs.map == MAP_FAILED ) goto fail;
+		madvise(fs.map, fs.size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	fd = -1;
+
+	fs.tfd = -1;
+	if ( char_us || line_us ) {
+		fs.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if ( fs.tfd < 0 ) {
+			e = errno;
+			if ( fs.map ) munmap(fs.map, fs.size);
+			errno = e;
+			return -1;
+		}
+	}
+
+	fs.off = 0;
+	fs.ascii = ascii;
+	fs.cr = 0;
+	fs.char_us = char_us;
+	fs.line_us = line_us;
+	fs.waiting = 0;
+	fs.queued = 0;
+	fs.t0 = fs_now();
+	fs.open = 1;
+
+	return 0;
+
+fail:
+	e = errno;
+	close(fd);
+	errno = e;
+	return -1;
+}
+
+int
+fsend_timer_fd (void)
+{
+	return fs.open ? fs.tfd : -1;
+}
+
+void
+fsend_tick (void)
+{
+	uint64_t exp;
+
+	if ( ! fs.open || fs.tfd < 0 ) return;
+	while ( read(fs.tfd, &exp, sizeof(exp)) < 0 && errno == EINTR )
+		/* nothing */ ;
+	fs.waiting = 0;
+}
+
+int
+fsend_ready (void)
+{
+	return fs.open && fs.off < fs.size && ! fs.waiting;
+}
+
+int
+fsend_fill (struct ring *q)
+{
+	size_t off;
+
+	if ( ! fs.open ) { errno = EBADF; return -1; }
+
+	if ( fs.off == fs.size ) return 0;
+	if ( fs.waiting ) return 1;
+
+	off = fs.off;
+	if ( fs.char_us ) {
+		fs_copy(q, 1, 0);
+		if ( fs.off > off )
+			fs_wait(fs.char_us + ( fs.map[off] == '\n' ? fs.line_us : 0 ));
+	} else if ( fs.line_us ) {
+		/* a line longer than the room in the queue goes out in
+		   pieces, with no wait in between */
+		fs_copy(q, fs.size - fs.off, 1);
+		if ( fs.off > off && fs.map[fs.off - 1] == '\n' )
+			fs_wait(fs.line_us);
+	} else {
+		fs_copy(q, fs.size - fs.off, 0);
+	}
+
+	return ( fs.off < fs.size ) ? 1 : 0;
+}
+
+void
+fsend_close (struct fsend_stats_s *st)
+{
+	if ( ! fs.open ) return;
+
+	if ( st ) {
+		st->size = fs.size;
+		st->done = fs.off;
+		st->queued = fs.queued;
+		st->elapsed_ns = fs_now() - fs.t0;
+	}
+	if ( fs.map ) munmap(fs.map, fs.size);
+	fs.map = NULL;
+	if ( fs.tfd >= 0 ) close(fs.tfd);
+	fs.tfd = -1;
+	fs.open = 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,129 @@
+/* vi: set sw=4 ts=4:
+ *
+ * fsend.h
+ *
+ * Built-in file sender. Feeds a file into the transmit queue of a
+ * port, in raw or ASCII mode, optionally paced, from within the event
+ * loop: no process is spawned, and the data received meanwhile keep
+ * being shown.
+ *
+ * Principles of operation:
+ *
+ * The file is mapped with mmap(2), and copied from the mapping into
+ * the queue (a "struct ring", see "ring.h") by fsend_fill(), as much
+ * as the queue has room for; the caller writes the queue to the port
+ * as usual. In ASCII mode, every LF that is not preceded by a CR is
+ * sent as CR LF.
+ *
+ * Without pacing, the file is queued as fast as the port takes it.
+ * With a character delay, one character is queued at a time; with
+ * only a line delay, one line at a time. After a character the sender
+ * waits for the character delay, after a line (its LF) for the line
+ * delay as well. The waits are timed with a timerfd(2): while waiting,
+ * fsend_fill() queues nothing, and the filedes returned by
+ * fsend_timer_fd() becomes readable when the wait is over.
+ *
+ * Interface summary:
+ *
+ * F fsend_open - start sending a file
+ * F fsend_timer_fd - the pacing timer
+ * F fsend_tick - acknowledge the pacing timer
+ * F fsend_ready - tell if fsend_fill() would queue something
+ * F fsend_fill - queue as much of the file as allowed
+ * F fsend_close - stop sending, and get the statistics
+ * T fsend_stats_s - statistics of a transfer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef FSEND_H
+#define FSEND_H
+
+#include <stdint.h>
+
+#include "ring.h"
+
+/* T fsend_stats_s
+ *
+ * Statistics of a transfer, as filled-in by fsend_close().
+ */
+struct fsend_stats_s {
+	unsigned long long size;     /* size of the file */
+	unsigned long long done;     /* bytes of the file queued */
+	unsigned long long queued;   /* bytes queued, after translation */
+	uint64_t elapsed_ns;         /* from fsend_open */
+};
+
+/* F fsend_open
+ *
+ * Start sending the file "path". If "ascii" is non-zero, line endings
+ * are translated. "char_us" and "line_us" are the character and line
+ * delays, in microseconds (zero for none).
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int fsend_open (const char *path, int ascii, long char_us, long line_us);
+
+/* F fsend_timer_fd
+ *
+ * Returns the filedes of the pacing timer, to be watched for reading
+ * by the caller, or negative if the transfer is not paced.
+ */
+int fsend_timer_fd (void);
+
+/* F fsend_tick
+ *
+ * Called when the pacing timer is readable: ends the current wait.
+ */
+void fsend_tick (void);
+
+/* F fsend_ready
+ *
+ * Returns non-zero if fsend_fill() would queue something now, given
+ * room in the queue: the file is not yet all queued, and the sender
+ * is not waiting for the pacing timer.
+ */
+int fsend_ready (void);
+
+/* F fsend_fill
+ *
+ * Copy as much of the file as allowed (by the pacing, and the room
+ * in ring "q") to "q".
+ *
+ * Returns 1 if there is more to send, 0 if the whole file has been
+ * queued, and negative on failure (errno is set).
+ */
+int fsend_fill (struct ring *q);
+
+/* F fsend_close
+ *
+ * Stop sending, and release the file. If "st" is not NULL, the
+ * statistics of the transfer are stored there.
+ */
+void fsend_close (struct fsend_stats_s *st);
+
+#endif /* of FSEND_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
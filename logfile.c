@@ -0,0 +1,299 @@
+/* vi: set sw=4 ts=4:
+ *
+ * logfile.c
+ *
+ * Asynchronous capture-to-file.
+ *
+ * Documentation can be found in the header file "logfile.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "logfile.h"
+
+/**********************************************************************/
+
+static struct {
+	int open;
+	int fd;
+	size_t sz;              /* size of each buffer */
+	int flush_ms;
+	pthread_t tid;
+	pthread_mutex_t mx;     /* protects everything below */
+	pthread_cond_t cv;      /* signals the writer */
+	unsigned char *fill;    /* buffer being filled */
+	size_t flen;
+	long long fill_t0;      /* when its first byte came */
+	unsigned char *wbuf;    /* buffer handed to the writer, or NULL */
+	size_t wlen;
+	long long w_t0;
+	unsigned char *spare;   /* free buffer, NULL while being written */
+	int stop;
+	struct logfile_stats_s st;
+} lg;
+
+static long long
+logfile_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* hand the buffer being filled to the writer. Call with the lock
+   held, and only if lg.spare is available. */
+static void
+logfile_swap (void)
+{
+	lg.wbuf = lg.fill;
+	lg.wlen = lg.flen;
+	lg.w_t0 = lg.fill_t0;
+	lg.fill = lg.spare;
+	lg.spare = NULL;
+	lg.flen = 0;
+	pthread_cond_signal(&lg.cv);
+}
+
+/**********************************************************************/
+
+static int
+logfile_writen (const unsigned char *b, size_t n)
+{
+	ssize_t r;
+
+	while ( n ) {
+		r = write(lg.fd, b, n);
+		if ( r < 0 ) {
+			if ( errno == EINTR ) continue;
+			return -1;
+		}
+		b += r;
+		n -= r;
+	}
+
+	return 0;
+}
+
+static void *
+logfile_main (void *arg)
+{
+	unsigned char *b;
+	long long now, last_sync, tmo;
+	struct timespec ts;
+	size_t n;
+	int err;
+
+	last_sync = logfile_now();
+
+	pthread_mutex_lock(&lg.mx);
+	for (;;) {
+		while ( ! lg.wbuf ) {
+			now = logfile_now();
+			if ( lg.flen && ( lg.stop || now - lg.fill_t0 >= lg.flush_ms ) ) {
+				logfile_swap();
+				break;
+			}
+			if ( lg.stop ) goto done;
+			/* wait until the oldest byte is due, or for a while */
+			tmo = lg.flen ? lg.fill_t0 + lg.flush_ms - now : lg.flush_ms;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += tmo / 1000;
+			ts.tv_nsec += (tmo % 1000) * 1000000;
+			if ( ts.tv_nsec >= 1000000000 ) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&lg.cv, &lg.mx, &ts);
+		}
+		b = lg.wbuf;
+		n = lg.wlen;
+		pthread_mutex_unlock(&lg.mx);
+
+		err = ( logfile_writen(b, n) < 0 ) ? errno : 0;
+		now = logfile_now();
+		if ( ! err && now - last_sync >= lg.flush_ms ) {
+			if ( fdatasync(lg.fd) < 0 ) err = errno;
+			last_sync = now;
+			pthread_mutex_lock(&lg.mx);
+			lg.st.syncs++;
+			pthread_mutex_unlock(&lg.mx);
+		}
+
+		pthread_mutex_lock(&lg.mx);
+		if ( err ) lg.st.err = err;
+		else lg.st.written += n;
+		lg.wbuf = NULL;
+		lg.spare = b;
+	}
+
+done:
+	pthread_mutex_unlock(&lg.mx);
+	if ( fdatasync(lg.fd) == 0 ) lg.st.syncs++;
+
+	return NULL;
+}
+
+/**********************************************************************/
+
+int
+logfile_open (const char *path, int flags, size_t bufsz, int flush_ms)
+{
+	sigset_t all, old;
+	int e;
+
+	if ( lg.open ) { errno = EBUSY; return -1; }
+
+	lg.fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0666);
+	if ( lg.fd < 0 ) return -1;
+	lg.fill = malloc(bufsz);
+	lg.spare = malloc(bufsz);
+	if ( ! lg.fill || ! lg.spare ) {
+		free(lg.fill);
+		free(lg.spare);
+		close(lg.fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	lg.sz = bufsz;
+	lg.flush_ms = ( flush_ms > 0 ) ? flush_ms : 1;
+	lg.flen = lg.wlen = 0;
+	lg.wbuf = NULL;
+	lg.stop = 0;
+	memset(&lg.st, 0, sizeof(lg.st));
+	pthread_mutex_init(&lg.mx, NULL);
+	pthread_cond_init(&lg.cv, NULL);
+
+	/* signals are for the main thread to handle */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	e = pthread_create(&lg.tid, NULL, logfile_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if ( e ) {
+		free(lg.fill);
+		free(lg.spare);
+		close(lg.fd);
+		errno = e;
+		return -1;
+	}
+	lg.open = 1;
+
+	return 0;
+}
+
+int
+logfile_writev (const struct iovec *iov, int iovcnt)
+{
+	const unsigned char *p;
+	size_t n, l, total, room;
+	int i;
+
+	if ( ! lg.open ) return -1;
+
+	for (total = 0, i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	pthread_mutex_lock(&lg.mx);
+	lg.st.in += total;
+	/* the spare buffer is free only if the writer is done with it */
+	room = lg.sz - lg.flen + ( lg.spare ? lg.sz : 0 );
+	if ( total > room ) {
+		lg.st.dropped += total;
+		pthread_mutex_unlock(&lg.mx);
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		p = iov[i].iov_base;
+		n = iov[i].iov_len;
+		while ( n ) {
+			if ( lg.flen == lg.sz ) logfile_swap();
+			if ( lg.flen == 0 ) lg.fill_t0 = logfile_now();
+			l = lg.sz - lg.flen;
+			if ( l > n ) l = n;
+			memcpy(lg.fill + lg.flen, p, l);
+			lg.flen += l;
+			p += l;
+			n -= l;
+		}
+	}
+	pthread_mutex_unlock(&lg.mx);
+
+	return 0;
+}
+
+int
+logfile_write (const void *data, size_t n)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = n;
+
+	return logfile_writev(&iov, 1);
+}
+
+int
+logfile_stats (struct logfile_stats_s *st)
+{
+	long long t0;
+
+	if ( ! lg.open ) return -1;
+
+	pthread_mutex_lock(&lg.mx);
+	*st = lg.st;
+	st->pending = lg.flen + ( lg.wbuf ? lg.wlen : 0 );
+	t0 = lg.wbuf ? lg.w_t0 : lg.flen ? lg.fill_t0 : -1;
+	pthread_mutex_unlock(&lg.mx);
+	st->lag_ms = ( t0 < 0 ) ? 0 : logfile_now() - t0;
+
+	return 0;
+}
+
+void
+logfile_close (void)
+{
+	if ( ! lg.open ) return;
+
+	pthread_mutex_lock(&lg.mx);
+	lg.stop = 1;
+	pthread_cond_signal(&lg.cv);
+	pthread_mutex_unlock(&lg.mx);
+	pthread_join(lg.tid, NULL);
+
+	close(lg.fd);
+	free(lg.fill);
+	free(lg.spare);
+	lg.open = 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,126 @@
+/* vi: set sw=4 ts=4:
+ *
+ * logfile.h
+ *
+ * Asynchronous capture-to-file. Data given to logfile_write() are
+ * appended to an in-memory buffer; a writer thread moves them to the
+ * file with large sequential writes, and periodically commits them to
+ * disk with fdatasync(2). The caller never waits for the disk.
+ *
+ * Principles of operation:
+ *
+ * There are two buffers of equal size. The caller fills one while the
+ * thread writes the other out. The buffers are swapped when the one
+ * being filled is full, or, by the thread, when the flush interval
+ * expires with data in it. If the buffer being filled is full and the
+ * other one has not been written out yet, the disk is not keeping up:
+ * the data are dropped (and counted) rather than blocking the caller.
+ * Data are dropped in whole, one call's worth at a time, so that
+ * whatever gets to the file is made of complete writes.
+ *
+ * The only lock is held for the duration of a memcpy into the buffer,
+ * or of a buffer swap, never across a system call.
+ *
+ * Interface summary:
+ *
+ * F logfile_open - open the log file and start the writer thread
+ * F logfile_write - append data to the log
+ * F logfile_writev - append data from an I/O vector to the log
+ * F logfile_stats - get the writer statistics (e.g. its lag)
+ * F logfile_close - flush everything to disk and stop the writer
+ * T logfile_stats_s - writer statistics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* T logfile_stats_s
+ *
+ * Statistics of the writer, as returned by logfile_stats().
+ */
+struct logfile_stats_s {
+	unsigned long long in;       /* bytes given to logfile_write() */
+	unsigned long long written;  /* bytes written to the file */
+	unsigned long long dropped;  /* bytes dropped, disk too slow */
+	unsigned long syncs;         /* fdatasync(2) calls */
+	size_t pending;              /* bytes buffered, not yet written */
+	long lag_ms;                 /* age of the oldest pending byte */
+	int err;                     /* errno of a failed write, or zero */
+};
+
+/* F logfile_open
+ *
+ * Open "path" for writing (creating it if needed), allocate two
+ * buffers of "bufsz" bytes each, and start the writer thread. "flags"
+ * are or-ed into the flags given to open(2), and should be either
+ * O_APPEND or O_TRUNC. Buffered data are written out, and committed to
+ * disk, at least every "flush_ms" milliseconds.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int logfile_open (const char *path, int flags, size_t bufsz, int flush_ms);
+
+/* F logfile_write
+ *
+ * Append "n" bytes from "data" to the log. Never blocks on I/O. If
+ * the writer is too far behind, the data are dropped. At most 2 *
+ * "bufsz" bytes can be appended with one call.
+ *
+ * Returns negative if the data were dropped, or if the log is not
+ * open; non-negative otherwise.
+ */
+int logfile_write (const void *data, size_t n);
+
+/* F logfile_writev
+ *
+ * Like logfile_write, for the "iovcnt" buffers described by "iov".
+ * Either all of them are appended, or none.
+ */
+int logfile_writev (const struct iovec *iov, int iovcnt);
+
+/* F logfile_stats
+ *
+ * Fill "st" with the current statistics of the writer.
+ *
+ * Returns negative if the log is not open, non-negative otherwise.
+ */
+int logfile_stats (struct logfile_stats_s *st);
+
+/* F logfile_close
+ *
+ * Write out all the buffered data, commit them to disk, stop the
+ * writer thread and close the file. Blocks until done. Does nothing
+ * if the log is not open.
+ */
+void logfile_close (void);
+
+#endif /* of LOGFILE_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -23,6 +23,7 @@
  * USA
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -38,11 +39,26 @@
 #include <sys/wait.h>
 #include <limits.h>
 #include <sys/time.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <spawn.h>
 
-#define _GNU_SOURCE
 #include <getopt.h>
 
 #include "term.h"
+#include "ring.h"
+#include "ev.h"
+#include "rxthr.h"
+#include "logfile.h"
+#include "capture.h"
+#include "replay.h"
+#include "sniff.h"
+#include "fsend.h"
+#include "xmodem.h"
+#include "zmodem.h"
+#include "frecv.h"
+#include "split.h"
 
 /**********************************************************************/
 
@@ -60,14 +76,31 @@
 #define KEY_RECEIVE '\x12' /* C-r: receive file */
 #define KEY_BREAK   '\x1c' /* C-\: break */
 #define KEY_TIMESTAMP   '\x09' /* C-i: timestamp */
+#define KEY_PORT    '\x0e' /* C-n: next port receives input */
 
 #define STO STDOUT_FILENO
 #define STI STDIN_FILENO
 
 /**********************************************************************/
 
+/* File transfer modes (--send-mode, --receive-mode). The built-in
+   sender and receiver are used, unless --send-cmd is given, or
+   --receive-mode is not. */
+enum xfer_mode_e {
+	XF_CMD,             /* receiving: with --receive-cmd */
+	XF_RAW,
+	XF_ASCII,
+	XF_XMODEM,
+	XF_YMODEM,
+	XF_ZMODEM
+};
+
+const char *xfer_mode_str[] = { "cmd", "raw", "ascii", "xmodem", "ymodem",
+								"zmodem" };
+
+#define XF_NMODES (sizeof(xfer_mode_str) / sizeof(xfer_mode_str[0]))
+
 struct {
-	char port[128];
 	int baud;
 	enum flowcntrl_e flow;
 	char *flow_str;
@@ -80,10 +113,35 @@ struct {
 	int nolock;
 #endif
 	unsigned char escape;
-	char send_cmd[128];
-	char receive_cmd[128];
+	const char *send_cmd;
+	enum xfer_mode_e send_mode;
+	long send_char_us;
+	long send_line_us;
+	const char *receive_cmd;
+	enum xfer_mode_e receive_mode;
+	unsigned long long receive_max;
+	long receive_idle_ms;
+	char *receive_end;
+	int window;
+	int txqueue;
+	enum ev_backend_e engine;
+	char *engine_str;
+	int zerocopy;
+	int rxthread;
+	int vmin;
+	int vtime;
+	char *batch_str;
+	char *logfile;
+	int logcapture;
+	int logbuf;
+	int logsync;
+	char *replay;
+	int replay_port;
+	double speed;
+	int bridge;
+	int sniff;
+	char *sniff_link;
 } opts = {
-	.port = "",
 	.baud = 115200,
 	.flow = FC_NONE,
 	.flow_str = "none",
@@ -96,11 +154,117 @@ struct {
 	.nolock = 0,
 #endif
 	.escape = '\x01',
-	.send_cmd = "ascii_xfr -s -v -l10",
-	.receive_cmd = "rz -vv"
+	.send_cmd = "",
+	.send_mode = XF_ASCII,
+	.send_char_us = 0,
+	.send_line_us = 0,
+	.receive_cmd = "rz -vv",
+	.receive_mode = XF_CMD,
+	.receive_max = 0,
+	.receive_idle_ms = 0,
+	.receive_end = NULL,
+	.window = 1,
+	.txqueue = 16384,
+	.engine = EV_DEFAULT,
+	.engine_str = "default",
+	.zerocopy = 0,
+	.rxthread = 0,
+	.vmin = 1,
+	.vtime = 0,
+	.batch_str = NULL,
+	.logfile = NULL,
+	.logcapture = 0,
+	.logbuf = 1024 * 1024,
+	.logsync = 1000,
+	.replay = NULL,
+	.replay_port = 0,
+	.speed = 1.0,
+	.bridge = 0,
+	.sniff = 0,
+	.sniff_link = NULL
+};
+
+/* Port read batching presets (--batch). "latency" has the driver
+   wake us up for every byte. "throughput" lets it collect 64 bytes,
+   and picks up stragglers within 0.1 sec. Larger VMIN values gain
+   little, and have been seen to hurt bulk transfers badly (ptys). */
+struct {
+	const char *name;
+	int vmin;
+	int vtime;
+} batch_presets[] = {
+	{ "latency", 1, 0 },
+	{ "throughput", 64, 1 },
+	{ NULL, 0, 0 }
+};
+
+/* smallest --logbuf accepted. The log writer keeps two buffers of
+   this size (see "logfile.h"), and cannot take a chunk larger than
+   both; port reads must always fit, with their capture header. */
+#define LOG_BUF_MIN 16384
+#define LOG_BUF_MAX (256 * 1024 * 1024)
+/* longest --logsync, in msec */
+#define LOG_SYNC_MAX (60 * 60 * 1000)
+
+/* The ports. Several can be given; each is set up with the
+   settings given by the options, unless its argument overrides them
+   (see parse_port). Data from all of them are shown merged, every
+   line tagged with the port it came from. Keyboard input goes to one
+   of them, the "input port", which the commands also act on. */
+
+/* longest port tag: colour codes, brackets, and up to 16 characters
+   of the name */
+#define TAG_MAX 32
+
+/* With --bridge, what is read from each of the two ports is written
+   to the other (its "peer"), and shown tagged with the direction.
+   These are the statistics of a direction, kept by its source port.
+   Latency is measured from the read of a chunk to the write that
+   empties the peer's queue; while the peer is slow, only the oldest of
+   the chunks waiting counts. */
+struct fwd_s {
+	unsigned long long bytes;
+	unsigned long chunks;
+	long long since;        /* nsec: oldest unwritten chunk read at */
+	long long lat_sum;      /* nsec */
+	long long lat_max;      /* nsec */
+	unsigned long lat_n;
+};
+
+struct port_s {
+	char name[128];
+	char tag[TAG_MAX];      /* line prefix, with several ports */
+	int taglen;
+	int fd;
+	int baud;
+	enum flowcntrl_e flow;
+	char *flow_str;
+	enum parity_e parity;
+	char *parity_str;
+	int databits;
+	int dtr_up;
+	struct ring q;          /* data waiting to be written to it */
+	int rd_ready;
+	int wr_ready;
+	struct port_s *peer;    /* with --bridge */
+	struct fwd_s fwd;
+#ifdef UUCP_LOCK_DIR
+	char lockname[_POSIX_PATH_MAX];
+#endif
 };
 
-int tty_fd;
+struct port_s *ports;
+int nports;
+struct port_s *port;        /* the input port */
+/* the port of the XMODEM, YMODEM, or ZMODEM transfer in progress, see
+   xfer_send() */
+struct port_s *xfer_pt;
+
+/* stdin is not a terminal, see sti_input() */
+int headless;
+/* where picocom's own messages go: stderr when headless, so that they
+   do not mix with the data */
+int msg_fd = STO;
 
 /**********************************************************************/
 
@@ -110,11 +274,10 @@ int tty_fd;
  * <http://www.faqs.org/faqs/uucp-internals> for details
  */
 
-char lockname[_POSIX_PATH_MAX] = "";
-
 int
-uucp_lockname(const char *dir, const char *file)
+uucp_lockname(struct port_s *pt, const char *dir)
 {
+	const char *file = pt->name;
 	char *p, *cp;
 	struct stat sb;
 
@@ -128,7 +291,7 @@ uucp_lockname(const char *dir, const char *file)
 	p = cp = strdup(p);
 	do { if ( *p == '/' ) *p = '_'; } while(*p++);
 	/* build lockname */
-	snprintf(lockname, sizeof(lockname), "%s/LCK..%s", dir, cp);
+	snprintf(pt->lockname, sizeof(pt->lockname), "%s/LCK..%s", dir, cp);
 	/* destroy the copy */
 	free(cp);
 
@@ -136,8 +299,9 @@ uucp_lockname(const char *dir, const char *file)
 }
 
 int
-uucp_lock(void)
+uucp_lock(struct port_s *pt)
 {
+	char *lockname = pt->lockname;
 	int r, fd, pid;
 	char buf[16];
 	mode_t m;
@@ -178,7 +342,10 @@ uucp_lock(void)
 int
 uucp_unlock(void)
 {
-	if ( lockname[0] ) unlink(lockname);
+	int i;
+
+	for (i = 0; i < nports; i++)
+		if ( ports[i].lockname[0] ) unlink(ports[i].lockname);
 	return 0;
 }
 
@@ -222,6 +389,8 @@ fd_printf (int fd, const char *format, ...)
 	return writen_ni(fd, buf, len);
 }
 
+int sto_flush (void);
+
 void
 fatal (const char *format, ...)
 {
@@ -229,6 +398,10 @@ fatal (const char *format, ...)
 	va_list args;
 	int len;
 
+	sto_flush();
+	cap_close();
+	logfile_close();
+	sniff_close();
 	term_reset(STO);
 	term_reset(STI);
 
@@ -238,10 +411,10 @@ fatal (const char *format, ...)
 	va_end(args);
 
 	s = "\r\nFATAL: ";
-	writen_ni(STO, s, strlen(s));
-	writen_ni(STO, buf, len);
+	writen_ni(msg_fd, s, strlen(s));
+	writen_ni(msg_fd, buf, len);
 	s = "\r\n";
-	writen_ni(STO, s, strlen(s));
+	writen_ni(msg_fd, s, strlen(s));
 
 	/* wait a bit for output to drain */
 	sleep(1);
@@ -389,486 +562,2375 @@ bits_next (int bits)
 
 /**********************************************************************/
 
-void
-child_empty_handler (int signum)
-{
-}
+/* --send-cmd and --receive-cmd are split into arguments once, at
+   startup (see parse_cmd), and run without a shell */
+#define RUN_CMD_ARGS_MAX 64
 
-void
-establish_child_signal_handlers (void)
+char *send_argv[RUN_CMD_ARGS_MAX + 1];
+char *receive_argv[RUN_CMD_ARGS_MAX + 1];
+
+extern char **environ;
+
+/* Split command "cmd" into "argv" (NULL-terminated). Returns negative
+   if it cannot be split, or is too long */
+int
+parse_cmd (const char *cmd, char *argv[])
 {
-	struct sigaction empty_action;
+	int argc = 0;
 
-	/* Set up the structure to specify the "empty" action. */
-    empty_action.sa_handler = child_empty_handler;
-	sigemptyset (&empty_action.sa_mask);
-	empty_action.sa_flags = 0;
+	if ( split_quoted(cmd, &argc, argv, RUN_CMD_ARGS_MAX) != 0 )
+		return -1;
+	argv[argc] = NULL;
 
-	sigaction (SIGINT, &empty_action, NULL);
-	sigaction (SIGTERM, &empty_action, NULL);
+	return argc;
 }
 
+/* Run the command in "cmd" with its standard input and output
+   connected to "fd", and wait for it. The arguments in "args" (if not
+   NULL, e.g. the names of the files to send) are split like the
+   command and appended to it */
 int
-run_cmd(int fd, ...)
+run_cmd (int fd, char *const cmd[], const char *args)
 {
+	char *argv[RUN_CMD_ARGS_MAX + 1];
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t sa;
+	sigset_t sigm, sigm_old, sigdef;
 	pid_t pid;
-	sigset_t sigm, sigm_old;
+	long fl;
+	int argc, n, i, r, status;
+
+	for (n = 0; cmd[n]; n++)
+		argv[n] = cmd[n];
+	argc = n;
+	if ( args && split_quoted(args, &argc, argv, RUN_CMD_ARGS_MAX) != 0 ) {
+		for (i = n; i < argc; i++) free(argv[i]);
+		fd_printf(STO, "*** cannot parse: %s\r\n", args);
+		return -1;
+	}
+	argv[argc] = NULL;
+	if ( ! argc ) {
+		fd_printf(STO, "*** no command to run\r\n");
+		return -1;
+	}
 
-	/* block signals, let child establish its own handlers */
+	/* the child starts with picocom's mask, and the dispositions
+	   changed by picocom set back to their defaults */
 	sigemptyset(&sigm);
 	sigaddset(&sigm, SIGTERM);
 	sigprocmask(SIG_BLOCK, &sigm, &sigm_old);
+	sigemptyset(&sigdef);
+	sigaddset(&sigdef, SIGINT);
+	sigaddset(&sigdef, SIGTERM);
+	sigaddset(&sigdef, SIGHUP);
+	sigaddset(&sigdef, SIGALRM);
+	sigaddset(&sigdef, SIGUSR1);
+	sigaddset(&sigdef, SIGUSR2);
+	sigaddset(&sigdef, SIGPIPE);
+	posix_spawnattr_init(&sa);
+	posix_spawnattr_setsigmask(&sa, &sigm_old);
+	posix_spawnattr_setsigdefault(&sa, &sigdef);
+	posix_spawnattr_setflags(&sa, POSIX_SPAWN_SETSIGMASK
+							 | POSIX_SPAWN_SETSIGDEF);
+	/* connect stdin and stdout to serial port */
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, fd, STI);
+	posix_spawn_file_actions_adddup2(&fa, fd, STO);
+
+	/* the child reads from, and writes to, the port now: what was
+	   queued for it is written first, and the port is taken out of
+	   the loop (the uring engine keeps a read queued on it) */
+	if ( ev_flush(fd) < 0 )
+		fatal("write to port failed: %s", strerror(errno));
+	ev_del(fd);
+	rxthr_pause();
+	/* the port's file status flags are shared with the child: set it
+	   to blocking mode while the child runs */
+	fl = fcntl(fd, F_GETFL);
+	fcntl(fd, F_SETFL, fl & ~O_NONBLOCK);
+	/* reset terminal to canonical mode */
+	term_reset(STI);
 
-	pid = fork();
-	if ( pid < 0 ) {
-		sigprocmask(SIG_SETMASK, &sigm_old, NULL);
-		fd_printf(STO, "*** cannot fork: %s\n", strerror(errno));
-		return -1;
-	} else if ( pid ) {
-		/* father: picocom */
-		int r;
-
-		/* reset the mask */
-		sigprocmask(SIG_SETMASK, &sigm_old, NULL);
+	for (i = 0; i < argc; i++)
+		fd_printf(STDERR_FILENO, "%s%s", i ? " " : "", argv[i]);
+	fd_printf(STDERR_FILENO, "\n");
+	r = posix_spawnp(&pid, argv[0], &fa, &sa, argv, environ);
+	if ( r == 0 ) {
 		/* wait for child to finish */
-		waitpid(pid, &r, 0);
-		/* reset terminal (back to raw mode) */
-		term_apply(STI);
-		/* check and report child return status */
-		if ( WIFEXITED(r) ) {
-			fd_printf(STO, "\r\n*** exit status: %d\r\n",
-					  WEXITSTATUS(r));
-			return WEXITSTATUS(r);
-		} else {
-			fd_printf(STO, "\r\n*** abnormal termination: 0x%x\r\n", r);
-			return -1;
-		}
+		while ( waitpid(pid, &status, 0) < 0 && errno == EINTR )
+			;
+	}
+	posix_spawn_file_actions_destroy(&fa);
+	posix_spawnattr_destroy(&sa);
+	sigprocmask(SIG_SETMASK, &sigm_old, NULL);
+
+	fcntl(fd, F_SETFL, fl);
+	rxthr_resume();
+	if ( ev_add(fd, (opts.rxthread ? 0 : EV_READ) | EV_WRITE | EV_ET) < 0 )
+		fatal("cannot add port to event loop: %s", strerror(errno));
+	/* back to raw mode */
+	term_set_raw(STI);
+	term_apply(STI);
+
+	/* check and report child return status */
+	if ( r != 0 ) {
+		fd_printf(STO, "*** cannot run %s: %s\r\n", argv[0], strerror(r));
+		r = -1;
+	} else if ( WIFEXITED(status) ) {
+		fd_printf(STO, "\r\n*** exit status: %d\r\n", WEXITSTATUS(status));
+		r = WEXITSTATUS(status);
 	} else {
-		/* child: external program */
-		int r;
-		long fl;
-		char cmd[512];
-
-		establish_child_signal_handlers();
-		sigprocmask(SIG_SETMASK, &sigm_old, NULL);
-		/* unmanage terminal, and reset it to canonical mode */
-		term_remove(STI);
-		/* unmanage serial port fd, without reset */
-		term_erase(fd);
-		/* set serial port fd to blocking mode */
-		fl = fcntl(fd, F_GETFL);
-		fl &= ~O_NONBLOCK;
-		fcntl(fd, F_SETFL, fl);
-		/* connect stdin and stdout to serial port */
-		close(STI);
-		close(STO);
-		dup2(fd, STI);
-		dup2(fd, STO);
-		{
-			/* build command-line */
-			char *c, *ce;
-			const char *s;
-			int n;
-			va_list vls;
-
-			c = cmd;
-			ce = cmd + sizeof(cmd) - 1;
-			va_start(vls, fd);
-			while ( (s = va_arg(vls, const char *)) ) {
-				n = strlen(s);
-				if ( c + n + 1 >= ce ) break;
-				memcpy(c, s, n); c += n;
-				*c++ = ' ';
-			}
-			va_end(vls);
-			*c = '\0';
-		}
-		/* run extenral command */
-		fd_printf(STDERR_FILENO, "%s\n", cmd);
-		r = system(cmd);
-		if ( WIFEXITED(r) ) exit(WEXITSTATUS(r));
-		else exit(128);
+		fd_printf(STO, "\r\n*** abnormal termination: 0x%x\r\n", status);
+		r = -1;
 	}
+	for (i = n; i < argc; i++) free(argv[i]);
+
+	return r;
 }
 
 /**********************************************************************/
 
-#define TTY_Q_SZ 256
+/* every port has a queue of data waiting to be written to it. Its
+   size is set by the --txqueue option. */
+#define TTY_Q_SZ_MIN 16
+#define TTY_Q_SZ_MAX (64 * 1024 * 1024)
 
-struct tty_q {
-	int len;
-	unsigned char buff[TTY_Q_SZ];
-} tty_q;
+void
+tty_q_put (unsigned char c)
+{
+	if ( ring_put(&port->q, &c, 1) != 1 )
+		fd_printf(STO, "\x07");
+}
 
 /**********************************************************************/
 #define TTY_TIME_RESET		2
 #define TTY_TIME_DISPLAY	1
 #define TTY_TIME_NONE		0
 int tty_time = TTY_TIME_RESET;
-int tty_time_enable = 2;
 
-void
-loop(void)
+/* Timestamp modes. The index in ts_modes[] of the one in use is kept
+   in "tty_time_enable", zero meaning no timestamps. */
+enum ts_mode_e {
+	TS_OFF = 0,
+	TS_START,           /* m:ss.mmm since the first data */
+	TS_DELTA,           /* +s.uuuuuu since the previous line */
+	TS_ISO              /* local wall-clock YYYY-MM-DDTHH:MM:SS.uuuuuu */
+};
+int tty_time_enable = TS_START;
+
+/* maximum length of a timestamp prefix, colour codes included */
+#define TS_MAX 48
+
+#define TS_PRE "\x1B[36m"
+#define TS_POST " \x1B[0m"
+
+/* Write "v" in decimal at "b", zero-padded to at least "w" digits.
+   Returns the end of the digits. */
+char *
+ts_dec (char *b, unsigned long long v, int w)
 {
-	enum {
-		ST_COMMAND,
-		ST_TRANSPARENT
-	} state;
-	int dtr_up;
-	fd_set rdset, wrset;
-	int newbaud, newflow, newparity, newbits;
-	char *newflow_str, *newparity_str;
-	char fname[128];
-	int r, n;
-	unsigned char c;
-	struct timeval tv,tv_ref;
-	unsigned int diff_sec,diff_msec;
-	char s[32];
+	char d[24];
+	int n;
 
+	n = 0;
+	do {
+		d[n++] = '0' + v % 10;
+		v /= 10;
+	} while ( v || n < w );
+	while ( n ) *b++ = d[--n];
 
-	tty_q.len = 0;
-	state = ST_TRANSPARENT;
-	dtr_up = 0;
+	return b;
+}
 
-	for (;;) {
-		FD_ZERO(&rdset);
-		FD_ZERO(&wrset);
-		FD_SET(STI, &rdset);
-		FD_SET(tty_fd, &rdset);
-		if ( tty_q.len ) FD_SET(tty_fd, &wrset);
+/* Formatters: write the body of a prefix for time "t" (usec, relative
+   to the start, to the previous line, or to the epoch) at "b", return
+   its length. Only ts_fmt_iso() goes through the C library, once a
+   second. */
+int
+ts_fmt_start (char *b, long long t)
+{
+	char *p = b;
 
-		if (select(FD_SETSIZE, &rdset, &wrset, NULL, NULL) < 0)
-			fatal("select failed: %d : %s", errno, strerror(errno));
+	t /= 1000;
+	p = ts_dec(p, t / 60000, 1);
+	*p++ = ':';
+	p = ts_dec(p, t / 1000 % 60, 2);
+	*p++ = '.';
+	p = ts_dec(p, t % 1000, 3);
 
-		if ( FD_ISSET(STI, &rdset) ) {
+	return p - b;
+}
 
-			/* read from terminal */
+int
+ts_fmt_delta (char *b, long long t)
+{
+	char *p = b;
 
-			do {
-				n = read(STI, &c, 1);
-			} while (n < 0 && errno == EINTR);
-			if (n == 0)
-				fatal("stdin closed");
-			else if (n < 0)
-				fatal("read from stdin failed: %s", strerror(errno));
+	*p++ = '+';
+	p = ts_dec(p, t / 1000000, 1);
+	*p++ = '.';
+	p = ts_dec(p, t % 1000000, 6);
 
-			switch (state) {
+	return p - b;
+}
 
-			case ST_COMMAND:
-				if ( c == opts.escape ) {
-					state = ST_TRANSPARENT;
-					/* pass the escape character down */
-					if (tty_q.len <= TTY_Q_SZ)
-						tty_q.buff[tty_q.len++] = c;
-					else
-						fd_printf(STO, "\x07");
-					break;
-				}
-				state = ST_TRANSPARENT;
-				switch (c) {
-				case KEY_EXIT:
-					return;
-				case KEY_QUIT:
-					term_set_hupcl(tty_fd, 0);
-					term_flush(tty_fd);
-					term_apply(tty_fd);
-					term_erase(tty_fd);
-					return;
-				case KEY_STATUS:
-					fd_printf(STO, "\r\n");
-					fd_printf(STO, "*** baud: %d\r\n", opts.baud);
-					fd_printf(STO, "*** flow: %s\r\n", opts.flow_str);
-					fd_printf(STO, "*** parity: %s\r\n", opts.parity_str);
-					fd_printf(STO, "*** databits: %d\r\n", opts.databits);
-					fd_printf(STO, "*** dtr: %s\r\n", dtr_up ? "up" : "down");
-					fd_printf(STO, "*** timestamp: %s\r\n", tty_time_enable ? "on" : "off");
-					break;
-				case KEY_PULSE:
-					fd_printf(STO, "\r\n*** pulse DTR ***\r\n");
-					if ( term_pulse_dtr(tty_fd) < 0 )
-						fd_printf(STO, "*** FAILED\r\n");
-					break;
-				case KEY_TOGGLE:
-					if ( dtr_up )
-						r = term_lower_dtr(tty_fd);
-					else
-						r = term_raise_dtr(tty_fd);
-					if ( r >= 0 ) dtr_up = ! dtr_up;
-					fd_printf(STO, "\r\n*** DTR: %s ***\r\n",
-							  dtr_up ? "up" : "down");
-					break;
-				case KEY_BAUD_UP:
-					newbaud = baud_up(opts.baud);
-					term_set_baudrate(tty_fd, newbaud);
-					tty_q.len = 0; term_flush(tty_fd);
-					if ( term_apply(tty_fd) >= 0 ) opts.baud = newbaud;
-					fd_printf(STO, "\r\n*** baud: %d ***\r\n", opts.baud);
-					break;
-				case KEY_BAUD_DN:
-					newbaud = baud_down(opts.baud);
-					term_set_baudrate(tty_fd, newbaud);
-					tty_q.len = 0; term_flush(tty_fd);
-					if ( term_apply(tty_fd) >= 0 ) opts.baud = newbaud;
-					fd_printf(STO, "\r\n*** baud: %d ***\r\n", opts.baud);
-					break;
-				case KEY_FLOW:
-					newflow = flow_next(opts.flow, &newflow_str);
-					term_set_flowcntrl(tty_fd, newflow);
-					tty_q.len = 0; term_flush(tty_fd);
-					if ( term_apply(tty_fd) >= 0 ) {
-						opts.flow = newflow;
-						opts.flow_str = newflow_str;
-					}
-					fd_printf(STO, "\r\n*** flow: %s ***\r\n", opts.flow_str);
-					break;
-				case KEY_PARITY:
-					newparity = parity_next(opts.parity, &newparity_str);
-					term_set_parity(tty_fd, newparity);
-					tty_q.len = 0; term_flush(tty_fd);
-					if ( term_apply(tty_fd) >= 0 ) {
-						opts.parity = newparity;
-						opts.parity_str = newparity_str;
-					}
-					fd_printf(STO, "\r\n*** parity: %s ***\r\n",
-							  opts.parity_str);
-					break;
-				case KEY_BITS:
-					newbits = bits_next(opts.databits);
-					term_set_databits(tty_fd, newbits);
-					tty_q.len = 0; term_flush(tty_fd);
-					if ( term_apply(tty_fd) >= 0 ) opts.databits = newbits;
-					fd_printf(STO, "\r\n*** databits: %d ***\r\n",
-							  opts.databits);
-					break;
-				case KEY_SEND:
-					fd_printf(STO, "\r\n*** file: ");
-					r = fd_readline(STI, STO, fname, sizeof(fname));
-					fd_printf(STO, "\r\n");
-					if ( r < -1 && errno == EINTR ) break;
-					if ( r <= -1 )
-						fatal("cannot read filename: %s", strerror(errno));
-					run_cmd(tty_fd, opts.send_cmd, fname, NULL);
-					break;
-				case KEY_RECEIVE:
-					fd_printf(STO, "*** file: ");
-					r = fd_readline(STI, STO, fname, sizeof(fname));
-					fd_printf(STO, "\r\n");
-					if ( r < -1 && errno == EINTR ) break;
-					if ( r <= -1 )
-						fatal("cannot read filename: %s", strerror(errno));
-					if ( fname[0] )
-						run_cmd(tty_fd, opts.send_cmd, fname, NULL);
-					else
-						run_cmd(tty_fd, opts.receive_cmd, NULL);
-					break;
-				case KEY_BREAK:
-					term_break(tty_fd);
-					fd_printf(STO, "\r\n*** break sent ***\r\n");
-					break;
-				case KEY_TIMESTAMP:
-					if(tty_time_enable) {
-						tty_time_enable = 0;
-						fd_printf(STO, "\r\n*** Time Stamp Disable ***\r\n");
-					} else {
-						tty_time_enable = 1;
-						tty_time = TTY_TIME_RESET;
-						fd_printf(STO, "\r\n*** Time Stamp Enable ***\r\n");
-					}
-                    break;
-				default:
-					break;
-				}
-				break;
+int
+ts_fmt_iso (char *b, long long t)
+{
+	static time_t shown = -1;
+	static char date[32];
+	static int datelen;
+	struct tm tm;
+	time_t sec;
+	char *p;
+
+	sec = t / 1000000;
+	if ( sec != shown ) {
+		localtime_r(&sec, &tm);
+		datelen = strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+		shown = sec;
+	}
+	memcpy(b, date, datelen);
+	p = b + datelen;
+	*p++ = '.';
+	p = ts_dec(p, t % 1000000, 6);
 
-			case ST_TRANSPARENT:
-				if ( c == opts.escape ) {
-					state = ST_COMMAND;
-				} else {
-					if (tty_q.len <= TTY_Q_SZ)
-						tty_q.buff[tty_q.len++] = c;
-					else
-						fd_printf(STO, "\x07");
-				}
-				break;
+	return p - b;
+}
 
-			default:
-				assert(0);
-				break;
-			}
-		}
+struct ts_mode_s {
+	const char *name;
+	clockid_t clock;
+	long long step;     /* usec; the prefix is re-built once per step */
+	int (*fmt)(char *b, long long t);
+} ts_modes[] = {
+	[TS_OFF]   = { "off",   CLOCK_MONOTONIC, 0,    NULL },
+	[TS_START] = { "start", CLOCK_MONOTONIC, 1000, ts_fmt_start },
+	[TS_DELTA] = { "delta", CLOCK_MONOTONIC, 1,    ts_fmt_delta },
+	[TS_ISO]   = { "iso",   CLOCK_REALTIME,  1,    ts_fmt_iso },
+};
 
-		if ( FD_ISSET(tty_fd, &rdset) ) {
+#define TS_NMODES (sizeof(ts_modes) / sizeof(ts_modes[0]))
 
-			/* read from port */
+/* Returns the index of the mode named "name", or negative */
+int
+ts_mode_find (const char *name)
+{
+	int i;
 
-			do {
-				n = read(tty_fd, &c, 1);
-			} while (n < 0 && errno == EINTR);
-			if (n == 0)
-				fatal("term closed");
-			else if ( n < 0 )
-				fatal("read from term failed: %s", strerror(errno));
-
-			if(tty_time_enable && tty_time) {
-                gettimeofday(&tv,NULL);
-				if(tty_time == TTY_TIME_RESET) {
-					tv_ref = tv;
-				}
+	for (i = 0; i < TS_NMODES; i++)
+		if ( strcmp(name, ts_modes[i].name) == 0 )
+			return i;
 
-				if((c != '\n') && (c != '\r')) {
-					diff_sec = tv.tv_sec - tv_ref.tv_sec;
-					if(tv.tv_usec/1000 < tv_ref.tv_usec/1000) {
-						diff_sec--;
-						diff_msec = (1000 + (tv.tv_usec/1000)) - (tv_ref.tv_usec/1000);
-					} else {
-						diff_msec = (tv.tv_usec - tv_ref.tv_usec) / 1000;
-					}
-					sprintf(s,"\x1B[36m" "%d:%02d.%03d " "\x1B[0m",diff_sec/60,diff_sec%60,diff_msec);
-					//sprintf(s,"%03d.%04d",(int)(tv.tv_sec-tty_timeref),(int)(tv.tv_usec/1000));
-					write(STO, s, strlen(s));
-					tty_time = TTY_TIME_NONE;
-				}
-			}
-			if((c == '\n') || (c == '\r')) tty_time = TTY_TIME_DISPLAY;
+	return -1;
+}
 
-			do {
-				n = write(STO, &c, 1);
-			} while ( errno == EAGAIN
-					  || errno == EWOULDBLOCK
-					  || errno == EINTR );
-			if ( n <= 0 )
-				fatal("write to stdout failed: %s", strerror(errno));
-		}
+/* Returns the current time (usec) on the clock of the mode in use */
+long long
+ts_now (void)
+{
+	struct timespec ts;
 
-		if ( FD_ISSET(tty_fd, &wrset) ) {
+	clock_gettime(ts_modes[tty_time_enable].clock, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-			/* write to port */
+/* size of the buffer used for reading from the port. Everything the
+   kernel has buffered (up to this many bytes) is read in one go. */
+#define TTY_RD_SZ 8192
 
-			do {
-				n = write(tty_fd, tty_q.buff, tty_q.len);
-			} while ( n < 0 && errno == EINTR );
-			if ( n <= 0 )
-				fatal("write to term failed: %s", strerror(errno));
-			memcpy(tty_q.buff, tty_q.buff + n, tty_q.len - n);
-			tty_q.len -= n;
-		}
-	}
+unsigned char tty_rd_buff[TTY_RD_SZ];
+
+/* don't read less than this from the port, unless stdout is idle */
+#define TTY_RD_LOWAT 1024
+
+/* With --rxthread the port is read by a thread of its own (see
+   "rxthr.h") into this ring, and "rx_fd" is the filedes by which the
+   thread notifies the loop. */
+#define RX_Q_SZ 65536
+
+struct ring rx_q;
+int rx_fd = -1;
+
+/* With VMIN > 1 (and VTIME = 0) the port is reported readable only
+   once VMIN bytes have arrived. The driver's VTIME timer cannot help
+   with the stragglers: it only completes blocking reads, and a
+   non-zero VTIME makes poll(2) ignore VMIN altogether. So VTIME is
+   kept out of the driver and emulated: the port is read every VTIME
+   tenths of a second regardless. This is the interval in msec, or
+   zero if not needed. */
+int tty_rd_tick;
+
+int
+tty_rd_tick_ms (void)
+{
+	return ( opts.vmin > 1 ) ? opts.vtime * 100 : 0;
+}
+
+long long
+now_ms (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long long
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 /**********************************************************************/
 
+/* Output to stdout goes through a bounded backlog, and is written to
+   a private non-blocking descriptor of stdout ("sto_fd") when stdout
+   can accept it, so that a slow terminal never blocks the loop. When
+   the backlog cannot take a whole chunk, reading from the port is
+   suspended until stdout drains (the port's own flow control, if any,
+   takes over from there). */
+
+#define STO_Q_SZ 65536
+
+struct ring sto_q;
+int sto_fd = STO;
+int sto_polled;     /* sto_fd is in the event loop */
+int sto_wr_ready;
+
+/* Open a descriptor of stdout with its own (non-blocking) file status
+   flags, so that stdin (which often shares stdout's open file
+   description) and the invoking shell are not affected. If that is not
+   possible, blocking stdout itself is used. */
 void
-deadly_handler(int signum)
+sto_open (void)
 {
-	kill(0, SIGTERM);
-	sleep(1);
-#ifdef UUCP_LOCK_DIR
-	uucp_unlock();
-#endif
-	exit(EXIT_FAILURE);
+	struct stat st;
+	char path[64];
+	int fd;
+
+	if ( ring_init(&sto_q, STO_Q_SZ) < 0 )
+		fatal("cannot allocate stdout queue: %s", strerror(errno));
+
+	sto_fd = STO;
+	sto_wr_ready = 1;
+	if ( fstat(STO, &st) < 0 ) return;
+	if ( ! S_ISCHR(st.st_mode) && ! S_ISFIFO(st.st_mode) ) return;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", STO);
+	fd = open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY);
+	if ( fd < 0 && isatty(STO) )
+		fd = open(ttyname(STO), O_WRONLY | O_NONBLOCK | O_NOCTTY);
+	if ( fd < 0 ) return;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	sto_fd = fd;
+	sto_polled = ( ev_add(sto_fd, EV_WRITE | EV_ET) >= 0 );
 }
 
 void
-establish_signal_handlers (void)
+sto_notready (void)
 {
-        struct sigaction exit_action, ign_action;
+	sto_wr_ready = 0;
+	if ( sto_polled ) ev_rearm(sto_fd, EV_WRITE);
+}
 
-        /* Set up the structure to specify the exit action. */
-        exit_action.sa_handler = deadly_handler;
-        sigemptyset (&exit_action.sa_mask);
-        exit_action.sa_flags = 0;
+/* write as much of the backlog as stdout accepts */
+void
+sto_drain (void)
+{
+	struct iovec iov[2];
+	int cnt;
+	ssize_t n;
 
-        /* Set up the structure to specify the ignore action. */
-        ign_action.sa_handler = SIG_IGN;
-        sigemptyset (&ign_action.sa_mask);
-        ign_action.sa_flags = 0;
+	while ( sto_wr_ready && (cnt = ring_iov(&sto_q, iov)) ) {
+		do {
+			n = ev_writev(sto_fd, iov, cnt);
+		} while ( n < 0 && errno == EINTR );
+		if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			sto_notready();
+			break;
+		}
+		if ( n <= 0 )
+			fatal("write to stdout failed: %s", strerror(errno));
+		ring_consume(&sto_q, n);
+	}
+}
 
-        sigaction (SIGTERM, &exit_action, NULL);
+/* Output the "cnt" buffers in "iov", with a single writev if stdout
+   can take them. Whatever is not written goes to the backlog, which
+   the caller must have made sure has room for it. */
+void
+sto_writev (struct iovec *iov, int cnt)
+{
+	ssize_t n;
+	int i;
 
-        sigaction (SIGINT, &ign_action, NULL);
-        sigaction (SIGHUP, &ign_action, NULL);
-        sigaction (SIGALRM, &ign_action, NULL);
-        sigaction (SIGUSR1, &ign_action, NULL);
-        sigaction (SIGUSR2, &ign_action, NULL);
-        sigaction (SIGPIPE, &ign_action, NULL);
+	if ( ! ring_len(&sto_q) && sto_wr_ready ) {
+		do {
+			n = ev_writev(sto_fd, iov, cnt);
+		} while ( n < 0 && errno == EINTR );
+		if ( n < 0 ) {
+			if ( errno != EAGAIN && errno != EWOULDBLOCK )
+				fatal("write to stdout failed: %s", strerror(errno));
+			sto_notready();
+			n = 0;
+		}
+		for (i = 0; i < cnt && n >= (ssize_t)iov[i].iov_len; i++)
+			n -= iov[i].iov_len;
+		if ( i == cnt ) return;
+		iov[i].iov_base = (char *)iov[i].iov_base + n;
+		iov[i].iov_len -= n;
+		iov += i;
+		cnt -= i;
+	}
+
+	for (i = 0; i < cnt; i++)
+		ring_put(&sto_q, iov[i].iov_base, iov[i].iov_len);
 }
 
 /**********************************************************************/
 
+/* Zero-copy pass-through (--zerocopy). When the data read from the
+   port are copied to stdout unmodified, they are moved with splice(2)
+   from the port to a pipe, and from the pipe to stdout, without ever
+   entering user space. The pipe then also serves as the stdout
+   backlog. */
+
+#define ZC_PIPE_SZ (1024 * 1024)
+
+int zc_pipe[2] = { -1, -1 };
+size_t zc_sz;       /* capacity of the pipe */
+size_t zc_len;      /* bytes in the pipe */
+int zc_full;        /* pipe out of buffer slots, see below */
+
 void
-show_usage(char *name)
+zc_open (void)
 {
-	char *s;
-
-	s = strrchr(name, '/');
-	s = s ? s+1 : name;
+	int sz;
 
-	printf("picocom v%s\n", VERSION_STR);
-	printf("Usage is: %s [options] <tty device>\n", s);
-	printf("Options are:\n");
-	printf("  --<b>aud <baudrate>\n");
-	printf("  --<f>low s (=soft) | h (=hard) | n (=none)\n");
-	printf("  --<p>arity o (=odd) | e (=even) | n (=none)\n");
-	printf("  --<d>atabits 5 | 6 | 7 | 8\n");
-	printf("  --<e>scape <char>\n");
-	printf("  --no<i>nit\n");
-	printf("  --no<r>eset\n");
-	printf("  --no<l>ock\n");
-	printf("  --<s>end-cmd <command>\n");
-	printf("  --recei<v>e-cmd <command>\n");
-	printf("  --<t>imestamp\n");
-	printf("  --<h>elp\n");
-	printf("<?> indicates the equivalent short option.\n");
-	printf("Short options are prefixed by \"-\" instead of by \"--\".\n");
+	if ( pipe2(zc_pipe, O_NONBLOCK | O_CLOEXEC) < 0 )
+		fatal("cannot create pipe: %s", strerror(errno));
+	fcntl(zc_pipe[1], F_SETPIPE_SZ, ZC_PIPE_SZ);
+	sz = fcntl(zc_pipe[1], F_GETPIPE_SZ);
+	zc_sz = ( sz > 0 ) ? sz : 65536;
 }
 
-/**********************************************************************/
+/* pass-through is disabled while any transformation or copy of the
+   data (such as timestamping, or logging) is enabled, and while they
+   go to a file transfer */
+int
+zc_active (void)
+{
+	return zc_pipe[0] >= 0 && ! tty_time_enable && ! opts.logfile
+		&& ! xfer_pt;
+}
 
+/* move as much of the pipe contents to stdout as it accepts */
 void
-parse_args(int argc, char *argv[])
+zc_drain (void)
 {
-	static struct option longOptions[] =
-	{
-		{"receive-cmd", required_argument, 0, 'v'},
-		{"send-cmd", required_argument, 0, 's'},
-		{"escape", required_argument, 0, 'e'},
-		{"noinit", no_argument, 0, 'i'},
-		{"noreset", no_argument, 0, 'r'},
-		{"nolock", no_argument, 0, 'l'},
-		{"flow", required_argument, 0, 'f'},
-		{"baud", required_argument, 0, 'b'},
-		{"parity", required_argument, 0, 'p'},
-		{"databits", required_argument, 0, 'd'},
-		{"help", no_argument, 0, 'h'},
-		{"timestamp", no_argument, 0, 't'},
-		{0, 0, 0, 0}
-	};
+	ssize_t n;
 
-	while (1) {
-		int optionIndex = 0;
-		int c;
+	while ( zc_len && sto_wr_ready ) {
+		do {
+			n = splice(zc_pipe[0], NULL, sto_fd, NULL, zc_len,
+					   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		} while ( n < 0 && errno == EINTR );
+		if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			sto_notready();
+			break;
+		}
+		if ( n <= 0 )
+			fatal("splice to stdout failed: %s", strerror(errno));
+		zc_len -= n;
+		zc_full = 0;
+	}
+}
 
-		/* no default error messages printed. */
-		opterr = 0;
+/**********************************************************************/
 
-		c = getopt_long(argc, argv, "hirlts:r:e:f:b:p:d:",
-						longOptions, &optionIndex);
+/* Wait until the backlog has been written. Used before writing to
+   stdout directly. Never fails fatally (it is called by fatal()). */
+int
+sto_flush (void)
+{
+	struct pollfd pfd;
+	ssize_t n;
+	int zc;
+
+	if ( ev_flush(sto_fd) < 0 ) return -1;
+	/* at most one of the two backlogs is non-empty at any time */
+	while ( ring_len(&sto_q) || zc_len ) {
+		zc = ( ring_len(&sto_q) == 0 );
+		if ( zc )
+			n = splice(zc_pipe[0], NULL, sto_fd, NULL, zc_len,
+					   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		else
+			n = ring_write(&sto_q, sto_fd);
+		if ( n < 0 && errno == EINTR ) continue;
+		if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			pfd.fd = sto_fd;
+			pfd.events = POLLOUT;
+			if ( poll(&pfd, 1, -1) < 0 && errno != EINTR ) return -1;
+			continue;
+		}
+		if ( n <= 0 ) return -1;
+		if ( zc ) { zc_len -= n; zc_full = 0; }
+	}
 
-		if (c < 0)
-			break;
+	return 0;
+}
 
-		switch (c) {
-		case 't':
-			tty_time_enable = 1;
+/**********************************************************************/
+
+/* time of the first data, and of the previous line (usec, see
+   ts_now), and the time shown by the cached prefix */
+long long ts_start, ts_prev, ts_shown = -1;
+
+/* Start timing from time "now" (usec), and display the timestamp of
+   the next line */
+void
+tty_ts_reset (long long now)
+{
+	ts_start = ts_prev = now;
+	ts_shown = -1;
+	tty_time = TTY_TIME_DISPLAY;
+}
+
+/* Returns the timestamp prefix for a line starting at time "now"
+   (usec). The prefix is kept formatted, and only re-formatted when
+   the time it shows changes. */
+const char *
+tty_ts_prefix (long long now, int *len)
+{
+	static char ts[TS_MAX];
+	static int tslen;
+	const struct ts_mode_s *m;
+	long long t;
+
+	m = &ts_modes[tty_time_enable];
+	switch (tty_time_enable) {
+	case TS_START: t = now - ts_start; break;
+	case TS_DELTA: t = now - ts_prev; break;
+	default: t = now; break;
+	}
+	ts_prev = now;
+
+	t -= t % m->step;
+	if ( t != ts_shown ) {
+		memcpy(ts, TS_PRE, sizeof(TS_PRE) - 1);
+		tslen = sizeof(TS_PRE) - 1;
+		tslen += m->fmt(ts + tslen, t);
+		memcpy(ts + tslen, TS_POST, sizeof(TS_POST) - 1);
+		tslen += sizeof(TS_POST) - 1;
+		ts_shown = t;
+	}
+	*len = tslen;
+
+	return ts;
+}
+
+/* Log a chunk of data read from port "pt" */
+void
+tty_log (struct port_s *pt, const unsigned char *buff, int len)
+{
+	struct iovec iov;
+
+	if ( opts.logcapture ) {
+		iov.iov_base = (void *)buff;
+		iov.iov_len = len;
+		cap_put(CAP_RX, pt - ports, &iov, 1, len);
+	} else {
+		logfile_write(buff, len);
+	}
+}
+
+/* Copy a chunk of data read from port "pt" to stdout, prefixing
+   every line with a timestamp if timestamps are enabled, and with the
+   port's tag if there are several ports. The clock is read at most
+   once per chunk, and line breaks are located with memchr(3). The
+   lines and their prefixes are gathered in a buffer, so that a chunk
+   normally goes out with a single write. */
+
+#define TS_BUFF_SZ 16384
+
+/* the port whose data were output last */
+struct port_s *out_port;
+
+void
+tty_output (struct port_s *pt, const unsigned char *buff, int len)
+{
+	static unsigned char tsb[TS_BUFF_SZ];
+	const unsigned char *p, *s, *e, *cr, *lf;
+	struct iovec iov;
+	const char *ts;
+	int n, l, tslen;
+	long long now;
+
+	if ( ! tty_time_enable && nports == 1 ) {
+		iov.iov_base = (void *)buff;
+		iov.iov_len = len;
+		sto_writev(&iov, 1);
+		return;
+	}
+
+	n = 0;
+	if ( pt != out_port ) {
+		/* another port has the word: end the line of the previous
+		   one, its remainder will be tagged anew */
+		if ( out_port && tty_time == TTY_TIME_NONE ) {
+			memcpy(tsb, "\r\n", 2);
+			n = 2;
+			tty_time = TTY_TIME_DISPLAY;
+		}
+		out_port = pt;
+	}
+
+	now = -1;
+	if ( tty_time == TTY_TIME_RESET ) {
+		now = ts_now();
+		tty_ts_reset(now);
+	}
+	ts = NULL;
+	tslen = 0;
+
+	s = p = buff;
+	e = buff + len;
+	cr = lf = NULL;
+	for (;;) {
+		if ( p < e && tty_time == TTY_TIME_DISPLAY ) {
+			if ( *p == '\n' || *p == '\r' ) {
+				p++;
+				continue;
+			}
+			/* first character of a line */
+			if ( tty_time_enable ) {
+				if ( now < 0 ) now = ts_now();
+				ts = tty_ts_prefix(now, &tslen);
+			}
+		} else if ( p < e ) {
+			/* skip to the next line break. Each of memchr's results
+			   is used until passed, so every byte is scanned at most
+			   twice */
+			if ( ! cr || cr < p ) {
+				cr = memchr(p, '\r', e - p);
+				if ( ! cr ) cr = e;
+			}
+			if ( ! lf || lf < p ) {
+				lf = memchr(p, '\n', e - p);
+				if ( ! lf ) lf = e;
+			}
+			p = ( cr < lf ) ? cr : lf;
+			if ( p < e ) {
+				tty_time = TTY_TIME_DISPLAY;
+				p++;
+			}
+			continue;
+		}
+
+		/* gather the data up to p, and the prefix if at a line start */
+		while ( s < p ) {
+			if ( n == TS_BUFF_SZ ) {
+				iov.iov_base = tsb;
+				iov.iov_len = n;
+				sto_writev(&iov, 1);
+				n = 0;
+			}
+			l = TS_BUFF_SZ - n;
+			if ( l > p - s ) l = p - s;
+			memcpy(tsb + n, s, l);
+			n += l;
+			s += l;
+		}
+		if ( p == e ) break;
+		if ( n + tslen + pt->taglen > TS_BUFF_SZ ) {
+			iov.iov_base = tsb;
+			iov.iov_len = n;
+			sto_writev(&iov, 1);
+			n = 0;
+		}
+		if ( tslen ) {
+			memcpy(tsb + n, ts, tslen);
+			n += tslen;
+		}
+		memcpy(tsb + n, pt->tag, pt->taglen);
+		n += pt->taglen;
+		tty_time = TTY_TIME_NONE;
+	}
+	iov.iov_base = tsb;
+	iov.iov_len = n;
+	sto_writev(&iov, 1);
+}
+
+/* How much can be read from a port, so that the output of
+   tty_output() is guaranteed to fit in the stdout backlog: in the
+   worst case a line is broken first, and every other byte starts a
+   new line. When switching between the copy and the zero-copy paths,
+   the backlog of the previous path must drain first. */
+int
+tty_rd_max (void)
+{
+	size_t sp, pfx;
+
+	if ( zc_active() )
+		return ( ring_len(&sto_q) || zc_full ) ? 0 : zc_sz - zc_len;
+	if ( zc_len )
+		return 0;
+
+	sp = ring_space(&sto_q);
+	pfx = ( tty_time_enable ? TS_MAX : 0 ) + ( nports > 1 ? TAG_MAX : 0 );
+	if ( pfx )
+		sp = ( sp > pfx + 2 ) ? (sp - pfx - 2) / (1 + pfx / 2) : 0;
+	/* while stdout is the bottleneck, wait for the backlog to drain
+	   some, instead of trickling the port in tiny reads */
+	if ( sp < TTY_RD_LOWAT && ring_len(&sto_q) )
+		return 0;
+
+	return ( sp < TTY_RD_SZ ) ? sp : TTY_RD_SZ;
+}
+
+/**********************************************************************/
+
+/* Bridge (--bridge). A chunk read from one port is written to the
+   other straight from the read buffer, before it is shown, so that
+   the display does not add to the forwarding latency. What the peer
+   does not take at once waits in its queue, like keyboard input. The
+   data pass through user space, rather than being moved with
+   splice(2), since they are also shown and logged. */
+
+long long bridge_start;     /* nsec */
+
+/* All the data read from port "pt" have been written to its peer */
+void
+fwd_done (struct port_s *pt)
+{
+	long long lat;
+
+	if ( ! pt->fwd.since ) return;
+	lat = now_ns() - pt->fwd.since;
+	pt->fwd.lat_sum += lat;
+	if ( lat > pt->fwd.lat_max ) pt->fwd.lat_max = lat;
+	pt->fwd.lat_n++;
+	pt->fwd.since = 0;
+}
+
+/* Forward the "len" bytes in "buff", just read from port "pt", to its
+   peer. The caller has made sure that the peer's queue has room. */
+void
+bridge_forward (struct port_s *pt, const unsigned char *buff, int len)
+{
+	struct port_s *to;
+	struct iovec iov;
+	ssize_t n;
+
+	to = pt->peer;
+	pt->fwd.bytes += len;
+	pt->fwd.chunks++;
+	if ( ! pt->fwd.since ) pt->fwd.since = now_ns();
+
+	n = 0;
+	if ( to->wr_ready && ! ring_len(&to->q) ) {
+		do {
+			n = write(to->fd, buff, len);
+		} while ( n < 0 && errno == EINTR );
+		if ( n < 0 ) {
+			if ( errno != EAGAIN && errno != EWOULDBLOCK )
+				fatal("write to %s failed: %s", to->name, strerror(errno));
+			to->wr_ready = 0;
+			ev_rearm(to->fd, EV_WRITE);
+			n = 0;
+		} else {
+			iov.iov_base = (void *)buff;
+			iov.iov_len = n;
+			cap_put(CAP_TX, to - ports, &iov, 1, n);
+		}
+	}
+	if ( n < len )
+		ring_put(&to->q, buff + n, len - n);
+	else
+		fwd_done(pt);
+}
+
+/* Show the statistics of both directions on "fd" */
+void
+bridge_report (int fd)
+{
+	struct port_s *pt;
+	double el;
+
+	el = (now_ns() - bridge_start) / 1e9;
+	for (pt = ports; pt < ports + nports; pt++) {
+		fd_printf(fd, "*** %.40s > %.40s: %llu bytes in %lu chunks, "
+				  "%.0f bytes/s\r\n", pt->name, pt->peer->name,
+				  pt->fwd.bytes, pt->fwd.chunks,
+				  ( el > 0 ) ? pt->fwd.bytes / el : 0.0);
+		if ( pt->fwd.lat_n )
+			fd_printf(fd, "***   latency: avg %.1f usec, max %.1f usec\r\n",
+					  pt->fwd.lat_sum / 1e3 / pt->fwd.lat_n,
+					  pt->fwd.lat_max / 1e3);
+	}
+}
+
+/* Sniffer (--sniff). The second port is the master side of a
+   pseudo-terminal (see "sniff.h"), bridged to the real port. The
+   settings that the program makes on the pseudo-terminal are copied
+   to the real port, checked for whenever the program has written
+   something (before it is forwarded), and every SNIFF_POLL_MS
+   regardless. */
+
+#define SNIFF_POLL_MS 100
+
+long long sniff_next;       /* msec */
+
+/* Create the pseudo-terminal, as port "pt", with the settings of the
+   real port */
+void
+sniff_port_open (struct port_s *pt)
+{
+	struct sniff_hw_s hw;
+
+	if ( ring_init(&pt->q, opts.txqueue) < 0 )
+		fatal("cannot allocate tx queue: %s", strerror(errno));
+
+	hw.baud = pt->peer->baud;
+	hw.flow = pt->peer->flow;
+	pt->fd = sniff_open(opts.sniff_link, &hw, pt->name, sizeof(pt->name));
+	if ( pt->fd < 0 )
+		fatal("cannot create pseudo-terminal: %s", strerror(errno));
+}
+
+/* Copy the settings that the program has changed on the
+   pseudo-terminal to the real port */
+void
+sniff_sync (void)
+{
+	struct sniff_hw_s hw;
+	struct port_s *pt;
+	int r;
+
+	r = sniff_poll(&hw);
+	if ( r <= 0 ) return;
+
+	pt = &ports[0];
+	/* a rate we do not know (or B0, hang-up) leaves the rate as is */
+	if ( hw.baud && term_set_baudrate(pt->fd, hw.baud) < 0 )
+		hw.baud = 0;
+	term_set_flowcntrl(pt->fd, hw.flow);
+	r = term_apply(pt->fd);
+
+	sto_flush();
+	if ( r < 0 ) {
+		term_revert(pt->fd);
+		fd_printf(msg_fd, "\r\n*** cannot configure %s: %s ***\r\n",
+				  pt->name, term_strerror(term_errno, errno));
+		return;
+	}
+	if ( hw.baud ) pt->baud = hw.baud;
+	pt->flow = hw.flow;
+	switch (hw.flow) {
+	case FC_RTSCTS: pt->flow_str = "RTS/CTS"; break;
+	case FC_XONXOFF: pt->flow_str = "xon/xoff"; break;
+	default: pt->flow_str = "none"; break;
+	}
+	fd_printf(msg_fd, "\r\n*** %s set by the program: baud %d, flow %s ***\r\n",
+			  pt->name, pt->baud, pt->flow_str);
+}
+
+/* File sending. Without --send-cmd, files are sent by the built-in
+   sender (see "fsend.h"), to the input port, from within the loop.
+   Any key typed during the transfer aborts it. */
+
+struct port_s *send_pt;     /* the port being sent to, or NULL */
+
+void
+send_start (const char *fname)
+{
+	int tfd;
+
+	if ( fsend_open(fname, opts.send_mode == XF_ASCII,
+					opts.send_char_us, opts.send_line_us) < 0 ) {
+		fd_printf(STO, "*** cannot send %s: %s\r\n", fname, strerror(errno));
+		return;
+	}
+	tfd = fsend_timer_fd();
+	if ( tfd >= 0 && ev_add(tfd, EV_READ) < 0 ) {
+		fd_printf(STO, "*** cannot send %s: %s\r\n", fname, strerror(errno));
+		fsend_close(NULL);
+		return;
+	}
+	send_pt = port;
+	fd_printf(STO, "*** sending %s (any key aborts) ***\r\n", fname);
+}
+
+/* End the transfer, and report on it. "why" is NULL if the whole file
+   has been sent. */
+void
+send_end (const char *why)
+{
+	struct fsend_stats_s st;
+	double el;
+
+	if ( fsend_timer_fd() >= 0 ) ev_del(fsend_timer_fd());
+	fsend_close(&st);
+	send_pt = NULL;
+
+	el = st.elapsed_ns / 1e9;
+	sto_flush();
+	fd_printf(STO, "\r\n*** %s: %llu of %llu bytes in %.3f sec, "
+			  "%.0f bytes/s ***\r\n", why ? why : "sent",
+			  st.done, st.size, el, ( el > 0 ) ? st.queued / el : 0.0);
+}
+
+/* Queue more of the file, and end the transfer once it has all been
+   written to the port */
+void
+send_pump (void)
+{
+	int r;
+
+	r = fsend_fill(&send_pt->q);
+	if ( r < 0 )
+		send_end(strerror(errno));
+	else if ( r == 0 && ! ring_len(&send_pt->q) )
+		send_end(NULL);
+}
+
+/* XMODEM and YMODEM transfers (see "xmodem.h"), ZMODEM ones (see
+   "zmodem.h"), and raw receives (see "frecv.h"), with the input port,
+   from within the loop. While one is in progress, what is read from
+   the port goes to the protocol instead of the screen. Any key typed
+   aborts it (and ends a raw receive). */
+
+/* most files sent in one YMODEM or ZMODEM batch */
+#define XFER_FILES_MAX 64
+
+/* The protocol modules have the same interface */
+struct xfer_ops_s {
+	int (*timer_fd)(void);
+	void (*tick)(void);
+	size_t (*input)(const unsigned char *buff, size_t len);
+	int (*fill)(struct ring *q);
+	void (*cancel)(void);
+	void (*close)(struct xm_stats_s *st);
+	/* raw receives only: take the data from the port, and show how
+	   much has been received */
+	ssize_t (*read)(int fd, size_t len);
+	void (*stats)(struct xm_stats_s *st);
+};
+
+const struct xfer_ops_s xm_ops = {
+	xm_timer_fd, xm_tick, xm_input, xm_fill, xm_cancel, xm_close,
+	NULL, NULL
+};
+const struct xfer_ops_s zm_ops = {
+	zm_timer_fd, zm_tick, zm_input, zm_fill, zm_cancel, zm_close,
+	NULL, NULL
+};
+const struct xfer_ops_s fr_ops = {
+	frecv_timer_fd, frecv_tick, frecv_input, frecv_fill, frecv_cancel,
+	frecv_close, frecv_read, frecv_stats
+};
+/* with an end marker, the data must be seen: they are read as usual */
+const struct xfer_ops_s fr_mark_ops = {
+	frecv_timer_fd, frecv_tick, frecv_input, frecv_fill, frecv_cancel,
+	frecv_close, NULL, frecv_stats
+};
+
+/* those of the transfer in progress */
+const struct xfer_ops_s *xfer_ops;
+
+/* when the progress of a raw receive was last shown (nsec) */
+long long xfer_shown;
+
+/* The transfer takes the data from port "pt" itself (with splice(2),
+   see frecv_read), unless they are logged or forwarded too, or the
+   io_uring engine keeps its own reads queued on the port */
+int
+xfer_reads (struct port_s *pt)
+{
+	return pt == xfer_pt && xfer_ops->read && ! opts.logfile
+		&& ! pt->peer && opts.engine != EV_URING;
+}
+
+/* Watch the transfer just started, with "ops". Returns negative on
+   failure (errno is set), and the transfer is closed. */
+int
+xfer_begin (const struct xfer_ops_s *ops)
+{
+	int e;
+
+	if ( ev_add(ops->timer_fd(), EV_READ) < 0 ) {
+		e = errno;
+		ops->close(NULL);
+		errno = e;
+		return -1;
+	}
+	xfer_ops = ops;
+	xfer_pt = port;
+
+	return 0;
+}
+
+/* Send the file named in "line" with XMODEM, or the files listed
+   there (with shell-like quoting) with YMODEM or ZMODEM */
+void
+xfer_send (const char *line)
+{
+	const struct xfer_ops_s *ops = &xm_ops;
+	char *files[XFER_FILES_MAX];
+	int nfiles, i, r, e;
+
+	if ( opts.send_mode != XF_XMODEM ) {
+		nfiles = 0;
+		r = split_quoted(line, &nfiles, files, XFER_FILES_MAX);
+		if ( r != 0 ) {
+			/* a shorter list, or a truncated name, is not what was
+			   asked for */
+			for (i = 0; i < nfiles; i++)
+				free(files[i]);
+			if ( r < 0 )
+				fd_printf(STO, "*** cannot parse: %s\r\n", line);
+			else if ( r & SPLIT_DROP )
+				fd_printf(STO, "*** too many files (at most %d)\r\n",
+						  XFER_FILES_MAX);
+			else
+				fd_printf(STO, "*** file name too long\r\n");
+			return;
+		}
+		if ( nfiles && opts.send_mode == XF_ZMODEM ) {
+			r = zm_send(files, nfiles);
+			ops = &zm_ops;
+		} else if ( nfiles ) {
+			r = xm_send(XM_YMODEM, files, nfiles, opts.window);
+		} else {
+			r = -1;
+			errno = EINVAL;
+		}
+		e = errno;
+		for (i = 0; i < nfiles; i++)
+			free(files[i]);
+		errno = e;
+	} else {
+		files[0] = (char *)line;
+		r = xm_send(XM_XMODEM, files, 1, opts.window);
+	}
+	if ( r >= 0 ) r = xfer_begin(ops);
+	if ( r < 0 ) {
+		fd_printf(STO, "*** cannot send %s: %s\r\n", line, strerror(errno));
+		return;
+	}
+	fd_printf(STO, "*** %s: sending %s (any key aborts) ***\r\n",
+			  xfer_mode_str[opts.send_mode], line);
+}
+
+/* Receive with XMODEM or raw into file "path", or with YMODEM or
+   ZMODEM into directory "path" */
+void
+xfer_receive (const char *path)
+{
+	const struct xfer_ops_s *ops = &xm_ops;
+	int r;
+
+	if ( opts.receive_mode == XF_RAW ) {
+		r = frecv_open(path, opts.receive_max, opts.receive_idle_ms,
+					   opts.receive_end,
+					   opts.receive_end ? strlen(opts.receive_end) : 0);
+		ops = opts.receive_end ? &fr_mark_ops : &fr_ops;
+		xfer_shown = 0;
+	} else if ( opts.receive_mode == XF_ZMODEM ) {
+		r = zm_receive(path);
+		ops = &zm_ops;
+	} else if ( opts.receive_mode == XF_YMODEM ) {
+		r = xm_receive(XM_YMODEM, path);
+	} else {
+		r = xm_receive(XM_XMODEM, path);
+	}
+	if ( r >= 0 ) r = xfer_begin(ops);
+	if ( r < 0 ) {
+		fd_printf(STO, "*** cannot receive %s: %s\r\n",
+				  path, strerror(errno));
+		return;
+	}
+	fd_printf(STO, "*** %s: receiving (any key %s) ***\r\n",
+			  xfer_mode_str[opts.receive_mode],
+			  ( opts.receive_mode == XF_RAW ) ? "stops" : "aborts");
+}
+
+/* End the transfer, and report on it */
+void
+xfer_end (void)
+{
+	struct xm_stats_s st;
+	struct port_s *pt;
+	double el, rate, line;
+
+	ev_del(xfer_ops->timer_fd());
+	xfer_ops->close(&st);
+	pt = xfer_pt;
+	xfer_pt = NULL;
+	xfer_ops = NULL;
+	/* a raw receive leaves what follows its end in the port, and may
+	   have stopped reading it before it was drained */
+	pt->rd_ready = 1;
+
+	el = st.elapsed_ns / 1e9;
+	rate = ( el > 0 ) ? st.bytes / el : 0.0;
+	/* characters per second: start, data, parity and stop bits */
+	line = pt->baud / (double)(2 + pt->databits + ( pt->parity != P_NONE ));
+	sto_flush();
+	if ( st.err )
+		fd_printf(STO, "\r\n*** transfer failed: %s ***", st.err);
+	else if ( st.end )
+		fd_printf(STO, "\r\n*** receive ended: %s ***", st.end);
+	if ( st.skipped )
+		fd_printf(STO, "\r\n*** %d file%s skipped by the receiver ***",
+				  st.skipped, ( st.skipped == 1 ) ? "" : "s");
+	fd_printf(STO, "\r\n*** %d file%s, %llu bytes in %.3f sec, %.0f bytes/s "
+			  "(%.0f%% of line rate), %lu retries ***\r\n",
+			  st.files, ( st.files == 1 ) ? "" : "s", st.bytes, el, rate,
+			  ( line > 0 ) ? rate * 100 / line : 0.0, st.retries);
+}
+
+/* Give the "len" bytes at "buff", read from port "pt", to the
+   transfer in progress on it. What it does not take, because it
+   follows the end of the transfer, is shown */
+void
+xfer_input (struct port_s *pt, const unsigned char *buff, size_t len)
+{
+	size_t n = 0;
+
+	if ( pt == xfer_pt ) n = xfer_ops->input(buff, len);
+	if ( n < len ) tty_output(pt, buff + n, len - n);
+}
+
+/* Show how much a raw receive has stored so far, at most once a
+   second */
+void
+xfer_progress (void)
+{
+	struct xm_stats_s st;
+	long long now;
+	double el;
+
+	now = now_ns();
+	if ( now - xfer_shown < 1000000000LL ) return;
+	xfer_shown = now;
+
+	xfer_ops->stats(&st);
+	el = st.elapsed_ns / 1e9;
+	fd_printf(STO, "\r*** %llu bytes, %.0f bytes/s ***",
+			  st.bytes, ( el > 0 ) ? st.bytes / el : 0.0);
+}
+
+/* Queue what the protocol has to send, and end the transfer once it
+   has all been written to the port */
+void
+xfer_pump (void)
+{
+	int r;
+
+	r = xfer_ops->fill(&xfer_pt->q);
+	/* ZMODEM starts again from an earlier position: what the port has
+	   not sent yet is stale */
+	if ( r == 2 ) term_flush(xfer_pt->fd);
+	if ( ! r && ! ring_len(&xfer_pt->q) )
+		xfer_end();
+}
+
+/* Send file "fname" (or files, with YMODEM or ZMODEM), with
+   --send-cmd, or built-in */
+void
+send_file (const char *fname)
+{
+	if ( opts.send_cmd[0] )
+		run_cmd(port->fd, send_argv, fname);
+	else if ( ! fname[0] )
+		return;
+	else if ( opts.send_mode == XF_XMODEM || opts.send_mode == XF_YMODEM
+			  || opts.send_mode == XF_ZMODEM )
+		xfer_send(fname);
+	else
+		send_start(fname);
+}
+
+/**********************************************************************/
+
+/* How much can be read from port "pt": as much as can be shown, and,
+   with --bridge, as much as its peer's queue has room for */
+int
+port_rd_max (struct port_s *pt)
+{
+	size_t n;
+
+	n = tty_rd_max();
+	if ( pt->peer && n > ring_space(&pt->peer->q) )
+		n = ring_space(&pt->peer->q);
+
+	return n;
+}
+
+/**********************************************************************/
+
+/* Make port number "i" the input port. With --sniff, the
+   pseudo-terminal (port 2) cannot be: it belongs to the other
+   program, and has no settings of its own */
+void
+port_select (int i)
+{
+	if ( i < 0 || i >= nports || ( opts.sniff && i == 1 ) ) {
+		fd_printf(STO, "\x07");
+		return;
+	}
+	port = &ports[i];
+	fd_printf(STO, "\r\n*** input: %s (%d of %d) ***\r\n",
+			  port->name, i + 1, nports);
+}
+
+/* Perform the command given by function character "c", on the input
+   port. Returns non-zero if picocom must exit. */
+int
+do_command (unsigned char c)
+{
+	int newbaud, newflow, newparity, newbits;
+	char *newflow_str, *newparity_str;
+	char fname[128];
+	struct logfile_stats_s lst;
+	int i, r;
+
+	/* command output must not overtake queued port data */
+	sto_flush();
+
+	switch (c) {
+	case KEY_EXIT:
+		return 1;
+	case KEY_QUIT:
+		for (i = 0; i < nports; i++) {
+			term_set_hupcl(ports[i].fd, 0);
+			term_flush(ports[i].fd);
+			term_apply(ports[i].fd);
+			term_erase(ports[i].fd);
+		}
+		return 1;
+	case KEY_STATUS:
+		fd_printf(STO, "\r\n");
+		if ( nports > 1 )
+			fd_printf(STO, "*** port: %s (%d of %d)\r\n",
+					  port->name, (int)(port - ports) + 1, nports);
+		fd_printf(STO, "*** baud: %d\r\n", port->baud);
+		fd_printf(STO, "*** flow: %s\r\n", port->flow_str);
+		fd_printf(STO, "*** parity: %s\r\n", port->parity_str);
+		fd_printf(STO, "*** databits: %d\r\n", port->databits);
+		fd_printf(STO, "*** dtr: %s\r\n", port->dtr_up ? "up" : "down");
+		fd_printf(STO, "*** timestamp: %s\r\n",
+				  ts_modes[tty_time_enable].name);
+		fd_printf(STO, "*** batch: vmin=%d vtime=%d\r\n",
+				  opts.vmin, opts.vtime);
+		if ( logfile_stats(&lst) >= 0 ) {
+			fd_printf(STO, "*** log: %s (%s)\r\n", opts.logfile,
+					  opts.logcapture ? "capture" : "raw");
+			fd_printf(STO, "*** log lag: %ld ms, %lu bytes pending\r\n",
+					  lst.lag_ms, (unsigned long)lst.pending);
+			fd_printf(STO, "*** log written: %llu, dropped: %llu, "
+					  "syncs: %lu\r\n", lst.written, lst.dropped, lst.syncs);
+			if ( lst.err )
+				fd_printf(STO, "*** log error: %s\r\n", strerror(lst.err));
+		}
+		if ( opts.bridge ) bridge_report(STO);
+		break;
+	case KEY_PULSE:
+		fd_printf(STO, "\r\n*** pulse DTR ***\r\n");
+		if ( term_pulse_dtr(port->fd) < 0 )
+			fd_printf(STO, "*** FAILED\r\n");
+		break;
+	case KEY_TOGGLE:
+		if ( port->dtr_up )
+			r = term_lower_dtr(port->fd);
+		else
+			r = term_raise_dtr(port->fd);
+		if ( r >= 0 ) port->dtr_up = ! port->dtr_up;
+		fd_printf(STO, "\r\n*** DTR: %s ***\r\n",
+				  port->dtr_up ? "up" : "down");
+		break;
+	case KEY_BAUD_UP:
+		newbaud = baud_up(port->baud);
+		term_set_baudrate(port->fd, newbaud);
+		ring_clear(&port->q); term_flush(port->fd);
+		if ( term_apply(port->fd) >= 0 ) port->baud = newbaud;
+		fd_printf(STO, "\r\n*** baud: %d ***\r\n", port->baud);
+		break;
+	case KEY_BAUD_DN:
+		newbaud = baud_down(port->baud);
+		term_set_baudrate(port->fd, newbaud);
+		ring_clear(&port->q); term_flush(port->fd);
+		if ( term_apply(port->fd) >= 0 ) port->baud = newbaud;
+		fd_printf(STO, "\r\n*** baud: %d ***\r\n", port->baud);
+		break;
+	case KEY_FLOW:
+		newflow = flow_next(port->flow, &newflow_str);
+		term_set_flowcntrl(port->fd, newflow);
+		ring_clear(&port->q); term_flush(port->fd);
+		if ( term_apply(port->fd) >= 0 ) {
+			port->flow = newflow;
+			port->flow_str = newflow_str;
+		}
+		fd_printf(STO, "\r\n*** flow: %s ***\r\n", port->flow_str);
+		break;
+	case KEY_PARITY:
+		newparity = parity_next(port->parity, &newparity_str);
+		term_set_parity(port->fd, newparity);
+		ring_clear(&port->q); term_flush(port->fd);
+		if ( term_apply(port->fd) >= 0 ) {
+			port->parity = newparity;
+			port->parity_str = newparity_str;
+		}
+		fd_printf(STO, "\r\n*** parity: %s ***\r\n",
+				  port->parity_str);
+		break;
+	case KEY_BITS:
+		newbits = bits_next(port->databits);
+		term_set_databits(port->fd, newbits);
+		ring_clear(&port->q); term_flush(port->fd);
+		if ( term_apply(port->fd) >= 0 ) port->databits = newbits;
+		fd_printf(STO, "\r\n*** databits: %d ***\r\n",
+				  port->databits);
+		break;
+	case KEY_SEND:
+		fd_printf(STO, "\r\n*** file: ");
+		r = fd_readline(STI, STO, fname, sizeof(fname));
+		fd_printf(STO, "\r\n");
+		if ( r < -1 && errno == EINTR ) break;
+		if ( r <= -1 )
+			fatal("cannot read filename: %s", strerror(errno));
+		send_file(fname);
+		break;
+	case KEY_RECEIVE:
+		if ( opts.receive_mode == XF_YMODEM
+			 || opts.receive_mode == XF_ZMODEM )
+			fd_printf(STO, "*** directory: ");
+		else
+			fd_printf(STO, "*** file: ");
+		r = fd_readline(STI, STO, fname, sizeof(fname));
+		fd_printf(STO, "\r\n");
+		if ( r < -1 && errno == EINTR ) break;
+		if ( r <= -1 )
+			fatal("cannot read filename: %s", strerror(errno));
+		if ( opts.receive_mode != XF_CMD )
+			xfer_receive(fname);
+		else if ( fname[0] )
+			send_file(fname);
+		else
+			run_cmd(port->fd, receive_argv, NULL);
+		break;
+	case KEY_BREAK:
+		term_break(port->fd);
+		fd_printf(STO, "\r\n*** break sent ***\r\n");
+		break;
+	case KEY_TIMESTAMP:
+		/* cycle through the modes: off, start, delta, iso, off... */
+		tty_time_enable = (tty_time_enable + 1) % TS_NMODES;
+		tty_time = TTY_TIME_RESET;
+		fd_printf(STO, "\r\n*** timestamp: %s ***\r\n",
+				  ts_modes[tty_time_enable].name);
+		break;
+	case KEY_PORT:
+		port_select((port - ports + 1) % nports);
+		break;
+	default:
+		/* a digit selects the input port by number */
+		if ( c >= '1' && c <= '9' )
+			port_select(c - '1');
+		break;
+	}
+
+	return 0;
+}
+
+/**********************************************************************/
+
+/* Output up to "max" bytes of the data read by the receive thread.
+   Once the thread has stopped, and the data it read before stopping
+   have all been output, report why it stopped. */
+void
+rx_output (int max)
+{
+	struct iovec iov[2];
+	int i, cnt, st;
+	size_t len;
+
+	st = rxthr_status();
+	cnt = ring_iov(&rx_q, iov);
+	for (i = 0; i < cnt && max > 0; i++) {
+		len = iov[i].iov_len;
+		if ( len > (size_t)max ) len = max;
+		tty_log(&ports[0], iov[i].iov_base, len);
+		xfer_input(&ports[0], iov[i].iov_base, len);
+		rxthr_consume(len);
+		max -= len;
+	}
+
+	if ( st && ! rxthr_pending() ) {
+		if ( st < 0 )
+			fatal("term closed");
+		else
+			fatal("read from term failed: %s", strerror(st));
+	}
+}
+
+/**********************************************************************/
+
+/* Headless mode: stdin is not a terminal but a plain byte stream
+   (e.g. a pipe or a file). It is read straight into the queue of the
+   input port, in blocks as large as the queue has room for, without
+   escape processing. It is only read while the queue has room, so a
+   fast producer is slowed down to the port's pace instead of losing
+   data. At end-of-file picocom exits, once the queue has been written
+   out. A headless bridge does not read stdin at all, and runs until
+   it is signalled to stop. */
+
+int sti_polled;     /* stdin is in the event loop */
+int sti_paused;     /* ... but taken out while the queue is full */
+int sti_eof;
+
+/* Headless, there is no escape key to quit with: SIGINT and SIGTERM
+   make loop() return instead, as at the end of stdin, so that the
+   output, the log file and the capture are written out. A bridge
+   stops this way too, and reports its statistics. */
+volatile sig_atomic_t stop_req;
+
+void
+stop_handler (int signum)
+{
+	stop_req = 1;
+}
+
+void
+sti_open (void)
+{
+	/* regular files cannot be polled (epoll), and are always
+	   readable */
+	sti_polled = ( ev_add(STI, EV_READ) >= 0 );
+}
+
+void
+sti_input (void)
+{
+	ssize_t n;
+
+	if ( sti_eof || ! ring_space(&port->q) ) return;
+
+	do {
+		n = ring_read(&port->q, STI);
+	} while ( n < 0 && errno == EINTR );
+	if ( n == 0 ) {
+		sti_eof = 1;
+		if ( sti_polled && ! sti_paused ) ev_del(STI);
+	} else if ( n < 0 && errno != EAGAIN && errno != EWOULDBLOCK ) {
+		fatal("read from stdin failed: %s", strerror(errno));
+	}
+}
+
+/* Take stdin out of the loop while the queue is full (it is
+   level-triggered), and put it back when the queue is half empty */
+void
+sti_throttle (void)
+{
+	if ( ! sti_polled || sti_eof ) return;
+
+	if ( ! sti_paused && ring_space(&port->q) == 0 ) {
+		ev_del(STI);
+		sti_paused = 1;
+	} else if ( sti_paused && ring_space(&port->q) >= opts.txqueue / 2 ) {
+		if ( ev_add(STI, EV_READ) < 0 )
+			fatal("cannot add stdin to event loop: %s", strerror(errno));
+		sti_paused = 0;
+	}
+}
+
+/**********************************************************************/
+
+/* Read up to "rdmax" bytes from port "pt", and output them */
+void
+port_input (struct port_s *pt, int rdmax)
+{
+	int n;
+
+	do {
+		if ( zc_active() )
+			n = splice(pt->fd, NULL, zc_pipe[1], NULL, rdmax,
+					   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		else if ( xfer_reads(pt) )
+			n = xfer_ops->read(pt->fd, rdmax);
+		else
+			n = ev_read(pt->fd, tty_rd_buff, rdmax);
+	} while (n < 0 && errno == EINTR);
+	if (n == 0)
+		fatal("term %s closed", pt->name);
+	else if ( n < 0 ) {
+		if ( errno != EAGAIN && errno != EWOULDBLOCK )
+			fatal("read from %s failed: %s", pt->name, strerror(errno));
+		/* Every splice occupies at least one pipe buffer slot, so the
+		   pipe can fill up long before zc_len reaches zc_sz, and
+		   splice cannot tell us whether it was the pipe or the port
+		   that had nothing to give. If the pipe is not empty, assume
+		   it was the pipe and retry once it has been drained some. */
+		if ( zc_active() && zc_len )
+			zc_full = 1;
+	} else if ( zc_active() ) {
+		zc_len += n;
+		zc_drain();
+	} else if ( ! xfer_reads(pt) ) {
+		tty_log(pt, tty_rd_buff, n);
+		if ( pt->peer ) bridge_forward(pt, tty_rd_buff, n);
+		xfer_input(pt, tty_rd_buff, n);
+	}
+	/* a short read means the port was drained */
+	if ( n < rdmax && ! zc_full ) {
+		pt->rd_ready = 0;
+		ev_rearm(pt->fd, EV_READ);
+	}
+}
+
+/* Write as much of the queue of port "pt" as the port accepts */
+void
+port_output (struct port_s *pt)
+{
+	struct iovec iov[2];
+	int iovcnt, n;
+
+	iovcnt = ring_iov(&pt->q, iov);
+	n = ring_write(&pt->q, pt->fd);
+	if ( n > 0 ) {
+		cap_put(CAP_TX, pt - ports, iov, iovcnt, n);
+		if ( pt->peer && ! ring_len(&pt->q) ) fwd_done(pt->peer);
+	} else {
+		if ( errno != EAGAIN && errno != EWOULDBLOCK )
+			fatal("write to %s failed: %s", pt->name, strerror(errno));
+		pt->wr_ready = 0;
+		ev_rearm(pt->fd, EV_WRITE);
+	}
+}
+
+/* Returns the port with filedes "fd", or NULL */
+struct port_s *
+port_find (int fd)
+{
+	int i;
+
+	for (i = 0; i < nports; i++)
+		if ( ports[i].fd == fd )
+			return &ports[i];
+
+	return NULL;
+}
+
+/* size of the buffer used for reading from stdin */
+#define STI_RD_SZ 4096
+
+unsigned char sti_rd_buff[STI_RD_SZ];
+
+void
+loop(void)
+{
+	enum {
+		ST_COMMAND,
+		ST_TRANSPARENT
+	} state;
+	struct ev_event evs[32];
+	struct port_s *pt;
+	int sti_ready;
+	unsigned char *p, *q, *e;
+	int i, n, rdmax, tmo, rd_first;
+	long long now, tick_next;
+
+	for (pt = ports; pt < ports + nports; pt++) {
+		ring_clear(&pt->q);
+		pt->rd_ready = pt->wr_ready = 0;
+	}
+	state = ST_TRANSPARENT;
+	tick_next = 0;
+	rd_first = 0;
+
+	for (;;) {
+		if ( stop_req ) {
+			sto_flush();
+			return;
+		}
+
+		/* the ports are edge-triggered; don't block while one is known
+		   to have data pending, and there is room for them */
+		if ( rx_fd >= 0 ) ports[0].rd_ready = ( rxthr_pending() > 0 );
+		tmo = -1;
+		for (pt = ports; pt < ports + nports; pt++) {
+			if ( pt->rd_ready && port_rd_max(pt) ) tmo = 0;
+			/* likewise for writing: a partial write does not mean
+			   that the port would block */
+			if ( pt->wr_ready && ring_len(&pt->q) ) tmo = 0;
+		}
+		if ( headless && ! opts.bridge && ! sti_polled && ! sti_eof
+			 && ring_space(&port->q) )
+			tmo = 0;
+		if ( tty_rd_tick && rx_fd < 0 && tmo < 0 ) {
+			now = now_ms();
+			tmo = ( tick_next > now ) ? tick_next - now : 0;
+		}
+		if ( opts.sniff && tmo != 0 ) {
+			now = now_ms();
+			n = ( sniff_next > now ) ? sniff_next - now : 0;
+			if ( tmo < 0 || n < tmo ) tmo = n;
+		}
+		n = ev_wait(evs, sizeof(evs) / sizeof(evs[0]), tmo);
+		if ( n < 0 )
+			fatal("ev_wait failed: %d : %s", errno, strerror(errno));
+		if ( tty_rd_tick && rx_fd < 0 ) {
+			now = now_ms();
+			if ( now >= tick_next ) {
+				/* look for data that the drivers hold back */
+				for (pt = ports; pt < ports + nports; pt++)
+					pt->rd_ready = 1;
+				tick_next = now + tty_rd_tick;
+			}
+		}
+
+		sti_ready = 0;
+		for (i = 0; i < n; i++) {
+			if ( evs[i].fd == STI ) {
+				sti_ready = 1;
+			} else if ( evs[i].fd == sto_fd ) {
+				sto_wr_ready = 1;
+			} else if ( evs[i].fd == rx_fd ) {
+				rxthr_ack();
+			} else if ( evs[i].fd == fsend_timer_fd() ) {
+				fsend_tick();
+			} else if ( xfer_pt && evs[i].fd == xfer_ops->timer_fd() ) {
+				xfer_ops->tick();
+				if ( xfer_ops->stats ) xfer_progress();
+			} else if ( (pt = port_find(evs[i].fd)) ) {
+				if ( evs[i].events & EV_READ ) pt->rd_ready = 1;
+				if ( evs[i].events & EV_WRITE ) pt->wr_ready = 1;
+			}
+		}
+
+		if ( sto_wr_ready && ring_len(&sto_q) ) {
+
+			/* write backlog to stdout */
+
+			sto_drain();
+		}
+
+		if ( sto_wr_ready && zc_len ) {
+
+			/* move pass-through data to stdout */
+
+			zc_drain();
+		}
+
+		if ( headless && ! opts.bridge ) {
+
+			/* read from stdin, as a byte stream */
+
+			if ( sti_ready || ! sti_polled ) sti_input();
+			sti_throttle();
+
+		} else if ( sti_ready ) {
+
+			/* read from terminal */
+
+			do {
+				n = read(STI, sti_rd_buff, sizeof(sti_rd_buff));
+			} while (n < 0 && errno == EINTR);
+			if (n == 0)
+				fatal("stdin closed");
+			else if (n < 0)
+				fatal("read from stdin failed: %s", strerror(errno));
+
+			p = sti_rd_buff;
+			e = sti_rd_buff + n;
+			if ( send_pt ) {
+				/* a key aborts the transfer, and is dropped */
+				ring_clear(&send_pt->q);
+				send_end("aborted");
+				e = p;
+			} else if ( xfer_pt ) {
+				/* the queue is not cleared: the block being sent
+				   must be completed, for the cancel to be seen */
+				xfer_ops->cancel();
+				e = p;
+			}
+			while ( p < e ) {
+				switch (state) {
+
+				case ST_COMMAND:
+					state = ST_TRANSPARENT;
+					if ( *p == opts.escape ) {
+						/* pass the escape character down */
+						tty_q_put(*p++);
+						break;
+					}
+					if ( do_command(*p++) ) {
+						sto_flush();
+						return;
+					}
+					break;
+
+				case ST_TRANSPARENT:
+					/* copy everything up to the next escape character */
+					q = memchr(p, opts.escape, e - p);
+					if ( ! q ) q = e;
+					if ( ring_put(&port->q, p, q - p) != q - p )
+						fd_printf(STO, "\x07");
+					p = q;
+					if ( p < e ) {
+						state = ST_COMMAND;
+						p++;
+					}
+					break;
+
+				default:
+					assert(0);
+					break;
+				}
+			}
+		}
+
+		if ( opts.sniff ) {
+
+			/* look for new settings of the pseudo-terminal */
+
+			now = now_ms();
+			if ( ports[1].rd_ready || now >= sniff_next ) {
+				sniff_sync();
+				sniff_next = now + SNIFF_POLL_MS;
+			}
+		}
+
+		if ( rx_fd >= 0 ) {
+
+			/* take what the receive thread has read from the port */
+
+			rx_output(tty_rd_max());
+
+		} else {
+
+			/* read from the ports. They share the room in the stdout
+			   backlog, so they take turns at being read first */
+
+			for (i = 0; i < nports; i++) {
+				pt = &ports[(rd_first + i) % nports];
+				rdmax = port_rd_max(pt);
+				if ( pt->rd_ready && rdmax ) port_input(pt, rdmax);
+			}
+			rd_first = (rd_first + 1) % nports;
+		}
+
+		/* write to the ports */
+
+		for (pt = ports; pt < ports + nports; pt++)
+			if ( pt->wr_ready && ring_len(&pt->q) ) port_output(pt);
+
+		if ( send_pt ) {
+
+			/* refill the queue with the file being sent */
+
+			send_pump();
+		}
+
+		if ( xfer_pt ) {
+
+			/* run the file transfer protocol */
+
+			xfer_pump();
+		}
+
+		if ( headless && ! opts.bridge ) {
+			sti_throttle();
+			if ( sti_eof && ! ring_len(&port->q) ) {
+				/* all of stdin has gone out */
+				term_drain(port->fd);
+				sto_flush();
+				return;
+			}
+		}
+	}
+}
+
+/**********************************************************************/
+
+void
+deadly_handler(int signum)
+{
+	kill(0, SIGTERM);
+	sleep(1);
+#ifdef UUCP_LOCK_DIR
+	uucp_unlock();
+#endif
+	exit(EXIT_FAILURE);
+}
+
+void
+establish_signal_handlers (void)
+{
+        struct sigaction exit_action, ign_action;
+
+        /* Set up the structure to specify the exit action. */
+        exit_action.sa_handler = deadly_handler;
+        sigemptyset (&exit_action.sa_mask);
+        exit_action.sa_flags = 0;
+
+        /* Set up the structure to specify the ignore action. */
+        ign_action.sa_handler = SIG_IGN;
+        sigemptyset (&ign_action.sa_mask);
+        ign_action.sa_flags = 0;
+
+        /* a bridge, or picocom headless, stops instead (see stop_req) */
+        if ( opts.bridge || headless ) exit_action.sa_handler = stop_handler;
+
+        sigaction (SIGTERM, &exit_action, NULL);
+
+        /* headless, there is no escape key to quit with */
+        sigaction (SIGINT, headless ? &exit_action : &ign_action, NULL);
+        sigaction (SIGHUP, &ign_action, NULL);
+        sigaction (SIGALRM, &ign_action, NULL);
+        sigaction (SIGUSR1, &ign_action, NULL);
+        sigaction (SIGUSR2, &ign_action, NULL);
+        sigaction (SIGPIPE, &ign_action, NULL);
+}
+
+/**********************************************************************/
+
+void
+show_usage(char *name)
+{
+	char *s;
+
+	s = strrchr(name, '/');
+	s = s ? s+1 : name;
+
+	printf("picocom v%s\n", VERSION_STR);
+	printf("Usage is: %s [options] <tty device> [<tty device>...]\n", s);
+	printf("Options are:\n");
+	printf("  --<b>aud <baudrate>\n");
+	printf("  --<f>low s (=soft) | h (=hard) | n (=none)\n");
+	printf("  --<p>arity o (=odd) | e (=even) | n (=none)\n");
+	printf("  --<d>atabits 5 | 6 | 7 | 8\n");
+	printf("  --<e>scape <char>\n");
+	printf("  --no<i>nit\n");
+	printf("  --no<r>eset\n");
+	printf("  --no<l>ock\n");
+	printf("  --<s>end-cmd <command>\n");
+	printf("  --recei<v>e-cmd <command>\n");
+	printf("  --send-<M>ode raw | ascii | xmodem | ymodem | zmodem\n");
+	printf("  --send-<P>ace <char msec>[,<line msec>]\n");
+	printf("  --recei<V>e-mode cmd | raw | xmodem | ymodem | zmodem\n");
+	printf("  --receive-<L>imit <bytes>[k|M|G][,<idle msec>[,<end marker>]]\n");
+	printf("  --<w>indow <blocks>\n");
+	printf("  --<t>imestamp[=off | start | delta | iso]\n");
+	printf("  --tx<q>ueue <bytes>\n");
+	printf("  --en<g>ine select | epoll | uring\n");
+	printf("  --<z>erocopy\n");
+	printf("  --r<x>thread\n");
+	printf("  --b<a>tch latency | throughput | <vmin>[,<vtime>]\n");
+	printf("  --l<o>gfile <filename>\n");
+	printf("  --logfor<m>at raw | capture\n");
+	printf("  --logb<u>f <bytes>\n");
+	printf("  --logs<y>nc <msec>\n");
+	printf("  --<R>eplay <capture file>\n");
+	printf("  --replay-p<O>rt <n>\n");
+	printf("  --<S>peed <factor> | max\n");
+	printf("  --<B>ridge\n");
+	printf("  --s<n>iff[=<link>]\n");
+	printf("  --<h>elp\n");
+	printf("<?> indicates the equivalent short option.\n");
+	printf("A <tty device> can be followed by settings for it alone:\n"
+		   "  <device>[,b=<baudrate>][,f=<flow>][,p=<parity>][,d=<databits>]\n");
+	printf("With several ports, C-n or a digit after the escape character\n"
+		   "selects the one that keyboard input goes to.\n");
+	printf("With --replay no port is given: the capture is played through\n"
+		   "a new pseudo-terminal. Only the data received on one port are\n"
+		   "played: the first given when capturing, or the <n>th one\n"
+		   "(from 0) with --replay-port.\n");
+	printf("With --bridge two ports are given, and what is received on\n"
+		   "each is sent to the other.\n");
+	printf("With --sniff one port is given, and bridged to a new\n"
+		   "pseudo-terminal (optionally reached by the symlink <link>),\n"
+		   "to be used by another program instead of the port.\n");
+	printf("Short options are prefixed by \"-\" instead of by \"--\".\n");
+}
+
+/**********************************************************************/
+
+/* Parse the argument of --batch: a preset name, or "vmin[,vtime]" */
+int
+parse_batch (const char *s)
+{
+	char *e;
+	long vmin, vtime;
+	int i;
+
+	for (i = 0; batch_presets[i].name; i++) {
+		if ( strcmp(s, batch_presets[i].name) == 0 ) {
+			opts.vmin = batch_presets[i].vmin;
+			opts.vtime = batch_presets[i].vtime;
+			opts.batch_str = (char *)batch_presets[i].name;
+			return 0;
+		}
+	}
+
+	vmin = strtol(s, &e, 10);
+	if ( e == s || vmin < 0 || vmin > 255 ) return -1;
+	vtime = 0;
+	if ( *e == ',' ) {
+		s = e + 1;
+		vtime = strtol(s, &e, 10);
+		if ( e == s || vtime < 0 || vtime > 255 ) return -1;
+	}
+	if ( *e ) return -1;
+
+	opts.vmin = vmin;
+	opts.vtime = vtime;
+	opts.batch_str = "custom";
+
+	return 0;
+}
+
+/* Parse the argument of --send-mode or --receive-mode, return the
+   mode or negative if invalid */
+int
+parse_xfer_mode (const char *s)
+{
+	int i;
+
+	for (i = 0; i < XF_NMODES; i++)
+		if ( strcmp(s, xfer_mode_str[i]) == 0 )
+			return i;
+
+	return -1;
+}
+
+/* Parse the argument of --send-pace: "<char msec>[,<line msec>]" */
+int
+parse_pace (const char *s)
+{
+	char *e;
+	double c, l;
+
+	c = strtod(s, &e);
+	if ( e == s || c < 0 || c > 60000 ) return -1;
+	l = 0;
+	if ( *e == ',' ) {
+		s = e + 1;
+		l = strtod(s, &e);
+		if ( e == s || l < 0 || l > 60000 ) return -1;
+	}
+	if ( *e ) return -1;
+
+	opts.send_char_us = c * 1000;
+	opts.send_line_us = l * 1000;
+
+	return 0;
+}
+
+/* Parse the argument of --receive-limit: "<bytes>[k|M|G][,<idle
+   msec>[,<end marker>]]", zero for no limit. The marker is the rest
+   of the argument, commas included */
+int
+parse_limit (const char *s)
+{
+	char *e, *end;
+	unsigned long long max, mult;
+	long idle;
+
+	if ( *s == '-' ) return -1;
+	errno = 0;
+	max = strtoull(s, &e, 10);
+	if ( e == s || errno ) return -1;
+	switch (*e) {
+	case 'k': mult = 1ULL << 10; e++; break;
+	case 'M': mult = 1ULL << 20; e++; break;
+	case 'G': mult = 1ULL << 30; e++; break;
+	default: mult = 1; break;
+	}
+	if ( max > ULLONG_MAX / mult ) return -1;
+	max *= mult;
+	idle = 0;
+	if ( *e == ',' ) {
+		s = e + 1;
+		idle = strtol(s, &e, 10);
+		if ( e == s || idle < 0 || idle > 3600000 ) return -1;
+	}
+	end = NULL;
+	if ( *e == ',' ) {
+		end = e + 1;
+		if ( ! *end || strlen(end) > FRECV_MARK_MAX ) return -1;
+	} else if ( *e ) {
+		return -1;
+	}
+
+	opts.receive_max = max;
+	opts.receive_idle_ms = idle;
+	opts.receive_end = end;
+
+	return 0;
+}
+
+/* Parse the arguments of --flow, --parity and --databits (only their
+   first character counts). Return negative if invalid. */
+int
+parse_flow (const char *s, enum flowcntrl_e *flow, char **flow_str)
+{
+	switch (s[0]) {
+	case 'X':
+	case 'x':
+		*flow_str = "xon/xoff";
+		*flow = FC_XONXOFF;
+		break;
+	case 'H':
+	case 'h':
+		*flow_str = "RTS/CTS";
+		*flow = FC_RTSCTS;
+		break;
+	case 'N':
+	case 'n':
+		*flow_str = "none";
+		*flow = FC_NONE;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+parse_parity (const char *s, enum parity_e *parity, char **parity_str)
+{
+	switch (s[0]) {
+	case 'e':
+		*parity_str = "even";
+		*parity = P_EVEN;
+		break;
+	case 'o':
+		*parity_str = "odd";
+		*parity = P_ODD;
+		break;
+	case 'n':
+		*parity_str = "none";
+		*parity = P_NONE;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+parse_databits (const char *s, int *databits)
+{
+	if ( s[0] < '5' || s[0] > '8' )
+		return -1;
+	*databits = s[0] - '0';
+
+	return 0;
+}
+
+/* Parse a port argument: "<device>[,<setting>...]", where a setting
+   is one of "b=<baudrate>", "f=<flow>", "p=<parity>", "d=<databits>",
+   and overrides the respective option for this port only (e.g.
+   "/dev/ttyUSB1,b=9600,p=e"). Returns negative if invalid. */
+int
+parse_port (struct port_s *pt, const char *arg)
+{
+	char buf[256], *s, *v, *sp;
+	int r;
+
+	pt->fd = -1;
+	pt->baud = opts.baud;
+	pt->flow = opts.flow;
+	pt->flow_str = opts.flow_str;
+	pt->parity = opts.parity;
+	pt->parity_str = opts.parity_str;
+	pt->databits = opts.databits;
+
+	if ( strlen(arg) >= sizeof(buf) ) return -1;
+	strcpy(buf, arg);
+	s = strtok_r(buf, ",", &sp);
+	if ( ! s || strlen(s) >= sizeof(pt->name) ) return -1;
+	strcpy(pt->name, s);
+
+	while ( (s = strtok_r(NULL, ",", &sp)) ) {
+		if ( s[0] == '\0' || s[1] != '=' || s[2] == '\0' ) return -1;
+		v = s + 2;
+		switch (s[0]) {
+		case 'b':
+			pt->baud = atoi(v);
+			r = ( pt->baud > 0 ) ? 0 : -1;
+			break;
+		case 'f':
+			r = parse_flow(v, &pt->flow, &pt->flow_str);
+			break;
+		case 'p':
+			r = parse_parity(v, &pt->parity, &pt->parity_str);
+			break;
+		case 'd':
+			r = parse_databits(v, &pt->databits);
+			break;
+		default:
+			r = -1;
+			break;
+		}
+		if ( r < 0 ) return -1;
+	}
+
+	return 0;
+}
+
+/* Returns the name of port "pt" without "/dev/" */
+const char *
+port_short_name (struct port_s *pt)
+{
+	return ( strncmp(pt->name, "/dev/", 5) == 0 ) ? pt->name + 5 : pt->name;
+}
+
+/* Make the tag that prefixes the lines of port "pt": the device name
+   without "/dev/", coloured so that the ports are told apart at a
+   glance. With --bridge, the tag names the direction as well. */
+void
+port_tag (struct port_s *pt)
+{
+	int c;
+
+	c = 1 + (int)(pt - ports) % 6;
+	if ( pt->peer )
+		pt->taglen = snprintf(pt->tag, sizeof(pt->tag),
+							  "\x1B[3%dm[%.8s>%.8s]\x1B[0m ", c,
+							  port_short_name(pt), port_short_name(pt->peer));
+	else
+		pt->taglen = snprintf(pt->tag, sizeof(pt->tag),
+							  "\x1B[3%dm[%.16s]\x1B[0m ", c,
+							  port_short_name(pt));
+}
+
+void
+parse_args(int argc, char *argv[])
+{
+	static struct option longOptions[] =
+	{
+		{"receive-cmd", required_argument, 0, 'v'},
+		{"send-cmd", required_argument, 0, 's'},
+		{"send-mode", required_argument, 0, 'M'},
+		{"send-pace", required_argument, 0, 'P'},
+		{"receive-mode", required_argument, 0, 'V'},
+		{"receive-limit", required_argument, 0, 'L'},
+		{"window", required_argument, 0, 'w'},
+		{"escape", required_argument, 0, 'e'},
+		{"noinit", no_argument, 0, 'i'},
+		{"noreset", no_argument, 0, 'r'},
+		{"nolock", no_argument, 0, 'l'},
+		{"flow", required_argument, 0, 'f'},
+		{"baud", required_argument, 0, 'b'},
+		{"parity", required_argument, 0, 'p'},
+		{"databits", required_argument, 0, 'd'},
+		{"help", no_argument, 0, 'h'},
+		{"timestamp", optional_argument, 0, 't'},
+		{"txqueue", required_argument, 0, 'q'},
+		{"engine", required_argument, 0, 'g'},
+		{"zerocopy", no_argument, 0, 'z'},
+		{"rxthread", no_argument, 0, 'x'},
+		{"batch", required_argument, 0, 'a'},
+		{"logfile", required_argument, 0, 'o'},
+		{"logformat", required_argument, 0, 'm'},
+		{"logbuf", required_argument, 0, 'u'},
+		{"logsync", required_argument, 0, 'y'},
+		{"replay", required_argument, 0, 'R'},
+		{"replay-port", required_argument, 0, 'O'},
+		{"speed", required_argument, 0, 'S'},
+		{"bridge", no_argument, 0, 'B'},
+		{"sniff", optional_argument, 0, 'n'},
+		{0, 0, 0, 0}
+	};
+	FILE *info;
+	struct port_s *pt;
+	int i, ts_set = 0;
+
+	while (1) {
+		int optionIndex = 0;
+		int c, r;
+		unsigned long ul;
+		char *e;
+
+		/* no default error messages printed. */
+		opterr = 0;
+
+		c = getopt_long(argc, argv, "hirlt::n::zxBs:M:P:V:L:w:r:e:f:b:p:d:q:g:a:o:m:u:y:R:O:S:",
+						longOptions, &optionIndex);
+
+		if (c < 0)
+			break;
+
+		switch (c) {
+		case 't':
+			r = optarg ? ts_mode_find(optarg) : TS_START;
+			if ( r < 0 ) {
+				fprintf(stderr, "--timestamp '%s' ignored.\n", optarg);
+				fprintf(stderr, "--timestamp can be one off: 'off', "
+						"'start', 'delta', or 'iso'\n");
+				break;
+			}
+			tty_time_enable = r;
 			tty_time = TTY_TIME_RESET;
+			ts_set = 1;
 			break;
 		case 's':
-			strncpy(opts.send_cmd, optarg, sizeof(opts.send_cmd));
-			opts.send_cmd[sizeof(opts.send_cmd) - 1] = '\0';
+			opts.send_cmd = optarg;
+			break;
+		case 'M':
+			r = parse_xfer_mode(optarg);
+			if ( r < 0 || r == XF_CMD ) {
+				fprintf(stderr, "--send-mode '%s' ignored.\n", optarg);
+				fprintf(stderr, "--send-mode can be one off: 'raw', "
+						"'ascii', 'xmodem', 'ymodem', or 'zmodem'\n");
+				break;
+			}
+			opts.send_mode = r;
+			break;
+		case 'V':
+			r = parse_xfer_mode(optarg);
+			if ( r != XF_CMD && r != XF_RAW && r != XF_XMODEM
+				 && r != XF_YMODEM && r != XF_ZMODEM ) {
+				fprintf(stderr, "--receive-mode '%s' ignored.\n", optarg);
+				fprintf(stderr, "--receive-mode can be one off: 'cmd', "
+						"'raw', 'xmodem', 'ymodem', or 'zmodem'\n");
+				break;
+			}
+			opts.receive_mode = r;
+			break;
+		case 'L':
+			if ( parse_limit(optarg) < 0 ) {
+				fprintf(stderr, "--receive-limit '%s' ignored.\n", optarg);
+				fprintf(stderr, "--receive-limit can be: <bytes>[k|M|G]"
+						"[,<idle msec>[,<end marker>]]\n");
+			}
+			break;
+		case 'w':
+			r = strtol(optarg, &e, 10);
+			if ( e == optarg || *e || r < 1 || r > XM_WINDOW_MAX ) {
+				fprintf(stderr, "--window '%s' ignored.\n", optarg);
+				fprintf(stderr, "--window must be 1 to %d blocks\n",
+						XM_WINDOW_MAX);
+				break;
+			}
+			opts.window = r;
+			break;
+		case 'P':
+			if ( parse_pace(optarg) < 0 ) {
+				fprintf(stderr, "--send-pace '%s' ignored.\n", optarg);
+				fprintf(stderr, "--send-pace can be: "
+						"<char msec>[,<line msec>]\n");
+			}
 			break;
 		case 'v':
-			strncpy(opts.receive_cmd, optarg, sizeof(opts.receive_cmd));
-			opts.receive_cmd[sizeof(opts.receive_cmd) - 1] = '\0';
+			opts.receive_cmd = optarg;
+			break;
+		case 'g':
+			if ( strcmp(optarg, "select") == 0 ) {
+				opts.engine = EV_SELECT;
+			} else if ( strcmp(optarg, "epoll") == 0 ) {
+				opts.engine = EV_EPOLL;
+			} else if ( strcmp(optarg, "uring") == 0 ) {
+				opts.engine = EV_URING;
+			} else {
+				fprintf(stderr, "--engine '%s' ignored.\n", optarg);
+				fprintf(stderr, "--engine can be one off: "
+						"'select', 'epoll', or 'uring'\n");
+				break;
+			}
+			opts.engine_str = optarg;
+			break;
+		case 'z':
+			opts.zerocopy = 1;
+			break;
+		case 'x':
+			opts.rxthread = 1;
+			break;
+		case 'B':
+			opts.bridge = 1;
+			break;
+		case 'n':
+			opts.sniff = 1;
+			opts.sniff_link = optarg;
+			break;
+		case 'a':
+			if ( parse_batch(optarg) < 0 ) {
+				fprintf(stderr, "--batch '%s' ignored.\n", optarg);
+				fprintf(stderr, "--batch can be: 'latency', 'throughput', "
+						"or <vmin>[,<vtime>] (0..255)\n");
+			}
+			break;
+		case 'o':
+			opts.logfile = optarg;
+			break;
+		case 'R':
+			opts.replay = optarg;
+			break;
+		case 'O':
+			errno = 0;
+			ul = strtoul(optarg, &e, 10);
+			if ( e == optarg || *e || errno || optarg[0] == '-'
+				 || ul > CAP_PORT_MAX ) {
+				fprintf(stderr, "--replay-port must be 0 to %d\n",
+						CAP_PORT_MAX);
+				exit(EXIT_FAILURE);
+			}
+			opts.replay_port = ul;
+			break;
+		case 'S':
+			if ( strcmp(optarg, "max") == 0 ) {
+				opts.speed = 0;
+			} else {
+				opts.speed = strtod(optarg, &e);
+				if ( e == optarg || *e || opts.speed <= 0 ) {
+					fprintf(stderr, "--speed must be a positive number, "
+							"or 'max'\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			break;
+		case 'm':
+			if ( strcmp(optarg, "raw") == 0 ) {
+				opts.logcapture = 0;
+			} else if ( strcmp(optarg, "capture") == 0 ) {
+				opts.logcapture = 1;
+			} else {
+				fprintf(stderr, "--logformat '%s' ignored.\n", optarg);
+				fprintf(stderr, "--logformat can be one off: "
+						"'raw' or 'capture'\n");
+			}
+			break;
+		case 'u':
+			errno = 0;
+			ul = strtoul(optarg, &e, 10);
+			if ( e == optarg || *e || errno || optarg[0] == '-'
+				 || ul < LOG_BUF_MIN || ul > LOG_BUF_MAX ) {
+				fprintf(stderr, "--logbuf must be %d to %d bytes\n",
+						LOG_BUF_MIN, LOG_BUF_MAX);
+				exit(EXIT_FAILURE);
+			}
+			opts.logbuf = ul;
+			break;
+		case 'y':
+			errno = 0;
+			ul = strtoul(optarg, &e, 10);
+			if ( e == optarg || *e || errno || optarg[0] == '-'
+				 || ul < 1 || ul > LOG_SYNC_MAX ) {
+				fprintf(stderr, "--logsync must be 1 to %d msec\n",
+						LOG_SYNC_MAX);
+				exit(EXIT_FAILURE);
+			}
+			opts.logsync = ul;
 			break;
 		case 'i':
 			opts.noinit = 1;
@@ -886,69 +2948,35 @@ parse_args(int argc, char *argv[])
 				opts.escape = optarg[0] - 'a' + 1;
 			break;
 		case 'f':
-			switch (optarg[0]) {
-			case 'X':
-			case 'x':
-				opts.flow_str = "xon/xoff";
-				opts.flow = FC_XONXOFF;
-				break;
-			case 'H':
-			case 'h':
-				opts.flow_str = "RTS/CTS";
-				opts.flow = FC_RTSCTS;
-				break;
-			case 'N':
-			case 'n':
-				opts.flow_str = "none";
-				opts.flow = FC_NONE;
-				break;
-			default:
+			if ( parse_flow(optarg, &opts.flow, &opts.flow_str) < 0 ) {
 				fprintf(stderr, "--flow '%c' ignored.\n", optarg[0]);
 				fprintf(stderr, "--flow can be one off: 'x', 'h', or 'n'\n");
-				break;
 			}
 			break;
 		case 'b':
 			opts.baud = atoi(optarg);
 			break;
+		case 'q':
+			errno = 0;
+			ul = strtoul(optarg, &e, 10);
+			if ( e == optarg || *e || errno || optarg[0] == '-'
+				 || ul < TTY_Q_SZ_MIN || ul > TTY_Q_SZ_MAX ) {
+				fprintf(stderr, "--txqueue must be %d to %d bytes\n",
+						TTY_Q_SZ_MIN, TTY_Q_SZ_MAX);
+				exit(EXIT_FAILURE);
+			}
+			opts.txqueue = ul;
+			break;
 		case 'p':
-			switch (optarg[0]) {
-			case 'e':
-				opts.parity_str = "even";
-				opts.parity = P_EVEN;
-				break;
-			case 'o':
-				opts.parity_str = "odd";
-				opts.parity = P_ODD;
-				break;
-			case 'n':
-				opts.parity_str = "none";
-				opts.parity = P_NONE;
-				break;
-			default:
+			if ( parse_parity(optarg, &opts.parity, &opts.parity_str) < 0 ) {
 				fprintf(stderr, "--parity '%c' ignored.\n", optarg[0]);
 				fprintf(stderr, "--parity can be one off: 'o', 'e', or 'n'\n");
-				break;
 			}
 			break;
 		case 'd':
-			switch (optarg[0]) {
-			case '5':
-				opts.databits = 5;
-				break;
-			case '6':
-				opts.databits = 6;
-				break;
-			case '7':
-				opts.databits = 7;
-				break;
-			case '8':
-				opts.databits = 8;
-				break;
-			default:
+			if ( parse_databits(optarg, &opts.databits) < 0 ) {
 				fprintf(stderr, "--databits '%c' ignored.\n", optarg[0]);
 				fprintf(stderr, "--databits can be one off: 5, 6, 7 or 8\n");
-				break;
 			}
 			break;
 		case 'h':
@@ -962,96 +2990,397 @@ parse_args(int argc, char *argv[])
 		}
 	} /* while */
 
+	if ( opts.replay ) {
+		printf("picocom v%s\n", VERSION_STR);
+		printf("\n");
+		printf("replay is      : %s\n", opts.replay);
+		printf("replay port is : %d\n", opts.replay_port);
+		if ( opts.speed > 0 )
+			printf("speed is       : %g\n", opts.speed);
+		else
+			printf("speed is       : max\n");
+		printf("\n");
+		return;
+	}
+
 	if ( (argc - optind) < 1) {
 		fprintf(stderr, "No port given\n");
 		exit(EXIT_FAILURE);
 	}
-	strncpy(opts.port, argv[optind], sizeof(opts.port) - 1);
-	opts.port[sizeof(opts.port) - 1] = '\0';
+	nports = argc - optind;
+	if ( opts.sniff ) {
+		if ( opts.bridge || nports != 1 ) {
+			fprintf(stderr, "--sniff needs one port, and no --bridge\n");
+			exit(EXIT_FAILURE);
+		}
+		/* bridged to the pseudo-terminal, made later */
+		opts.bridge = 1;
+		nports = 2;
+	} else if ( opts.bridge && nports != 2 ) {
+		fprintf(stderr, "--bridge needs two ports\n");
+		exit(EXIT_FAILURE);
+	}
+	ports = calloc(nports, sizeof(*ports));
+	if ( ! ports ) {
+		fprintf(stderr, "Cannot allocate %d ports\n", nports);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < argc - optind; i++) {
+		pt = &ports[i];
+		if ( parse_port(pt, argv[optind + i]) < 0 ) {
+			fprintf(stderr, "Invalid port '%s'\n", argv[optind + i]);
+			fprintf(stderr, "A port is: <device>[,b=<baudrate>][,f=<flow>]"
+					"[,p=<parity>][,d=<databits>]\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if ( parse_cmd(opts.send_cmd, send_argv) < 0 ) {
+		fprintf(stderr, "Invalid --send-cmd '%s'\n", opts.send_cmd);
+		exit(EXIT_FAILURE);
+	}
+	if ( parse_cmd(opts.receive_cmd, receive_argv) < 0 ) {
+		fprintf(stderr, "Invalid --receive-cmd '%s'\n", opts.receive_cmd);
+		exit(EXIT_FAILURE);
+	}
+	if ( opts.bridge ) {
+		ports[0].peer = &ports[1];
+		ports[1].peer = &ports[0];
+	}
+	port = &ports[0];
+	if ( nports > 1 && opts.logfile && ! opts.logcapture ) {
+		fprintf(stderr, "A raw log cannot tell the ports apart; "
+				"use --logformat capture\n");
+		exit(EXIT_FAILURE);
+	}
 
-	printf("picocom v%s\n", VERSION_STR);
-	printf("\n");
-	printf("port is        : %s\n", opts.port);
-	printf("flowcontrol    : %s\n", opts.flow_str);
-	printf("baudrate is    : %d\n", opts.baud);
-	printf("parity is      : %s\n", opts.parity_str);
-	printf("databits are   : %d\n", opts.databits);
-	printf("escape is      : C-%c\n", 'a' + opts.escape - 1);
-	printf("noinit is      : %s\n", opts.noinit ? "yes" : "no");
-	printf("noreset is     : %s\n", opts.noreset ? "yes" : "no");
-	printf("nolock is      : %s\n", opts.nolock ? "yes" : "no");
-	printf("send_cmd is    : %s\n", opts.send_cmd);
-	printf("receive_cmd is : %s\n", opts.receive_cmd);
-	printf("\n");
+	/* with stdin not a terminal, the data are a plain byte stream:
+	   keep them, and stdout, unadorned */
+	headless = ! isatty(STI);
+	if ( headless && ! ts_set ) tty_time_enable = TS_OFF;
+	info = headless ? stderr : stdout;
+
+	fprintf(info, "picocom v%s\n", VERSION_STR);
+	fprintf(info, "\n");
+	if ( nports == 1 || opts.sniff ) {
+		fprintf(info, "port is        : %s\n", port->name);
+		fprintf(info, "flowcontrol    : %s\n", port->flow_str);
+		fprintf(info, "baudrate is    : %d\n", port->baud);
+		fprintf(info, "parity is      : %s\n", port->parity_str);
+		fprintf(info, "databits are   : %d\n", port->databits);
+	} else {
+		for (pt = ports; pt < ports + nports; pt++)
+			fprintf(info, "port %-2d is     : %s (baud %d, flow %s, "
+					"parity %s, databits %d)\n", (int)(pt - ports) + 1,
+					pt->name, pt->baud, pt->flow_str, pt->parity_str,
+					pt->databits);
+	}
+	fprintf(info, "escape is      : C-%c\n", 'a' + opts.escape - 1);
+	fprintf(info, "noinit is      : %s\n", opts.noinit ? "yes" : "no");
+	fprintf(info, "noreset is     : %s\n", opts.noreset ? "yes" : "no");
+	fprintf(info, "nolock is      : %s\n", opts.nolock ? "yes" : "no");
+	fprintf(info, "timestamp is   : %s\n", ts_modes[tty_time_enable].name);
+	if ( opts.send_cmd[0] )
+		fprintf(info, "send_cmd is    : %s\n", opts.send_cmd);
+	else if ( opts.send_mode == XF_XMODEM || opts.send_mode == XF_YMODEM )
+		fprintf(info, "send_cmd is    : (built-in, %s, window %d)\n",
+				xfer_mode_str[opts.send_mode], opts.window);
+	else if ( opts.send_mode == XF_ZMODEM )
+		fprintf(info, "send_cmd is    : (built-in, %s)\n",
+				xfer_mode_str[opts.send_mode]);
+	else
+		fprintf(info, "send_cmd is    : (built-in, %s, pace %g/%g msec)\n",
+				xfer_mode_str[opts.send_mode],
+				opts.send_char_us / 1e3, opts.send_line_us / 1e3);
+	if ( opts.receive_mode == XF_RAW )
+		fprintf(info, "receive_cmd is : (built-in, %s, limit %llu bytes, "
+				"idle %ld msec, end %s)\n", xfer_mode_str[opts.receive_mode],
+				opts.receive_max, opts.receive_idle_ms,
+				opts.receive_end ? opts.receive_end : "none");
+	else if ( opts.receive_mode != XF_CMD )
+		fprintf(info, "receive_cmd is : (built-in, %s)\n",
+				xfer_mode_str[opts.receive_mode]);
+	else
+		fprintf(info, "receive_cmd is : %s\n", opts.receive_cmd);
+	fprintf(info, "txqueue is     : %d\n", opts.txqueue);
+	fprintf(info, "engine is      : %s\n", opts.engine_str);
+	fprintf(info, "zerocopy is    : %s\n", opts.zerocopy ? "yes" : "no");
+	fprintf(info, "rxthread is    : %s\n", opts.rxthread ? "yes" : "no");
+	fprintf(info, "batch is       : %s (vmin=%d vtime=%d)\n",
+			opts.batch_str ? opts.batch_str : "latency",
+			opts.vmin, opts.vtime);
+	if ( opts.logfile )
+		fprintf(info, "logfile is     : %s (%s, buffer %d bytes, "
+				"sync %d msec)\n", opts.logfile,
+				opts.logcapture ? "capture" : "raw",
+				opts.logbuf, opts.logsync);
+	if ( opts.sniff )
+		fprintf(info, "sniff is       : yes%s%s\n",
+				opts.sniff_link ? ", link " : "",
+				opts.sniff_link ? opts.sniff_link : "");
+	else if ( opts.bridge )
+		fprintf(info, "bridge is      : %s <> %s\n",
+				ports[0].name, ports[1].name);
+	if ( headless )
+		fprintf(info, "headless is    : yes (stdin is not a terminal)\n");
+	fprintf(info, "\n");
 }
 
 /**********************************************************************/
 
+void
+replay_handler (int signum)
+{
+	replay_stop();
+}
+
+/* play the capture given with --replay through a pseudo-terminal */
 int
-main(int argc, char *argv[])
+do_replay (void)
 {
+	struct replay_stats_s st;
+	struct sigaction sa;
+	const char *name;
+	double el, sp;
 	int r;
 
-	parse_args(argc, argv);
+	name = replay_open(opts.replay);
+	if ( ! name )
+		fatal("cannot replay %s: %s", opts.replay, strerror(errno));
 
-	establish_signal_handlers();
+	sa.sa_handler = replay_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
 
-	r = term_lib_init();
+	printf("Replaying through %s\n", name);
+	printf("Waiting for it to be opened (C-c to quit)...\n");
+	fflush(stdout);
+
+	r = replay_run(opts.speed, opts.replay_port, &st);
 	if ( r < 0 )
-		fatal("term_init failed: %s", term_strerror(term_errno, errno));
+		fprintf(stderr, "replay failed: %s\n", strerror(errno));
+
+	el = st.elapsed_ns / 1e9;
+	sp = st.span_ns / 1e9;
+	printf("played         : %lu chunks, %llu bytes in %.3f sec\n",
+		   st.chunks, st.bytes, el);
+	if ( ! st.chunks ) {
+		/* nothing to tell */
+	} else if ( opts.speed > 0 ) {
+		printf("drift          : %+.3f msec over %.3f sec\n",
+			   (el - sp) * 1e3, sp);
+		printf("lateness       : avg %.3f msec, max %.3f msec, "
+			   "%lu chunks > 1 msec\n",
+			   st.chunks ? st.late_sum_ns / 1e6 / st.chunks : 0.0,
+			   st.late_max_ns / 1e6, st.late);
+	} else if ( el > 0 ) {
+		printf("throughput     : %.1f MB/s\n", st.bytes / el / 1e6);
+	}
+	if ( st.drops )
+		printf("gaps           : %lu (data were lost while capturing)\n",
+			   st.drops);
+	if ( st.skipped )
+		printf("skipped        : %lu records too large\n", st.skipped);
+	if ( st.other )
+		printf("other ports    : %lu chunks not played (see --replay-port)\n",
+			   st.other);
+
+	if ( st.hangup ) {
+		printf("The pseudo-terminal was closed before the end\n");
+	} else if ( st.stopped ) {
+		printf("Stopped\n");
+	} else if ( r >= 0 ) {
+		printf("Done. Waiting for it to be closed (C-c to quit)...\n");
+		fflush(stdout);
+		replay_drain();
+	}
+	if ( st.host )
+		printf("discarded      : %llu bytes written by the program\n",
+			   st.host);
+	replay_close();
+
+	return ( r < 0 ) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**********************************************************************/
+
+/* Lock, open, and configure port "pt" */
+void
+port_open (struct port_s *pt)
+{
+	int r;
 
 #ifdef UUCP_LOCK_DIR
-	if ( ! opts.nolock ) uucp_lockname(UUCP_LOCK_DIR, opts.port);
-	if ( uucp_lock() < 0 )
-		fatal("cannot lock %s: %s", opts.port, strerror(errno));
+	if ( ! opts.nolock ) uucp_lockname(pt, UUCP_LOCK_DIR);
+	if ( uucp_lock(pt) < 0 )
+		fatal("cannot lock %s: %s", pt->name, strerror(errno));
 #endif
 
-	tty_fd = open(opts.port, O_RDWR | O_NONBLOCK);
-	if (tty_fd < 0)
-		fatal("cannot open %s: %s", opts.port, strerror(errno));
+	if ( ring_init(&pt->q, opts.txqueue) < 0 )
+		fatal("cannot allocate tx queue: %s", strerror(errno));
+
+	pt->fd = open(pt->name, O_RDWR | O_NONBLOCK);
+	if (pt->fd < 0)
+		fatal("cannot open %s: %s", pt->name, strerror(errno));
 
 	if ( opts.noinit ) {
-		r = term_add(tty_fd);
+		r = term_add(pt->fd);
 	} else {
-		r = term_set(tty_fd,
+		r = term_set(pt->fd,
 					 1,              /* raw mode. */
-					 opts.baud,      /* baud rate. */
-					 opts.parity,    /* parity. */
-					 opts.databits,  /* data bits. */
-					 opts.flow,      /* flow control. */
+					 pt->baud,       /* baud rate. */
+					 pt->parity,     /* parity. */
+					 pt->databits,   /* data bits. */
+					 pt->flow,       /* flow control. */
 					 1,              /* local or modem */
 					 !opts.noreset); /* hup-on-close. */
 	}
 	if ( r < 0 )
 		fatal("failed to add device %s: %s",
-			  opts.port, term_strerror(term_errno, errno));
-	r = term_apply(tty_fd);
+			  pt->name, term_strerror(term_errno, errno));
+	if ( ! opts.noinit || opts.batch_str ) {
+		r = term_set_vmin_vtime(pt->fd, opts.vmin,
+								(opts.vmin > 1) ? 0 : opts.vtime);
+		if ( r < 0 )
+			fatal("failed to set batching of %s: %s",
+				  pt->name, term_strerror(term_errno, errno));
+	}
+	r = term_apply(pt->fd);
 	if ( r < 0 )
 		fatal("failed to config device %s: %s",
-			  opts.port, term_strerror(term_errno, errno));
+			  pt->name, term_strerror(term_errno, errno));
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, r;
+
+	parse_args(argc, argv);
 
-	r = term_add(STI);
+	if ( opts.replay )
+		return do_replay();
+
+	establish_signal_handlers();
+
+	r = term_lib_init();
 	if ( r < 0 )
-		fatal("failed to add I/O device: %s",
-			  term_strerror(term_errno, errno));
-	term_set_raw(STI);
-	r = term_apply(STI);
+		fatal("term_init failed: %s", term_strerror(term_errno, errno));
+
+	if ( opts.engine == EV_URING && opts.vmin > 1 && opts.vtime ) {
+		/* the read kept queued on a port waits for VMIN bytes, and
+		   cannot be forced to complete with fewer */
+		fprintf(stderr, "--batch vmin > 1 ignored with the uring engine\n");
+		opts.vmin = 1;
+	}
+	for (i = 0; i < nports; i++) {
+		if ( opts.sniff && i == 1 )
+			sniff_port_open(&ports[i]);
+		else
+			port_open(&ports[i]);
+	}
+	if ( nports > 1 )
+		for (i = 0; i < nports; i++)
+			port_tag(&ports[i]);
+	tty_rd_tick = tty_rd_tick_ms();
+
+	if ( headless ) {
+		msg_fd = STDERR_FILENO;
+	} else {
+		r = term_add(STI);
+		if ( r < 0 )
+			fatal("failed to add I/O device: %s",
+				  term_strerror(term_errno, errno));
+		term_set_raw(STI);
+		r = term_apply(STI);
+		if ( r < 0 )
+			fatal("failed to set I/O device to raw mode: %s",
+				  term_strerror(term_errno, errno));
+	}
+
+	r = ev_init(opts.engine);
+	if ( r < 0 )
+		fatal("cannot initialize %s event loop: %s",
+			  opts.engine_str, strerror(errno));
+	if ( headless ) {
+		sti_open();
+		r = 0;
+	} else {
+		r = ev_add(STI, EV_READ);
+	}
+	if ( opts.rxthread && nports > 1 ) {
+		/* the thread serves a single port */
+		fd_printf(msg_fd, "--rxthread ignored with several ports\r\n");
+		opts.rxthread = 0;
+	}
+	if ( r >= 0 && opts.rxthread ) {
+		if ( ring_init(&rx_q, RX_Q_SZ) < 0 )
+			fatal("cannot allocate rx queue: %s", strerror(errno));
+		rx_fd = rxthr_start(ports[0].fd, &rx_q, tty_rd_tick);
+		if ( rx_fd < 0 )
+			fatal("cannot start receive thread: %s", strerror(errno));
+		r = ev_add(rx_fd, EV_READ);
+		if ( r >= 0 )
+			r = ev_add(ports[0].fd, EV_WRITE | EV_ET);
+	} else {
+		for (i = 0; r >= 0 && i < nports; i++)
+			r = ev_add(ports[i].fd, EV_READ | EV_WRITE | EV_ET);
+	}
 	if ( r < 0 )
-		fatal("failed to set I/O device to raw mode: %s",
-			  term_strerror(term_errno, errno));
+		fatal("cannot add I/O devices to event loop: %s", strerror(errno));
+	sto_open();
+	if ( opts.zerocopy ) {
+		/* the io_uring engine keeps its own reads queued on the port,
+		   the receive thread reads into its ring, and the data of
+		   several ports must be tagged */
+		if ( nports > 1 )
+			fd_printf(msg_fd, "--zerocopy ignored with several ports\r\n");
+		else if ( opts.rxthread )
+			fd_printf(msg_fd, "--zerocopy ignored with --rxthread\r\n");
+		else if ( opts.engine == EV_URING )
+			fd_printf(msg_fd,
+					  "--zerocopy ignored with the uring engine\r\n");
+		else
+			zc_open();
+	}
 
-	fd_printf(STO, "Terminal ready\r\n");
+	if ( opts.logfile ) {
+		if ( opts.logcapture )
+			r = cap_open(opts.logfile, opts.logbuf, opts.logsync);
+		else
+			r = logfile_open(opts.logfile, O_APPEND,
+							 opts.logbuf, opts.logsync);
+		if ( r < 0 )
+			fatal("cannot open log file %s: %s",
+				  opts.logfile, strerror(errno));
+	}
+
+	if ( opts.sniff )
+		fd_printf(msg_fd, "Sniffing %s through %s%s%s\r\n",
+				  ports[0].name, ports[1].name,
+				  opts.sniff_link ? ", linked as " : "",
+				  opts.sniff_link ? opts.sniff_link : "");
+	fd_printf(msg_fd, "Terminal ready\r\n");
+	bridge_start = now_ns();
 	loop();
+	cap_close();
+	logfile_close();
+	sniff_close();
 
-	fd_printf(STO, "\r\n");
+	fd_printf(msg_fd, "\r\n");
+	if ( opts.bridge ) bridge_report(msg_fd);
 	if ( opts.noreset ) {
-		fd_printf(STO, "Skipping tty reset...\r\n");
-		term_erase(tty_fd);
+		fd_printf(msg_fd, "Skipping tty reset...\r\n");
+		for (i = 0; i < nports; i++)
+			term_erase(ports[i].fd);
 	}
 
-	fd_printf(STO, "Thanks for using picocom\r\n");
-	/* wait a bit for output to drain */
-	sleep(1);
+	fd_printf(msg_fd, "Thanks for using picocom\r\n");
+	/* wait a bit for output to drain (headless, it has been) */
+	if ( ! headless ) sleep(1);
 
 #ifdef UUCP_LOCK_DIR
 	uucp_unlock();
@@ -0,0 +1,319 @@
+/* vi: set sw=4 ts=4:
+ *
+ * replay.c
+ *
+ * Session replay.
+ *
+ * Documentation can be found in the header file "replay.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "capture.h"
+#include "replay.h"
+
+/**********************************************************************/
+
+/* largest record that can be played */
+#define RP_BUFF_SZ (1024 * 1024)
+
+/* a chunk this late counts as late */
+#define RP_LATE_NS 1000000ULL
+
+static struct {
+	int open;
+	struct cap_rd_s rd;
+	int mfd;                    /* pseudo-terminal master */
+	int tfd;                    /* timerfd */
+	char name[128];             /* slave name */
+	volatile sig_atomic_t stop;
+	struct replay_stats_s *st;
+	unsigned char buff[RP_BUFF_SZ];
+} rp = { .mfd = -1, .tfd = -1 };
+
+static uint64_t
+rp_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**********************************************************************/
+
+/* read and discard whatever the program has written */
+static void
+rp_discard (void)
+{
+	unsigned char b[4096];
+	ssize_t n;
+
+	while ( (n = read(rp.mfd, b, sizeof(b))) > 0 )
+		rp.st->host += n;
+}
+
+/* wait for the program to open the slave side. Until it does (and
+   after it has closed it) the master reports a hangup */
+static int
+rp_wait_open (void)
+{
+	struct pollfd pfd;
+
+	for (;;) {
+		if ( rp.stop ) return -1;
+		pfd.fd = rp.mfd;
+		pfd.events = POLLIN;
+		if ( poll(&pfd, 1, 0) < 0 && errno != EINTR ) return -1;
+		if ( ! (pfd.revents & POLLHUP) ) return 0;
+		poll(NULL, 0, 50);
+	}
+}
+
+/* wait for room on the master if "out", or for the timer if "timer".
+   Returns 1 if the timer expired, 0 if something else happened,
+   negative if the replay must end. */
+static int
+rp_wait (int out, int timer)
+{
+	struct pollfd pfd[2];
+	uint64_t exp;
+	int n;
+
+	pfd[0].fd = rp.mfd;
+	pfd[0].events = POLLIN | ( out ? POLLOUT : 0 );
+	pfd[1].fd = rp.tfd;
+	pfd[1].events = POLLIN;
+	n = poll(pfd, timer ? 2 : 1, -1);
+	if ( rp.stop ) return -1;
+	if ( n < 0 ) return ( errno == EINTR ) ? 0 : -1;
+
+	if ( pfd[0].revents & POLLIN ) rp_discard();
+	if ( pfd[0].revents & POLLHUP ) {
+		rp.st->hangup = 1;
+		return -1;
+	}
+	if ( timer && (pfd[1].revents & POLLIN) ) {
+		while ( read(rp.tfd, &exp, sizeof(exp)) < 0 && errno == EINTR )
+			/* nothing */ ;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+rp_write (const unsigned char *b, size_t n)
+{
+	ssize_t r;
+
+	while ( n ) {
+		r = write(rp.mfd, b, n);
+		if ( r > 0 ) {
+			b += r;
+			n -= r;
+		} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			if ( rp_wait(1, 0) < 0 ) return -1;
+		} else if ( errno == EIO ) {
+			rp.st->hangup = 1;
+			return -1;
+		} else if ( errno != EINTR || rp.stop ) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* wait until "due", on the timerfd */
+static int
+rp_sleep (uint64_t due)
+{
+	struct itimerspec its;
+	int r;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = due / 1000000000;
+	its.it_value.tv_nsec = due % 1000000000;
+	if ( timerfd_settime(rp.tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0 )
+		return -1;
+	while ( (r = rp_wait(0, 1)) == 0 )
+		/* nothing */ ;
+
+	return ( r < 0 ) ? -1 : 0;
+}
+
+/**********************************************************************/
+
+const char *
+replay_open (const char *path)
+{
+	struct termios tio;
+	char *name;
+	int fd, e;
+
+	if ( rp.open ) { errno = EBUSY; return NULL; }
+
+	if ( cap_rd_open(&rp.rd, path, NULL) < 0 ) return NULL;
+
+	rp.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	rp.mfd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if ( rp.tfd < 0 || rp.mfd < 0 ) goto fail;
+	if ( grantpt(rp.mfd) < 0 || unlockpt(rp.mfd) < 0 ) goto fail;
+	name = ptsname(rp.mfd);
+	if ( ! name ) goto fail;
+	strncpy(rp.name, name, sizeof(rp.name) - 1);
+	rp.name[sizeof(rp.name) - 1] = '\0';
+	fcntl(rp.mfd, F_SETFL, O_NONBLOCK);
+
+	/* raw mode, so that the data reach the program unchanged. The
+	   setting outlives this filedes. */
+	fd = open(rp.name, O_RDWR | O_NOCTTY);
+	if ( fd < 0 ) goto fail;
+	if ( tcgetattr(fd, &tio) == 0 ) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	close(fd);
+
+	rp.stop = 0;
+	rp.open = 1;
+
+	return rp.name;
+
+fail:
+	e = errno;
+	rp.open = 1;
+	replay_close();
+	errno = e;
+	return NULL;
+}
+
+int
+replay_run (double speed, int port, struct replay_stats_s *st)
+{
+	struct cap_rec_s rec;
+	uint64_t base, now, due, first, last, late;
+	int r, started;
+
+	memset(st, 0, sizeof(*st));
+	rp.st = st;
+	if ( rp_wait_open() < 0 ) {
+		st->stopped = rp.stop;
+		return rp.stop ? 0 : -1;
+	}
+
+	started = 0;
+	base = now = rp_now();
+	first = last = 0;
+	r = 0;
+	while ( ! rp.stop ) {
+		r = cap_rd_next(&rp.rd, &rec, rp.buff, sizeof(rp.buff));
+		if ( r == 0 ) break;
+		if ( r < 0 ) {
+			if ( errno != EMSGSIZE ) break;
+			st->skipped++;
+			r = 0;
+			continue;
+		}
+		if ( rec.type == CAP_DROP ) st->drops++;
+		if ( rec.type != CAP_RX ) continue;
+		if ( rec.port != port ) {
+			st->other++;
+			continue;
+		}
+
+		if ( ! started ) {
+			started = 1;
+			base = rp_now();
+			first = rec.t;
+		}
+		last = rec.t;
+		if ( speed > 0 ) {
+			due = base + (uint64_t)((rec.t - first) / speed);
+			if ( due > rp_now() && rp_sleep(due) < 0 ) {
+				r = ( st->hangup || rp.stop ) ? 0 : -1;
+				break;
+			}
+			now = rp_now();
+			late = ( now > due ) ? now - due : 0;
+			if ( late > st->late_max_ns ) st->late_max_ns = late;
+			st->late_sum_ns += late;
+			if ( late > RP_LATE_NS ) st->late++;
+		}
+		if ( rp_write(rp.buff, rec.len) < 0 ) {
+			r = ( st->hangup || rp.stop ) ? 0 : -1;
+			break;
+		}
+		st->chunks++;
+		st->bytes += rec.len;
+	}
+	st->stopped = rp.stop;
+	st->elapsed_ns = started ? rp_now() - base : 0;
+	st->span_ns = ( speed > 0 ) ? (uint64_t)((last - first) / speed)
+		: last - first;
+
+	return ( r < 0 ) ? -1 : 0;
+}
+
+void
+replay_drain (void)
+{
+	if ( ! rp.open || ! rp.st ) return;
+
+	while ( rp_wait(0, 0) >= 0 )
+		/* nothing */ ;
+}
+
+void
+replay_stop (void)
+{
+	rp.stop = 1;
+}
+
+void
+replay_close (void)
+{
+	if ( ! rp.open ) return;
+
+	if ( rp.mfd >= 0 ) close(rp.mfd);
+	if ( rp.tfd >= 0 ) close(rp.tfd);
+	rp.mfd = rp.tfd = -1;
+	cap_rd_close(&rp.rd);
+	rp.open = 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,134 @@
+/* vi: set sw=4 ts=4:
+ *
+ * replay.h
+ *
+ * Session replay. Plays the received data of a capture file (see
+ * "capture.h") back through a pseudo-terminal, with their original
+ * timing, with the timing scaled, or as fast as possible. Programs
+ * that parse serial data can be tested against the slave side of the
+ * pseudo-terminal, without the device that produced the data.
+ *
+ * Principles of operation:
+ *
+ * Only the CAP_RX records of one port are played (a capture of
+ * several ports, or of a bridge, has data from each); each is written
+ * to the master side as one chunk. Every chunk is due at its capture time, divided by
+ * the speed factor, from the time the first chunk goes out. The wait
+ * is done with a timerfd(2) armed with the absolute due time on
+ * CLOCK_MONOTONIC, so that the errors do not accumulate. Whatever the
+ * program under test writes to the slave side is read and discarded.
+ *
+ * A chunk may go out late: because the host was busy, or because the
+ * program under test did not read the previous ones fast enough (the
+ * pseudo-terminal buffers only a few KB). The lateness of every chunk
+ * is measured and summarized in the statistics.
+ *
+ * Interface summary:
+ *
+ * F replay_open - open a capture file and create the pseudo-terminal
+ * F replay_run - play the capture
+ * F replay_drain - wait for the program to close the pseudo-terminal
+ * F replay_stop - make replay_run return early (signal-safe)
+ * F replay_close - close the capture and the pseudo-terminal
+ * T replay_stats_s - replay statistics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+/* T replay_stats_s
+ *
+ * Statistics of a replay, as filled-in by replay_run().
+ */
+struct replay_stats_s {
+	unsigned long chunks;        /* chunks played */
+	unsigned long long bytes;    /* bytes played */
+	unsigned long drops;         /* CAP_DROP records met (gaps) */
+	unsigned long skipped;       /* records too large to play */
+	unsigned long other;         /* CAP_RX records of other ports */
+	unsigned long long host;     /* bytes read from the program */
+	uint64_t span_ns;            /* capture time played, scaled */
+	uint64_t elapsed_ns;         /* time it took */
+	uint64_t late_max_ns;        /* worst lateness of a chunk */
+	uint64_t late_sum_ns;        /* total lateness of the chunks */
+	unsigned long late;          /* chunks more than 1 msec late */
+	int hangup;                  /* the program closed the slave */
+	int stopped;                 /* replay_stop() was called */
+};
+
+/* F replay_open
+ *
+ * Open the capture file "path" and create a pseudo-terminal, in raw
+ * mode, to play it through.
+ *
+ * Returns the name of the slave side of the pseudo-terminal, or NULL
+ * on failure (errno is set).
+ */
+const char *replay_open (const char *path);
+
+/* F replay_run
+ *
+ * Wait for a program to open the slave side of the pseudo-terminal,
+ * then play the data received on port "port" of the capture (see
+ * "capture.h"). "speed" scales the timing (2.0 plays twice as fast as
+ * recorded); if zero, chunks are played as fast as the program reads
+ * them. Returns at the end of the capture, when the
+ * program closes the slave side, or after replay_stop(). The
+ * statistics are stored in "st".
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int replay_run (double speed, int port, struct replay_stats_s *st);
+
+/* F replay_drain
+ *
+ * Wait until the program closes the slave side of the pseudo-terminal
+ * (or until replay_stop() is called), discarding what it writes.
+ * If the master side is closed before the program has read all the
+ * data, the data still buffered are lost; call this after
+ * replay_run(), before replay_close().
+ */
+void replay_drain (void);
+
+/* F replay_stop
+ *
+ * Make replay_run() or replay_drain() return as soon as possible. Can
+ * be called from a signal handler.
+ */
+void replay_stop (void);
+
+/* F replay_close
+ *
+ * Close the capture file and the pseudo-terminal.
+ */
+void replay_close (void);
+
+#endif /* of REPLAY_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,191 @@
+/* vi: set sw=4 ts=4:
+ *
+ * ring.c
+ *
+ * Simple byte ring-buffer (circular queue).
+ *
+ * Documentation can be found in the header file "ring.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "ring.h"
+
+/* Each counter is only ever modified by one side: "wr" by the
+   producer, "rd" by the consumer. Loading the other side's counter
+   with acquire, and storing ones own with release semantics, is all
+   it takes to share a ring between two threads. */
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**********************************************************************/
+
+int
+ring_init (struct ring *r, size_t sz)
+{
+	size_t n;
+
+	for (n = 1; n < sz; n <<= 1)
+		if ( n << 1 == 0 ) { errno = EINVAL; return -1; }
+
+	r->buff = malloc(n);
+	if ( ! r->buff ) return -1;
+	r->sz = n;
+	r->rd = r->wr = 0;
+
+	return 0;
+}
+
+void
+ring_free (struct ring *r)
+{
+	free(r->buff);
+	r->buff = NULL;
+	r->sz = 0;
+	r->rd = r->wr = 0;
+}
+
+void
+ring_clear (struct ring *r)
+{
+	STORE(&r->rd, LOAD(&r->wr));
+}
+
+size_t
+ring_len (const struct ring *r)
+{
+	return LOAD(&r->wr) - LOAD(&r->rd);
+}
+
+size_t
+ring_space (const struct ring *r)
+{
+	return r->sz - ring_len(r);
+}
+
+/**********************************************************************/
+
+size_t
+ring_put (struct ring *r, const void *data, size_t n)
+{
+	size_t off, sp, l;
+
+	sp = ring_space(r);
+	if ( n > sp ) n = sp;
+
+	off = r->wr & (r->sz - 1);
+	l = r->sz - off;
+	if ( l > n ) l = n;
+	memcpy(r->buff + off, data, l);
+	memcpy(r->buff, (const unsigned char *)data + l, n - l);
+	STORE(&r->wr, r->wr + n);
+
+	return n;
+}
+
+int
+ring_iov (const struct ring *r, struct iovec iov[2])
+{
+	size_t off, len, l;
+
+	len = ring_len(r);
+	if ( len == 0 ) return 0;
+
+	off = r->rd & (r->sz - 1);
+	l = r->sz - off;
+	if ( l >= len ) {
+		iov[0].iov_base = r->buff + off;
+		iov[0].iov_len = len;
+		return 1;
+	}
+	iov[0].iov_base = r->buff + off;
+	iov[0].iov_len = l;
+	iov[1].iov_base = r->buff;
+	iov[1].iov_len = len - l;
+
+	return 2;
+}
+
+void
+ring_consume (struct ring *r, size_t n)
+{
+	STORE(&r->rd, r->rd + n);
+}
+
+ssize_t
+ring_write (struct ring *r, int fd)
+{
+	struct iovec iov[2];
+	int cnt;
+	ssize_t n;
+
+	cnt = ring_iov(r, iov);
+	if ( cnt == 0 ) return 0;
+
+	do {
+		if ( cnt == 1 )
+			n = write(fd, iov[0].iov_base, iov[0].iov_len);
+		else
+			n = writev(fd, iov, cnt);
+	} while ( n < 0 && errno == EINTR );
+	if ( n > 0 ) ring_consume(r, n);
+
+	return n;
+}
+
+ssize_t
+ring_read (struct ring *r, int fd)
+{
+	struct iovec iov[2];
+	size_t off, sp, l;
+	ssize_t n;
+
+	sp = ring_space(r);
+	if ( sp == 0 ) return 0;
+
+	off = r->wr & (r->sz - 1);
+	l = r->sz - off;
+	iov[0].iov_base = r->buff + off;
+	iov[0].iov_len = ( l < sp ) ? l : sp;
+	iov[1].iov_base = r->buff;
+	iov[1].iov_len = sp - iov[0].iov_len;
+
+	do {
+		if ( iov[1].iov_len == 0 )
+			n = read(fd, iov[0].iov_base, iov[0].iov_len);
+		else
+			n = readv(fd, iov, 2);
+	} while ( n < 0 && errno == EINTR );
+	if ( n > 0 ) STORE(&r->wr, r->wr + n);
+
+	return n;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -0,0 +1,156 @@
+/* vi: set sw=4 ts=4:
+ *
+ * ring.h
+ *
+ * Simple byte ring-buffer (circular queue).
+ *
+ * Data are appended at the tail of the ring and removed from its
+ * head. The ring never moves data around: the data currently in the
+ * ring occupy at most two contiguous regions of the buffer (when they
+ * wrap around its end), which can be handed directly to writev(2).
+ *
+ * The size of the ring is always a power of two. The read and write
+ * positions are free-running counters, and are reduced to buffer
+ * offsets by masking.
+ *
+ * A ring can be shared, without locking, by one producer thread
+ * (calling ring_space, ring_put, and ring_read) and one consumer
+ * thread (calling ring_len, ring_iov, ring_consume, and ring_write).
+ *
+ * Interface summary:
+ *
+ * F ring_init - allocate the buffer of a ring
+ * F ring_free - release the buffer of a ring
+ * F ring_clear - discard the contents of a ring
+ * F ring_len - number of bytes in a ring
+ * F ring_space - number of bytes that can be added to a ring
+ * F ring_put - append bytes to a ring
+ * F ring_iov - describe the contents of a ring as an I/O vector
+ * F ring_consume - remove bytes from the head of a ring
+ * F ring_write - write the contents of a ring to a filedes
+ * F ring_read - read from a filedes into a ring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct ring {
+	unsigned char *buff;
+	size_t sz;      /* size of buff, power of two */
+	size_t rd;      /* free-running read (head) counter */
+	size_t wr;      /* free-running write (tail) counter */
+};
+
+/* F ring_init
+ *
+ * Allocate a buffer of at least "sz" bytes for ring "r". The size is
+ * rounded-up to the next power of two. The ring is initially empty.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int ring_init (struct ring *r, size_t sz);
+
+/* F ring_free
+ *
+ * Release the buffer of ring "r".
+ */
+void ring_free (struct ring *r);
+
+/* F ring_clear
+ *
+ * Discard the contents of ring "r".
+ */
+void ring_clear (struct ring *r);
+
+/* F ring_len
+ *
+ * Returns the number of bytes currently in ring "r".
+ */
+size_t ring_len (const struct ring *r);
+
+/* F ring_space
+ *
+ * Returns the number of bytes that can be added to ring "r".
+ */
+size_t ring_space (const struct ring *r);
+
+/* F ring_put
+ *
+ * Append up to "n" bytes from "data" to the tail of ring "r".
+ *
+ * Returns the number of bytes actually appended, which is less than
+ * "n" if the ring became full.
+ */
+size_t ring_put (struct ring *r, const void *data, size_t n);
+
+/* F ring_iov
+ *
+ * Fill "iov" with the (at most two) contiguous regions currently
+ * holding the contents of ring "r", head first.
+ *
+ * Returns the number of I/O vector entries filled (0, 1, or 2).
+ */
+int ring_iov (const struct ring *r, struct iovec iov[2]);
+
+/* F ring_consume
+ *
+ * Remove "n" bytes from the head of ring "r". "n" must not be larger
+ * than ring_len(r).
+ */
+void ring_consume (struct ring *r, size_t n);
+
+/* F ring_write
+ *
+ * Write as much of the contents of ring "r" to filedes "fd" as
+ * possible with a single write(2), or a single writev(2) if the data
+ * wrap around the end of the buffer. The bytes written are removed
+ * from the ring. Interrupted calls are restarted.
+ *
+ * Returns the number of bytes written, or negative on failure (errno
+ * is set, and the ring is unaffected).
+ */
+ssize_t ring_write (struct ring *r, int fd);
+
+/* F ring_read
+ *
+ * Read from filedes "fd" into the free space of ring "r", with a
+ * single read(2), or a single readv(2) if the free space wraps around
+ * the end of the buffer. The bytes read are appended to the
+ * ring. Interrupted calls are restarted.
+ *
+ * Returns the number of bytes read (0 at end-of-file, or if the ring
+ * is full), or negative on failure (errno is set, and the ring is
+ * unaffected).
+ */
+ssize_t ring_read (struct ring *r, int fd);
+
+#endif /* of RING_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
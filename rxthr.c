@@ -0,0 +1,252 @@
+/* vi: set sw=4 ts=4:
+ *
+ * rxthr.c
+ *
+ * Receive thread.
+ *
+ * Documentation can be found in the header file "rxthr.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "rxthr.h"
+
+/**********************************************************************/
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+/* Orders a store to one location before a load from another. Both
+   sides of every hand-off below store their own flag or counter,
+   fence, then look at the other side's, so at least one of them is
+   guaranteed to see the other. */
+#define FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static struct {
+	int fd;             /* filedes being drained */
+	int tick;           /* read at least this often (ms), if positive */
+	struct ring *r;     /* ring it is drained into */
+	int ntf[2];         /* pipe: thread notifies caller */
+	int ctl[2];         /* pipe: caller wakes thread */
+	int ack[2];         /* pipe: thread acknowledges pause */
+	int started;
+	int paused;         /* set by the caller */
+	int waiting;        /* set by the thread, while the ring is full */
+	int status;         /* see rxthr_status() */
+	pthread_t tid;
+} rx;
+
+/**********************************************************************/
+
+static void
+rxthr_signal (int fd)
+{
+	char c = 0;
+
+	/* if the pipe is full, the other side has been woken already */
+	while ( write(fd, &c, 1) < 0 && errno == EINTR )
+		/* nothing */ ;
+}
+
+static void
+rxthr_drain (int fd)
+{
+	char b[64];
+	ssize_t n;
+
+	for (;;) {
+		n = read(fd, b, sizeof(b));
+		if ( n > 0 ) continue;
+		if ( n < 0 && errno == EINTR ) continue;
+		break;
+	}
+}
+
+/* wait until woken by the caller, or, if "fd" is not negative, until
+   "fd" becomes readable or the tick expires */
+static void
+rxthr_wait (int fd)
+{
+	struct pollfd pfd[2];
+
+	pfd[0].fd = rx.ctl[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = fd;
+	pfd[1].events = POLLIN;
+	if ( poll(pfd, (fd < 0) ? 1 : 2,
+			  (fd < 0 || rx.tick <= 0) ? -1 : rx.tick) > 0 && pfd[0].revents )
+		rxthr_drain(rx.ctl[0]);
+}
+
+static void
+rxthr_stop (int status)
+{
+	STORE(&rx.status, status);
+	rxthr_signal(rx.ntf[1]);
+	/* in case the caller is, or is about to be, waiting in
+	   rxthr_pause() */
+	rxthr_signal(rx.ack[1]);
+}
+
+static void *
+rxthr_main (void *arg)
+{
+	ssize_t n;
+
+	for (;;) {
+		if ( LOAD(&rx.paused) ) {
+			rxthr_signal(rx.ack[1]);
+			while ( LOAD(&rx.paused) )
+				rxthr_wait(-1);
+			continue;
+		}
+
+		if ( ring_space(rx.r) == 0 ) {
+			STORE(&rx.waiting, 1);
+			FENCE();
+			if ( ring_space(rx.r) == 0 )
+				rxthr_wait(-1);
+			STORE(&rx.waiting, 0);
+			continue;
+		}
+
+		n = ring_read(rx.r, rx.fd);
+		if ( n > 0 ) {
+			/* notify only if the caller may have found the ring
+			   empty, and may now be blocking */
+			FENCE();
+			if ( ring_len(rx.r) <= (size_t)n )
+				rxthr_signal(rx.ntf[1]);
+		} else if ( n == 0 ) {
+			rxthr_stop(-1);
+			break;
+		} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			rxthr_wait(rx.fd);
+		} else {
+			rxthr_stop(errno);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/**********************************************************************/
+
+static int
+rxthr_pipe (int p[2], int rd_nonblock)
+{
+	if ( pipe(p) < 0 ) return -1;
+	fcntl(p[0], F_SETFD, FD_CLOEXEC);
+	fcntl(p[1], F_SETFD, FD_CLOEXEC);
+	if ( rd_nonblock ) fcntl(p[0], F_SETFL, O_NONBLOCK);
+	fcntl(p[1], F_SETFL, O_NONBLOCK);
+
+	return 0;
+}
+
+int
+rxthr_start (int fd, struct ring *r, int tick)
+{
+	sigset_t all, old;
+	int e;
+
+	if ( rx.started ) { errno = EBUSY; return -1; }
+
+	rx.fd = fd;
+	rx.r = r;
+	rx.tick = tick;
+	if ( rxthr_pipe(rx.ntf, 1) < 0 ) return -1;
+	if ( rxthr_pipe(rx.ctl, 1) < 0 ) return -1;
+	if ( rxthr_pipe(rx.ack, 0) < 0 ) return -1;
+
+	/* signals are for the main thread to handle */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	e = pthread_create(&rx.tid, NULL, rxthr_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if ( e ) { errno = e; return -1; }
+	rx.started = 1;
+
+	return rx.ntf[0];
+}
+
+void
+rxthr_ack (void)
+{
+	rxthr_drain(rx.ntf[0]);
+}
+
+size_t
+rxthr_pending (void)
+{
+	FENCE();
+	return ring_len(rx.r);
+}
+
+void
+rxthr_consume (size_t n)
+{
+	ring_consume(rx.r, n);
+	FENCE();
+	if ( LOAD(&rx.waiting) )
+		rxthr_signal(rx.ctl[1]);
+}
+
+int
+rxthr_status (void)
+{
+	return LOAD(&rx.status);
+}
+
+void
+rxthr_pause (void)
+{
+	char c;
+
+	if ( ! rx.started || LOAD(&rx.status) ) return;
+
+	STORE(&rx.paused, 1);
+	rxthr_signal(rx.ctl[1]);
+	while ( read(rx.ack[0], &c, 1) < 0 && errno == EINTR )
+		/* nothing */ ;
+}
+
+void
+rxthr_resume (void)
+{
+	if ( ! rx.started ) return;
+
+	STORE(&rx.paused, 0);
+	rxthr_signal(rx.ctl[1]);
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
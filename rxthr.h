@@ -0,0 +1,126 @@
+/* vi: set sw=4 ts=4:
+ *
+ * rxthr.h
+ *
+ * Receive thread. Drains a filedes into a ring (see "ring.h") from a
+ * thread of its own, so that reading from the filedes is never
+ * delayed by whatever the rest of the program is doing with the data
+ * (e.g. waiting for a slow terminal).
+ *
+ * Principles of operation:
+ *
+ * The thread is the only producer, and the caller the only consumer
+ * of the ring; they share it without locking. The thread reads from
+ * the filedes as long as there is room in the ring. When the ring
+ * goes from empty to non-empty, or when reading fails, the thread
+ * makes the filedes returned by rxthr_start() readable; the caller is
+ * expected to wait for it (e.g. with "ev.h") and then call
+ * rxthr_ack(). Data are removed from the ring with rxthr_consume()
+ * (not ring_consume()), which wakes the thread if it was waiting for
+ * room. Before blocking, the caller must check rxthr_pending(): if it
+ * returns non-zero there are data in the ring, and no notification
+ * may come for them.
+ *
+ * The filedes being drained should be in non-blocking mode.
+ *
+ * Interface summary:
+ *
+ * F rxthr_start - start draining a filedes into a ring
+ * F rxthr_ack - acknowledge a notification from the thread
+ * F rxthr_pending - number of bytes waiting in the ring
+ * F rxthr_consume - remove bytes from the ring
+ * F rxthr_status - whether the thread has stopped, and why
+ * F rxthr_pause - stop reading from the filedes for a while
+ * F rxthr_resume - resume reading after rxthr_pause
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef RXTHR_H
+#define RXTHR_H
+
+#include <sys/types.h>
+
+#include "ring.h"
+
+/* F rxthr_start
+ *
+ * Start a thread that reads from filedes "fd" into ring "r" until
+ * end-of-file or a read error. Only one receive thread may exist. If
+ * "tick" is positive, the thread also tries to read every "tick"
+ * milliseconds while "fd" is not reported readable (for devices that
+ * may hold data without being readable, see term_set_vmin_vtime).
+ *
+ * Returns the filedes the caller must watch for readability (see
+ * above), or negative on failure (errno is set).
+ */
+int rxthr_start (int fd, struct ring *r, int tick);
+
+/* F rxthr_ack
+ *
+ * Clear the readability of the notification filedes. Call it when the
+ * filedes has been reported readable, before looking at the ring.
+ */
+void rxthr_ack (void);
+
+/* F rxthr_pending
+ *
+ * Returns the number of bytes currently in the ring. A return value
+ * of zero guarantees that the thread will notify the caller when more
+ * data arrive.
+ */
+size_t rxthr_pending (void);
+
+/* F rxthr_consume
+ *
+ * Remove "n" bytes from the head of the ring (see ring_consume), and
+ * wake the thread if it was waiting for room in the ring.
+ */
+void rxthr_consume (size_t n);
+
+/* F rxthr_status
+ *
+ * Returns zero while the thread is reading, -1 if it has stopped at
+ * end-of-file, or the errno value of the read that failed.
+ */
+int rxthr_status (void);
+
+/* F rxthr_pause
+ *
+ * Make the thread stop reading from the filedes, so that another
+ * reader (e.g. a child process) may take over. Returns after the
+ * thread is guaranteed not to be inside a read. Does nothing if no
+ * thread has been started.
+ */
+void rxthr_pause (void);
+
+/* F rxthr_resume
+ *
+ * Make the thread resume reading after a call to rxthr_pause().
+ */
+void rxthr_resume (void);
+
+#endif /* of RXTHR_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
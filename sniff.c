@@ -0,0 +1,180 @@
+/* vi: set sw=4 ts=4:
+ *
+ * sniff.c
+ *
+ * The pseudo-terminal of the sniffer mode.
+ *
+ * Documentation can be found in the header file "sniff.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/stat.h>
+
+#include "term.h"
+#include "sniff.h"
+
+/**********************************************************************/
+
+static const struct {
+	speed_t spd;
+	int baud;
+} sniff_speeds[] = {
+	{ B50, 50 }, { B75, 75 }, { B110, 110 }, { B134, 134 },
+	{ B150, 150 }, { B200, 200 }, { B300, 300 }, { B600, 600 },
+	{ B1200, 1200 }, { B1800, 1800 }, { B2400, 2400 }, { B4800, 4800 },
+	{ B9600, 9600 }, { B19200, 19200 }, { B38400, 38400 },
+	{ B57600, 57600 }, { B115200, 115200 },
+#ifdef HIGH_BAUD
+	{ B230400, 230400 }, { B460800, 460800 }, { B921600, 921600 },
+#endif
+};
+
+#define SNIFF_NSPEEDS (sizeof(sniff_speeds) / sizeof(sniff_speeds[0]))
+
+static struct {
+	int open;
+	int mfd;                    /* master side */
+	int sfd;                    /* slave side, kept open */
+	char *link;
+	struct sniff_hw_s hw;       /* as last reported */
+} sn = { .mfd = -1, .sfd = -1 };
+
+/* the hardware settings in "tio" */
+static void
+sniff_hw (const struct termios *tio, struct sniff_hw_s *hw)
+{
+	speed_t spd;
+	size_t i;
+
+	spd = cfgetospeed(tio);
+	hw->baud = 0;
+	for (i = 0; i < SNIFF_NSPEEDS; i++)
+		if ( sniff_speeds[i].spd == spd )
+			hw->baud = sniff_speeds[i].baud;
+
+	if ( tio->c_cflag & CRTSCTS )
+		hw->flow = FC_RTSCTS;
+	else if ( tio->c_iflag & (IXON | IXOFF) )
+		hw->flow = FC_XONXOFF;
+	else
+		hw->flow = FC_NONE;
+}
+
+/**********************************************************************/
+
+int
+sniff_open (const char *link, const struct sniff_hw_s *hw,
+			char *name, size_t sz)
+{
+	struct term_dev_s *t;
+	struct termios tio;
+	struct stat st;
+	char *s;
+	int r, e;
+
+	if ( sn.open ) { errno = EBUSY; return -1; }
+	sn.open = 1;
+
+	sn.mfd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if ( sn.mfd < 0 ) goto fail;
+	if ( grantpt(sn.mfd) < 0 || unlockpt(sn.mfd) < 0 ) goto fail;
+	s = ptsname(sn.mfd);
+	if ( ! s ) goto fail;
+	if ( strlen(s) >= sz ) { errno = ENAMETOOLONG; goto fail; }
+	strcpy(name, s);
+	fcntl(sn.mfd, F_SETFL, O_NONBLOCK);
+
+	sn.sfd = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if ( sn.sfd < 0 ) goto fail;
+	t = term_dev_add(sn.sfd, NULL);
+	if ( ! t ) goto fail;
+	r = term_dev_set_raw(t);
+	if ( r >= 0 ) r = term_dev_set_baudrate(t, hw->baud);
+	if ( r >= 0 ) r = term_dev_set_flowcntrl(t, hw->flow);
+	if ( r >= 0 ) r = term_dev_apply(t);
+	/* the settings outlive the handle */
+	term_dev_erase(t);
+	if ( r < 0 ) {
+		if ( r != -TERM_ESETATTR ) errno = EINVAL;
+		goto fail;
+	}
+	if ( tcgetattr(sn.sfd, &tio) < 0 ) goto fail;
+	sniff_hw(&tio, &sn.hw);
+
+	if ( link ) {
+		if ( lstat(link, &st) == 0 && S_ISLNK(st.st_mode) )
+			unlink(link);
+		if ( symlink(name, link) < 0 ) goto fail;
+		sn.link = strdup(link);
+	}
+
+	return sn.mfd;
+
+fail:
+	e = errno;
+	sniff_close();
+	errno = e;
+	return -1;
+}
+
+int
+sniff_poll (struct sniff_hw_s *hw)
+{
+	struct termios tio;
+	struct sniff_hw_s h;
+
+	if ( ! sn.open ) { errno = EBADF; return -1; }
+
+	if ( tcgetattr(sn.sfd, &tio) < 0 ) return -1;
+	sniff_hw(&tio, &h);
+	if ( h.baud == sn.hw.baud && h.flow == sn.hw.flow ) return 0;
+	sn.hw = h;
+	*hw = h;
+
+	return 1;
+}
+
+void
+sniff_close (void)
+{
+	if ( ! sn.open ) return;
+
+	if ( sn.link ) unlink(sn.link);
+	free(sn.link);
+	sn.link = NULL;
+	if ( sn.sfd >= 0 ) close(sn.sfd);
+	if ( sn.mfd >= 0 ) close(sn.mfd);
+	sn.sfd = sn.mfd = -1;
+	sn.open = 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
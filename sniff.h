@@ -0,0 +1,104 @@
+/* vi: set sw=4 ts=4:
+ *
+ * sniff.h
+ *
+ * The pseudo-terminal of the sniffer mode. A program that insists on
+ * owning a serial port is given the slave side of a pseudo-terminal
+ * instead, while picocom, owning the real port, passes the data
+ * through between the two (see --sniff in "picocom.c").
+ *
+ * Principles of operation:
+ *
+ * The pseudo-terminal is created in raw mode, with the baud rate and
+ * flow control of the real port. picocom keeps the slave side open
+ * itself, so that the program may close and re-open it without the
+ * master side seeing a hangup, and without the settings being lost;
+ * while no program has it open, the data for it wait in the
+ * pseudo-terminal (up to a few KB, then picocom stops reading the
+ * real port).
+ *
+ * The settings that the program makes on the slave side are not
+ * announced in any way, so they are polled: sniff_poll() reads them,
+ * and reports the hardware settings if they changed since the last
+ * call. Only the baud rate and the flow control can be reported: a
+ * pseudo-terminal on Linux forces CS8, and ignores parity.
+ *
+ * Interface summary:
+ *
+ * F sniff_open - create the pseudo-terminal
+ * F sniff_poll - check for changes of the settings
+ * F sniff_close - destroy the pseudo-terminal
+ * T sniff_hw_s - hardware settings
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef SNIFF_H
+#define SNIFF_H
+
+#include <stddef.h>
+
+#include "term.h"
+
+/* T sniff_hw_s
+ *
+ * Hardware settings of the pseudo-terminal, as made by the program.
+ */
+struct sniff_hw_s {
+	int baud;                   /* zero if not a standard rate */
+	enum flowcntrl_e flow;
+};
+
+/* F sniff_open
+ *
+ * Create the pseudo-terminal, in raw mode, with the settings "hw". If
+ * "link" is not NULL, a symbolic link to the slave side is created by
+ * that name (an existing symbolic link is replaced). The name of the
+ * slave side is stored in "name", a buffer of "sz" bytes.
+ *
+ * Returns the filedes of the master side (non-blocking), or negative
+ * on failure (errno is set).
+ */
+int sniff_open (const char *link, const struct sniff_hw_s *hw,
+				char *name, size_t sz);
+
+/* F sniff_poll
+ *
+ * Read the settings of the pseudo-terminal. If its hardware settings
+ * have changed since the last call (or since sniff_open), store them
+ * in "hw".
+ *
+ * Returns 1 if they changed, 0 if not, negative on failure.
+ */
+int sniff_poll (struct sniff_hw_s *hw);
+
+/* F sniff_close
+ *
+ * Destroy the pseudo-terminal, and remove the symbolic link.
+ */
+void sniff_close (void);
+
+#endif /* of SNIFF_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
@@ -7,7 +7,7 @@
  * Nick Patavalis (npat@inaccessnetworks.com)
  *
  * originaly by Pantelis Antoniou (panto@intranet.gr), Nick Patavalis
- *    
+ *
  * Documentation can be found in the header file "term.h".
  *
  * This program is free software; you can redistribute it and/or
@@ -23,7 +23,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
- * USA 
+ * USA
  *
  * $Id$
  */
@@ -43,12 +43,27 @@
 
 /***************************************************************************/
 
+/* A terminal handle: a filedes and its settings structures. The
+   term_dev_* functions only ever touch the handle they are given. */
+
+struct term_dev_s {
+	int fd;
+	struct termios origtermios;
+	struct termios currtermios;
+	struct termios nexttermios;
+};
+
+/* The framework, used by the filedes-based interface. The table is
+   indexed by filedes: the handle of filedes "fd" is at index "fd", or
+   NULL if the filedes is not in the framework. It grows as needed, by
+   doubling. */
+
+#define TERM_TAB_MIN 16
+
 static struct term_s {
 	int init;
-	int fd[MAX_TERMS];
-	struct termios origtermios[MAX_TERMS];
-	struct termios currtermios[MAX_TERMS];
-	struct termios nexttermios[MAX_TERMS];
+	int size;
+	struct term_dev_s **dev;
 } term;
 
 /***************************************************************************/
@@ -58,7 +73,7 @@ int term_errno;
 static const char * const term_err_str[] = {
 	[TERM_EOK]        = "No error",
 	[TERM_ENOINIT]    = "Framework is uninitialized",
-	[TERM_EFULL]      = "Framework is full",
+	[TERM_EFULL]      = "Framework is full (out of memory)",
     [TERM_ENOTFOUND]  = "Filedes not in the framework",
     [TERM_EEXISTS]    = "Filedes already in the framework",
     [TERM_EATEXIT]    = "Cannot install atexit handler",
@@ -75,15 +90,15 @@ static const char * const term_err_str[] = {
     [TERM_EDTRDOWN]   = "Cannot lower DTR",
     [TERM_EDTRUP]     = "Cannot raise DTR",
 	[TERM_EDRAIN]     = "Cannot drain the device",
-	[TERM_EBREAK]     = "Cannot send break sequence"
+	[TERM_EBREAK]     = "Cannot send break sequence",
+	[TERM_EVMINVTIME] = "Invalid VMIN or VTIME value"
 };
 
-static char term_err_buff[1024];
-
 const char *
-term_strerror (int terrnum, int errnum)
+term_strerror_r (int terrnum, int errnum, char *buf, size_t sz)
 {
 	const char *rval;
+	char ebuf[128];
 
 	switch(terrnum) {
 	case TERM_EFLUSH:
@@ -93,9 +108,12 @@ term_strerror (int terrnum, int errnum)
 	case TERM_ESETISPEED:
 	case TERM_EDRAIN:
 	case TERM_EBREAK:
-		snprintf(term_err_buff, sizeof(term_err_buff),
-				 "%s: %s", term_err_str[terrnum], strerror(errnum));
-		rval = term_err_buff;
+		/* strerror() may use a static buffer: not from several
+		   threads */
+		if ( strerror_r(errnum, ebuf, sizeof(ebuf)) != 0 )
+			snprintf(ebuf, sizeof(ebuf), "Unknown error %d", errnum);
+		snprintf(buf, sz, "%s: %s", term_err_str[terrnum], ebuf);
+		rval = buf;
 		break;
 	case TERM_EOK:
 	case TERM_ENOINIT:
@@ -110,9 +128,9 @@ term_strerror (int terrnum, int errnum)
 	case TERM_EFLOW:
 	case TERM_EDTRDOWN:
 	case TERM_EDTRUP:
-		snprintf(term_err_buff, sizeof(term_err_buff),
-				 "%s", term_err_str[terrnum]);
-		rval = term_err_buff;
+	case TERM_EVMINVTIME:
+		snprintf(buf, sz, "%s", term_err_str[terrnum]);
+		rval = buf;
 		break;
 	default:
 		rval = NULL;
@@ -122,6 +140,15 @@ term_strerror (int terrnum, int errnum)
 	return rval;
 }
 
+static char term_err_buff[1024];
+
+const char *
+term_strerror (int terrnum, int errnum)
+{
+	return term_strerror_r(terrnum, errnum,
+						   term_err_buff, sizeof(term_err_buff));
+}
+
 int
 term_perror (const char *prefix)
 {
@@ -131,272 +158,105 @@ term_perror (const char *prefix)
 
 /***************************************************************************/
 
-static int
-term_find_next_free (void)
+struct term_dev_s *
+term_dev_add (int fd, int *err)
 {
-	int rval, i;
-
-	do { /* dummy */
-		if ( ! term.init ) {
-			term_errno = TERM_ENOINIT;
-			rval = -1;
-			break;
-		}
-
-		for (i = 0; i < MAX_TERMS; i++)
-			if ( term.fd[i] == -1 ) break;
-
-		if ( i == MAX_TERMS ) {
-			term_errno = TERM_EFULL;
-			rval = -1;
-			break;
-		}
-
-		rval = i;
-	} while (0);
+	struct term_dev_s *t;
+	int r, e;
 
-	return rval;
-}
-
-/***************************************************************************/
-
-static int
-term_find (int fd)
-{
-	int rval, i;
+	t = NULL;
+	e = TERM_EOK;
 
 	do { /* dummy */
-		if ( ! term.init ) {
-			term_errno = TERM_ENOINIT;
-			rval = -1;
+		if ( ! isatty(fd) ) {
+			e = TERM_EISATTY;
 			break;
 		}
 
-		for (i = 0; i < MAX_TERMS; i++)
-			if (term.fd[i] == fd) break;
-
-		if ( i == MAX_TERMS ) {
-			term_errno = TERM_ENOTFOUND;
-			rval = -1;
+		t = malloc(sizeof(*t));
+		if ( ! t ) {
+			e = TERM_EFULL;
 			break;
 		}
 
-		rval = i;
-	} while (0);
-
-	return rval;
-}
-
-/***************************************************************************/
-
-static void
-term_exitfunc (void)
-{
-	int r, i;
-
-	do { /* dummy */
-		if ( ! term.init )
+		r = tcgetattr(fd, &t->origtermios);
+		if ( r < 0 ) {
+			free(t);
+			t = NULL;
+			e = TERM_EGETATTR;
 			break;
-
-		for (i = 0; i < MAX_TERMS; i++) {
-			if (term.fd[i] == -1)
-				continue;
-			do { /* dummy */
-				r = tcflush(term.fd[i], TCIOFLUSH);
-				if ( r < 0 ) break;
-				r = tcsetattr(term.fd[i], TCSAFLUSH, &term.origtermios[i]);
-				if ( r < 0 ) break;
-			} while (0);
-			if ( r < 0 ) {
-				char *tname;
-
-				tname = ttyname(term.fd[i]);
-				if ( ! tname ) tname = "UNKNOWN";
-				fprintf(stderr, "%s: reset failed for dev %s: %s\n",
-						__FUNCTION__, tname, strerror(errno));
-			}
-			term.fd[i] = -1;
 		}
-	} while (0);
-}
-
-/***************************************************************************/
-
-int
-term_lib_init (void)
-{
-	int rval, r, i;
 
-	rval = 0;
+		t->currtermios = t->origtermios;
+		t->nexttermios = t->origtermios;
+		t->fd = fd;
+	} while (0);
 
-	do { /* dummy */
-		if ( term.init ) {
-			/* reset all terms back to their original settings */
-			for (i = 0; i < MAX_TERMS; i++) {
-				if (term.fd[i] == -1)
-					continue;
-				do {
-					r = tcflush(term.fd[i], TCIOFLUSH);
-					if ( r < 0 ) break;
-					r = tcsetattr(term.fd[i], TCSAFLUSH, &term.origtermios[i]);
-					if ( r < 0 ) break;
-				} while (0);
-				if ( r < 0 ) {
-					char *tname;
- 
-					tname = ttyname(term.fd[i]);
-					if ( ! tname ) tname = "UNKNOWN";
-					fprintf(stderr, "%s: reset failed for dev %s: %s\n",
-							__FUNCTION__, tname, strerror(errno));
-				}
-				term.fd[i] = -1;
-			}
-		} else {
-			/* initialize term structure. */
-			for (i = 0; i < MAX_TERMS; i++)
-				term.fd[i] = -1;
-			if ( atexit(term_exitfunc) != 0 ) {
-				term_errno = TERM_EATEXIT;
-				rval = -1; 
-				break;
-			}
-			/* ok. term struct is now initialized. */
-			term.init = 1;
-		}
-	} while(0);
+	if ( err ) *err = e;
 
-	return rval;
+	return t;
 }
 
 /***************************************************************************/
 
 int
-term_add (int fd)
+term_dev_remove (struct term_dev_s *t)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
-		i = term_find(fd);
-		if ( i >= 0 ) {
-			term_errno = TERM_EEXISTS;
-			rval = -1;
-			break;
-		}
-
-		if ( ! isatty(fd) ) {
-			term_errno = TERM_EISATTY;
-			rval = -1;
-			break;
-		}
-
-		i = term_find_next_free();
-		if ( i < 0 ) {
-			rval = -1;
+		r = tcflush(t->fd, TCIOFLUSH);
+		if ( r < 0 ) {
+			rval = -TERM_EFLUSH;
 			break;
 		}
-
-		r = tcgetattr(fd, &term.origtermios[i]);
+		r = tcsetattr(t->fd, TCSAFLUSH, &t->origtermios);
 		if ( r < 0 ) {
-			term_errno = TERM_EGETATTR;
-			rval = -1;
+			rval = -TERM_ESETATTR;
 			break;
 		}
-
-		term.currtermios[i] = term.origtermios[i];
-		term.nexttermios[i] = term.origtermios[i];
-		term.fd[i] = fd;
 	} while (0);
 
+	free(t);
+
 	return rval;
 }
 
 /***************************************************************************/
 
-int
-term_remove(int fd)
+void
+term_dev_erase (struct term_dev_s *t)
 {
-	int rval, r, i;
-
-	rval = 0;
-
-	do { /* dummy */
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-		
-		do { /* dummy */
-			r = tcflush(term.fd[i], TCIOFLUSH);
-			if ( r < 0 ) { 
-				term_errno = TERM_EFLUSH;
-				rval = -1;
-				break;
-			}
-			r = tcsetattr(term.fd[i], TCSAFLUSH, &term.origtermios[i]);
-			if ( r < 0 ) {
-				term_errno = TERM_ESETATTR;
-				rval = -1;
-				break;
-			}
-		} while (0);
-		
-		term.fd[i] = -1;
-	} while (0);
-
-	return rval;
+	free(t);
 }
 
 /***************************************************************************/
 
 int
-term_erase(int fd)
+term_dev_fd (const struct term_dev_s *t)
 {
-	int rval, i;
-
-	rval = 0;
-
-	do { /* dummy */
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-		
-		term.fd[i] = -1;
-	} while (0);
-
-	return rval;
+	return t->fd;
 }
 
 /***************************************************************************/
 
 int
-term_replace (int oldfd, int newfd)
+term_dev_replace (struct term_dev_s *t, int newfd)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
-
-		i = term_find(oldfd); 
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		r = tcsetattr(newfd, TCSAFLUSH, &term.currtermios[i]);
+		r = tcsetattr(newfd, TCSAFLUSH, &t->currtermios);
 		if ( r < 0 ) {
-			term_errno = TERM_ESETATTR;
-			rval = -1;
+			rval = -TERM_ESETATTR;
 			break;
 		}
 
-		term.fd[i] = newfd;
-
+		t->fd = newfd;
 	} while (0);
 
 	return rval;
@@ -405,35 +265,26 @@ term_replace (int oldfd, int newfd)
 /***************************************************************************/
 
 int
-term_reset (int fd)
+term_dev_reset (struct term_dev_s *t)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		r = tcflush(term.fd[i], TCIOFLUSH);
+		r = tcflush(t->fd, TCIOFLUSH);
 		if ( r < 0 ) {
-			term_errno = TERM_EFLUSH;
-			rval = -1;
+			rval = -TERM_EFLUSH;
 			break;
 		}
-		r = tcsetattr(term.fd[i], TCSAFLUSH, &term.origtermios[i]);
+		r = tcsetattr(t->fd, TCSAFLUSH, &t->origtermios);
 		if ( r < 0 ) {
-			term_errno = TERM_ESETATTR;
-			rval = -1;
+			rval = -TERM_ESETATTR;
 			break;
 		}
 
-		term.currtermios[i] = term.origtermios[i];
-		term.nexttermios[i] = term.origtermios[i];
+		t->currtermios = t->origtermios;
+		t->nexttermios = t->origtermios;
 	} while (0);
 
 	return rval;
@@ -442,51 +293,28 @@ term_reset (int fd)
 /***************************************************************************/
 
 int
-term_revert (int fd)
+term_dev_revert (struct term_dev_s *t)
 {
-	int rval, i;
-
-	rval = 0;
-
-	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		term.nexttermios[i] = term.currtermios[i];
+	t->nexttermios = t->currtermios;
 
-	} while (0);
-
-	return rval;
+	return 0;
 }
 
 /***************************************************************************/
 
 int
-term_refresh (int fd)
+term_dev_refresh (struct term_dev_s *t)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		r = tcgetattr(fd, &term.currtermios[i]);
+		r = tcgetattr(t->fd, &t->currtermios);
 		if ( r < 0 ) {
-			term_errno = TERM_EGETATTR;
-			rval = -1;
+			rval = -TERM_EGETATTR;
 			break;
 		}
-
 	} while (0);
 
 	return rval;
@@ -495,29 +323,20 @@ term_refresh (int fd)
 /***************************************************************************/
 
 int
-term_apply (int fd)
+term_dev_apply (struct term_dev_s *t)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-		
-		r = tcsetattr(term.fd[i], TCSAFLUSH, &term.nexttermios[i]);
+		r = tcsetattr(t->fd, TCSAFLUSH, &t->nexttermios);
 		if ( r < 0 ) {
-			term_errno = TERM_ESETATTR;
-			rval = -1;
+			rval = -TERM_ESETATTR;
 			break;
 		}
-		
-		term.currtermios[i] = term.nexttermios[i];
 
+		t->currtermios = t->nexttermios;
 	} while (0);
 
 	return rval;
@@ -526,37 +345,23 @@ term_apply (int fd)
 /***************************************************************************/
 
 int
-term_set_raw (int fd)
+term_dev_set_raw (struct term_dev_s *t)
 {
-	int rval, i;
-
-	rval = 0;
-
-	do { /* dummy */
-		
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		/* BSD raw mode */
-		cfmakeraw(&term.nexttermios[i]);
-		/* one byte at a time, no timer */
-		term.nexttermios[i].c_cc[VMIN] = 1;
-		term.nexttermios[i].c_cc[VTIME] = 0;
+	/* BSD raw mode */
+	cfmakeraw(&t->nexttermios);
+	/* one byte at a time, no timer */
+	t->nexttermios.c_cc[VMIN] = 1;
+	t->nexttermios.c_cc[VTIME] = 0;
 
-	} while (0);
-	
-	return rval;
+	return 0;
 }
 
 /***************************************************************************/
 
 int
-term_set_baudrate (int fd, int baudrate)
+term_dev_set_baudrate (struct term_dev_s *t, int baudrate)
 {
-	int rval, r, i;
+	int rval, r;
 	speed_t spd;
 	struct termios tio;
 
@@ -564,13 +369,7 @@ term_set_baudrate (int fd, int baudrate)
 
 	do { /* dummy */
 
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		tio = term.nexttermios[i];
+		tio = t->nexttermios;
 
 		switch (baudrate) {
 		case 0:
@@ -639,27 +438,24 @@ term_set_baudrate (int fd, int baudrate)
 			break;
 #endif
 		default:
-			term_errno = TERM_EBAUD;
-			rval = -1;
+			rval = -TERM_EBAUD;
 			break;
 		}
 		if ( rval < 0 ) break;
 
 		r = cfsetospeed(&tio, spd);
 		if ( r < 0 ) {
-			term_errno = TERM_ESETOSPEED;
-			rval = -1;
+			rval = -TERM_ESETOSPEED;
 			break;
 		}
-			
+
 		r = cfsetispeed(&tio, spd);
 		if ( r < 0 ) {
-			term_errno = TERM_ESETISPEED;
-			rval = -1;
+			rval = -TERM_ESETISPEED;
 			break;
 		}
 
-		term.nexttermios[i] = tio;
+		t->nexttermios = tio;
 
 	} while (0);
 
@@ -669,42 +465,29 @@ term_set_baudrate (int fd, int baudrate)
 /***************************************************************************/
 
 int
-term_set_parity (int fd, enum parity_e parity) 
+term_dev_set_parity (struct term_dev_s *t, enum parity_e parity)
 {
-	int rval, i;
+	int rval;
 	struct termios *tiop;
 
 	rval = 0;
+	tiop = &t->nexttermios;
 
-	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		tiop = &term.nexttermios[i];
-
-		switch (parity) {
-		case P_EVEN:
-			tiop->c_cflag &= ~PARODD;
-			tiop->c_cflag |= PARENB;
-			break;
-		case P_ODD:
-			tiop->c_cflag |= PARENB | PARODD;
-			break;
-		case P_NONE:
-			tiop->c_cflag &= ~(PARENB | PARODD); 
-			break;
-		default:
-			term_errno = TERM_EPARITY;
-			rval = -1;
-			break;
-		}
-		if ( rval < 0 ) break;
-
-	} while (0);
+	switch (parity) {
+	case P_EVEN:
+		tiop->c_cflag &= ~PARODD;
+		tiop->c_cflag |= PARENB;
+		break;
+	case P_ODD:
+		tiop->c_cflag |= PARENB | PARODD;
+		break;
+	case P_NONE:
+		tiop->c_cflag &= ~(PARENB | PARODD);
+		break;
+	default:
+		rval = -TERM_EPARITY;
+		break;
+	}
 
 	return rval;
 }
@@ -712,44 +495,31 @@ term_set_parity (int fd, enum parity_e parity)
 /***************************************************************************/
 
 int
-term_set_databits (int fd, int databits)
+term_dev_set_databits (struct term_dev_s *t, int databits)
 {
-	int rval, i;
+	int rval;
 	struct termios *tiop;
 
 	rval = 0;
+	tiop = &t->nexttermios;
 
-	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		tiop = &term.nexttermios[i];
-				
-		switch (databits) {
-		case 5:
-			tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS5;
-			break;
-		case 6:
-			tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS6;
-			break;
-		case 7:
-			tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS7;
-			break;
-		case 8:
-			tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS8;
-			break;
-		default:
-			term_errno = TERM_EDATABITS;
-			rval = -1;
-			break;
-		}
-		if ( rval < 0 ) break;
-
-	} while (0);
+	switch (databits) {
+	case 5:
+		tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS5;
+		break;
+	case 6:
+		tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS6;
+		break;
+	case 7:
+		tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS7;
+		break;
+	case 8:
+		tiop->c_cflag = (tiop->c_cflag & ~CSIZE) | CS8;
+		break;
+	default:
+		rval = -TERM_EDATABITS;
+		break;
+	}
 
 	return rval;
 }
@@ -757,44 +527,31 @@ term_set_databits (int fd, int databits)
 /***************************************************************************/
 
 int
-term_set_flowcntrl (int fd, enum flowcntrl_e flowcntl)
+term_dev_set_flowcntrl (struct term_dev_s *t, enum flowcntrl_e flowcntl)
 {
-	int rval, i;
+	int rval;
 	struct termios *tiop;
 
 	rval = 0;
+	tiop = &t->nexttermios;
 
-	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-		
-		tiop = &term.nexttermios[i];
-
-		switch (flowcntl) {
-		case FC_RTSCTS:
-			tiop->c_cflag |= CRTSCTS;
-			tiop->c_iflag &= ~(IXON | IXOFF | IXANY);
-			break;
-		case FC_XONXOFF:
-			tiop->c_cflag &= ~(CRTSCTS);
-			tiop->c_iflag |= IXON | IXOFF;
-			break;
-		case FC_NONE:
-			tiop->c_cflag &= ~(CRTSCTS);
-			tiop->c_iflag &= ~(IXON | IXOFF | IXANY);
-			break;
-		default:
-			term_errno = TERM_EFLOW;
-			rval = -1;
-			break;
-		}
-		if ( rval < 0 ) break;
-
-	} while (0);
+	switch (flowcntl) {
+	case FC_RTSCTS:
+		tiop->c_cflag |= CRTSCTS;
+		tiop->c_iflag &= ~(IXON | IXOFF | IXANY);
+		break;
+	case FC_XONXOFF:
+		tiop->c_cflag &= ~(CRTSCTS);
+		tiop->c_iflag |= IXON | IXOFF;
+		break;
+	case FC_NONE:
+		tiop->c_cflag &= ~(CRTSCTS);
+		tiop->c_iflag &= ~(IXON | IXOFF | IXANY);
+		break;
+	default:
+		rval = -TERM_EFLOW;
+		break;
+	}
 
 	return rval;
 }
@@ -802,166 +559,117 @@ term_set_flowcntrl (int fd, enum flowcntrl_e flowcntl)
 /***************************************************************************/
 
 int
-term_set_local(int fd, int local)
+term_dev_set_local (struct term_dev_s *t, int local)
 {
-	int rval, i;
-	struct termios *tiop;
-
-	rval = 0;
-
-	do { /* dummy */
+	if ( local )
+		t->nexttermios.c_cflag |= CLOCAL;
+	else
+		t->nexttermios.c_cflag &= ~CLOCAL;
 
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
-		tiop = &term.nexttermios[i];
-
-		if ( local )
-			tiop->c_cflag |= CLOCAL;
-		else
-			tiop->c_cflag &= ~CLOCAL;
-
-	} while (0);
-
-	return rval;
+	return 0;
 }
 
 /***************************************************************************/
 
 int
-term_set_hupcl (int fd, int on)
+term_dev_set_hupcl (struct term_dev_s *t, int on)
 {
-	int rval, i;
-	struct termios *tiop;
+	if ( on )
+		t->nexttermios.c_cflag |= HUPCL;
+	else
+		t->nexttermios.c_cflag &= ~HUPCL;
 
-	rval = 0;
-
-	do { /* dummy */
-
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
+	return 0;
+}
 
-		tiop = &term.nexttermios[i];
+/***************************************************************************/
 
-		if ( on )
-			tiop->c_cflag |= HUPCL;
-		else
-			tiop->c_cflag &= ~HUPCL;
+int
+term_dev_set_vmin_vtime (struct term_dev_s *t, int vmin, int vtime)
+{
+	if ( vmin < 0 || vmin > 255 || vtime < 0 || vtime > 255 )
+		return -TERM_EVMINVTIME;
 
-	} while (0);
+	t->nexttermios.c_cc[VMIN] = vmin;
+	t->nexttermios.c_cc[VTIME] = vtime;
 
-	return rval;
+	return 0;
 }
 
 /***************************************************************************/
 
 int
-term_set(int fd,
-		 int raw,
-		 int baud, enum parity_e parity, int bits, enum flowcntrl_e fc,
-		 int local, int hup_close)
+term_dev_set (struct term_dev_s *t,
+			  int raw,
+			  int baud, enum parity_e parity, int bits, enum flowcntrl_e fc,
+			  int local, int hup_close)
 {
-	int rval, r, i, ni;
+	int rval;
 	struct termios tio;
 
 	rval = 0;
+	tio = t->nexttermios;
 
 	do { /* dummy */
 
-		i = term_find(fd);
-		if ( i < 0 ) {
-			ni = term_add(fd);
-			if ( ni < 0 ) {
-				rval = -1;
-				break;
-			}
-		} else {
-			ni = i;
+		if (raw) {
+			rval = term_dev_set_raw(t);
+			if ( rval < 0 ) break;
 		}
 
-		tio = term.nexttermios[ni];
+		rval = term_dev_set_baudrate(t, baud);
+		if ( rval < 0 ) break;
 
-		do { /* dummy */
+		rval = term_dev_set_parity(t, parity);
+		if ( rval < 0 ) break;
 
-			if (raw) {
-				r = term_set_raw(fd);
-				if ( r < 0 ) { rval = -1; break; }
-			}
-			
-			r = term_set_baudrate(fd, baud);
-			if ( r < 0 ) { rval = -1; break; }
-			
-			r = term_set_parity(fd, parity);
-			if ( r < 0 ) { rval = -1; break; }
-			
-			r = term_set_databits(fd, bits);
-			if ( r < 0 ) { rval = -1; break; }
-			
-			r = term_set_flowcntrl(fd, fc);
-			if ( r < 0 ) { rval = -1; break; }
-			
-			r = term_set_local(fd, local);
-			if ( r < 0 ) { rval = -1; break; }
-			
-			r = term_set_hupcl(fd, hup_close);
-			if ( r < 0 ) { rval = -1; break; }
-			
-		} while (0);
-
-		if ( rval < 0 ) { 
-			if ( i < 0 )
-				/* new addition. must be removed */
-				term.fd[ni] = -1;
-			else
-				/* just revert to previous settings */
-				term.nexttermios[ni] = tio;
-		}
+		rval = term_dev_set_databits(t, bits);
+		if ( rval < 0 ) break;
+
+		rval = term_dev_set_flowcntrl(t, fc);
+		if ( rval < 0 ) break;
+
+		rval = term_dev_set_local(t, local);
+		if ( rval < 0 ) break;
+
+		rval = term_dev_set_hupcl(t, hup_close);
+		if ( rval < 0 ) break;
 
 	} while (0);
 
+	/* revert to the previous settings */
+	if ( rval < 0 )
+		t->nexttermios = tio;
+
 	return rval;
 }
 
 /***************************************************************************/
 
 int
-term_pulse_dtr (int fd)
+term_dev_pulse_dtr (struct term_dev_s *t)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
 
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
 #ifdef __linux__
 		{
 			int opins = TIOCM_DTR;
 
-			r = ioctl(fd, TIOCMBIC, &opins);
+			r = ioctl(t->fd, TIOCMBIC, &opins);
 			if ( r < 0 ) {
-				term_errno = TERM_EDTRDOWN;
-				rval = -1;
+				rval = -TERM_EDTRDOWN;
 				break;
 			}
 
 			sleep(1);
 
-			r = ioctl(fd, TIOCMBIS, &opins);
+			r = ioctl(t->fd, TIOCMBIS, &opins);
 			if ( r < 0 ) {
-				term_errno = TERM_EDTRUP;
-				rval = -1;
+				rval = -TERM_EDTRUP;
 				break;
 			}
 		}
@@ -969,36 +677,33 @@ term_pulse_dtr (int fd)
 		{
 			struct termios tio, tioold;
 
-			r = tcgetattr(fd, &tio);
+			r = tcgetattr(t->fd, &tio);
 			if ( r < 0 ) {
-				term_errno = TERM_ESETATTR;
-				rval = -1;
+				rval = -TERM_ESETATTR;
 				break;
 			}
-			
+
 			tioold = tio;
-			
+
 			cfsetospeed(&tio, B0);
 			cfsetispeed(&tio, B0);
-			r = tcsetattr(fd, TCSANOW, &tio);
+			r = tcsetattr(t->fd, TCSANOW, &tio);
 			if ( r < 0 ) {
-				term_errno = TERM_ESETATTR;
-				rval = -1;
+				rval = -TERM_ESETATTR;
 				break;
 			}
-			
+
 			sleep(1);
-			
-			r = tcsetattr(fd, TCSANOW, &tioold);
+
+			r = tcsetattr(t->fd, TCSANOW, &tioold);
 			if ( r < 0 ) {
-				term.currtermios[i] = tio;
-				term_errno = TERM_ESETATTR;
-				rval = -1;
+				t->currtermios = tio;
+				rval = -TERM_ESETATTR;
 				break;
 			}
 		}
 #endif /* of __linux__ */
-			
+
 	} while (0);
 
 	return rval;
@@ -1007,37 +712,29 @@ term_pulse_dtr (int fd)
 /***************************************************************************/
 
 int
-term_raise_dtr(int fd)
+term_dev_raise_dtr (struct term_dev_s *t)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
 
-		i = term_find(fd);
-		if ( i < 0 ) {
-			rval = -1;
-			break;
-		}
-
 #ifdef __linux__
 		{
 			int opins = TIOCM_DTR;
 
-			r = ioctl(fd, TIOCMBIS, &opins);
+			r = ioctl(t->fd, TIOCMBIS, &opins);
 			if ( r < 0 ) {
-				term_errno = TERM_EDTRUP;
-				rval = -1;
+				rval = -TERM_EDTRUP;
 				break;
 			}
 		}
 #else
-		r = tcsetattr(fd, TCSANOW, &term.currtermios[i]);
+		r = tcsetattr(t->fd, TCSANOW, &t->currtermios);
 		if ( r < 0 ) {
 			/* FIXME: perhaps try to update currtermios */
-			term_errno = TERM_ESETATTR;
-			rval = -1;
+			rval = -TERM_ESETATTR;
 			break;
 		}
 #endif /* of __linux__ */
@@ -1047,31 +744,23 @@ term_raise_dtr(int fd)
 }
 
 /***************************************************************************/
-
 
 int
-term_lower_dtr(int fd)
+term_dev_lower_dtr (struct term_dev_s *t)
 {
-	int rval, r, i;
+	int rval, r;
 
 	rval = 0;
 
 	do { /* dummy */
 
-		i = term_find(fd);
-		if ( i < 0 ) { 
-			rval = -1;
-			break;
-		}
-
 #ifdef __linux__
 		{
 			int opins = TIOCM_DTR;
 
-			r = ioctl(fd, TIOCMBIC, &opins);
+			r = ioctl(t->fd, TIOCMBIC, &opins);
 			if ( r < 0 ) {
-				term_errno = TERM_EDTRDOWN;
-				rval = -1;
+				rval = -TERM_EDTRDOWN;
 				break;
 			}
 		}
@@ -1079,84 +768,238 @@ term_lower_dtr(int fd)
 		{
 			struct termios tio;
 
-			r = tcgetattr(fd, &tio);
+			r = tcgetattr(t->fd, &tio);
 			if ( r < 0 ) {
-				term_errno = TERM_EGETATTR;
-				rval = -1;
+				rval = -TERM_EGETATTR;
 				break;
 			}
-			term.currtermios[i] = tio;
-			
+			t->currtermios = tio;
+
 			cfsetospeed(&tio, B0);
 			cfsetispeed(&tio, B0);
-			
-			r = tcsetattr(fd, TCSANOW, &tio);
+
+			r = tcsetattr(t->fd, TCSANOW, &tio);
 			if ( r < 0 ) {
-				term_errno = TERM_ESETATTR;
-				rval = -1;
+				rval = -TERM_ESETATTR;
 				break;
 			}
 		}
 #endif /* of __linux__ */
 	} while (0);
-	
+
 	return rval;
 }
 
 /***************************************************************************/
 
 int
-term_drain(int fd)
+term_dev_drain (struct term_dev_s *t)
 {
-	int rval, r;
+	int r;
+
+	do {
+		r = tcdrain(t->fd);
+	} while ( r < 0 && errno == EINTR);
+
+	return ( r < 0 ) ? -TERM_EDRAIN : 0;
+}
+
+/***************************************************************************/
+
+int
+term_dev_flush (struct term_dev_s *t)
+{
+	int r;
+
+	r = tcflush(t->fd, TCIOFLUSH);
+
+	return ( r < 0 ) ? -TERM_EFLUSH : 0;
+}
+
+/***************************************************************************/
+
+int
+term_dev_break (struct term_dev_s *t)
+{
+	int r;
+
+	r = tcsendbreak(t->fd, 0);
+
+	return ( r < 0 ) ? -TERM_EBREAK : 0;
+}
+
+/***************************************************************************/
+
+/* The filedes-based interface: the framework maps each filedes to its
+   handle, and the functions below are wrappers that report errors in
+   term_errno. */
+
+static int
+term_grow (int fd)
+{
+	int rval, sz, i;
+	void *p;
 
 	rval = 0;
 
 	do { /* dummy */
-
-		r = term_find(fd);
-		if ( r < 0 ) {
+		if ( ! term.init ) {
+			term_errno = TERM_ENOINIT;
 			rval = -1;
 			break;
 		}
 
-		do {
-			r = tcdrain(fd);
-		} while ( r < 0 && errno == EINTR);
-		if ( r < 0 ) {
-			term_errno = TERM_EDRAIN;
+		if ( fd < term.size )
+			break;
+
+		sz = term.size ? term.size : TERM_TAB_MIN;
+		while ( sz <= fd ) sz *= 2;
+
+		p = realloc(term.dev, sz * sizeof(*term.dev));
+		if ( ! p ) {
+			term_errno = TERM_EFULL;
 			rval = -1;
 			break;
 		}
+		term.dev = p;
+		for (i = term.size; i < sz; i++)
+			term.dev[i] = NULL;
+
+		term.size = sz;
+	} while (0);
+
+	return rval;
+}
+
+/***************************************************************************/
+
+static struct term_dev_s *
+term_find (int fd)
+{
+	struct term_dev_s *rval;
+
+	do { /* dummy */
+		if ( ! term.init ) {
+			term_errno = TERM_ENOINIT;
+			rval = NULL;
+			break;
+		}
+
+		if ( fd < 0 || fd >= term.size || ! term.dev[fd] ) {
+			term_errno = TERM_ENOTFOUND;
+			rval = NULL;
+			break;
+		}
 
+		rval = term.dev[fd];
 	} while (0);
 
 	return rval;
 }
 
+/* Turn the result of a term_dev_* call into that of a wrapper */
+static int
+term_ret (int r)
+{
+	if ( r < 0 ) {
+		term_errno = -r;
+		return -1;
+	}
+
+	return r;
+}
+
+/***************************************************************************/
+
+/* reset all terms back to their original settings, and remove them */
+static void
+term_reset_all (const char *fname)
+{
+	int r, i;
+
+	for (i = 0; i < term.size; i++) {
+		if ( ! term.dev[i] )
+			continue;
+		r = term_dev_remove(term.dev[i]);
+		if ( r < 0 ) {
+			char *tname;
+
+			tname = ttyname(i);
+			if ( ! tname ) tname = "UNKNOWN";
+			fprintf(stderr, "%s: reset failed for dev %s: %s\n",
+					fname, tname, strerror(errno));
+		}
+		term.dev[i] = NULL;
+	}
+}
+
+static void
+term_exitfunc (void)
+{
+	if ( term.init )
+		term_reset_all(__FUNCTION__);
+}
+
 /***************************************************************************/
 
 int
-term_flush(int fd)
+term_lib_init (void)
 {
-	int rval, r;
+	int rval;
 
 	rval = 0;
 
 	do { /* dummy */
+		if ( term.init ) {
+			term_reset_all(__FUNCTION__);
+		} else {
+			/* initialize term structure. The table is allocated when
+			   the first filedes is added. */
+			term.size = 0;
+			if ( atexit(term_exitfunc) != 0 ) {
+				term_errno = TERM_EATEXIT;
+				rval = -1;
+				break;
+			}
+			/* ok. term struct is now initialized. */
+			term.init = 1;
+		}
+	} while(0);
 
-		r = term_find(fd);
-		if ( r < 0 ) {
+	return rval;
+}
+
+/***************************************************************************/
+
+int
+term_add (int fd)
+{
+	int rval, r, e;
+	struct term_dev_s *t;
+
+	rval = 0;
+
+	do { /* dummy */
+		if ( term_find(fd) ) {
+			term_errno = TERM_EEXISTS;
 			rval = -1;
 			break;
 		}
 
-		r = tcflush(fd, TCIOFLUSH);
+		r = term_grow(fd);
 		if ( r < 0 ) {
 			rval = -1;
 			break;
 		}
 
+		t = term_dev_add(fd, &e);
+		if ( ! t ) {
+			term_errno = e;
+			rval = -1;
+			break;
+		}
+
+		term.dev[fd] = t;
 	} while (0);
 
 	return rval;
@@ -1165,32 +1008,283 @@ term_flush(int fd)
 /***************************************************************************/
 
 int
-term_break(int fd)
+term_remove(int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	term.dev[fd] = NULL;
+
+	return term_ret(term_dev_remove(t));
+}
+
+/***************************************************************************/
+
+int
+term_erase(int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	term.dev[fd] = NULL;
+	term_dev_erase(t);
+
+	return 0;
+}
+
+/***************************************************************************/
+
+int
+term_replace (int oldfd, int newfd)
 {
 	int rval, r;
+	struct term_dev_s *t;
 
 	rval = 0;
 
 	do { /* dummy */
 
-		r = term_find(fd);
+		t = term_find(oldfd);
+		if ( ! t ) {
+			rval = -1;
+			break;
+		}
+		if ( newfd != oldfd && term_find(newfd) ) {
+			term_errno = TERM_EEXISTS;
+			rval = -1;
+			break;
+		}
+
+		r = term_grow(newfd);
 		if ( r < 0 ) {
 			rval = -1;
 			break;
 		}
-	
-		r = tcsendbreak(fd, 0);
+
+		r = term_ret(term_dev_replace(t, newfd));
 		if ( r < 0 ) {
-			term_errno = TERM_EBREAK;
 			rval = -1;
 			break;
 		}
 
+		/* the handle moves to the index of the new filedes */
+		term.dev[oldfd] = NULL;
+		term.dev[newfd] = t;
+
 	} while (0);
 
 	return rval;
 }
 
+/***************************************************************************/
+
+int
+term_reset (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_reset(t));
+}
+
+int
+term_revert (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_revert(t));
+}
+
+int
+term_refresh (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_refresh(t));
+}
+
+int
+term_apply (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_apply(t));
+}
+
+int
+term_set_raw (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_raw(t));
+}
+
+int
+term_set_baudrate (int fd, int baudrate)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_baudrate(t, baudrate));
+}
+
+int
+term_set_parity (int fd, enum parity_e parity)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_parity(t, parity));
+}
+
+int
+term_set_databits (int fd, int databits)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_databits(t, databits));
+}
+
+int
+term_set_flowcntrl (int fd, enum flowcntrl_e flowcntl)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_flowcntrl(t, flowcntl));
+}
+
+int
+term_set_local (int fd, int local)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_local(t, local));
+}
+
+int
+term_set_hupcl (int fd, int on)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_hupcl(t, on));
+}
+
+int
+term_set_vmin_vtime (int fd, int vmin, int vtime)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_set_vmin_vtime(t, vmin, vtime));
+}
+
+/***************************************************************************/
+
+int
+term_set(int fd,
+		 int raw,
+		 int baud, enum parity_e parity, int bits, enum flowcntrl_e fc,
+		 int local, int hup_close)
+{
+	int rval, r, added;
+	struct term_dev_s *t;
+
+	rval = 0;
+
+	do { /* dummy */
+
+		added = 0;
+		t = term_find(fd);
+		if ( ! t ) {
+			r = term_add(fd);
+			if ( r < 0 ) {
+				rval = -1;
+				break;
+			}
+			t = term.dev[fd];
+			added = 1;
+		}
+
+		r = term_ret(term_dev_set(t, raw, baud, parity, bits, fc,
+								  local, hup_close));
+		if ( r < 0 ) {
+			rval = -1;
+			if ( added ) {
+				/* new addition. must be removed */
+				term.dev[fd] = NULL;
+				term_dev_erase(t);
+			}
+		}
+
+	} while (0);
+
+	return rval;
+}
+
+/***************************************************************************/
+
+int
+term_pulse_dtr (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_pulse_dtr(t));
+}
+
+int
+term_raise_dtr (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_raise_dtr(t));
+}
+
+int
+term_lower_dtr (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_lower_dtr(t));
+}
+
+int
+term_drain (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_drain(t));
+}
+
+int
+term_flush (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_flush(t));
+}
+
+int
+term_break (int fd)
+{
+	struct term_dev_s *t;
+
+	if ( ! (t = term_find(fd)) ) return -1;
+	return term_ret(term_dev_break(t));
+}
+
 /**************************************************************************/
 
 /*
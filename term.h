@@ -33,6 +33,20 @@
  * current settings from it and updating currtermios (to catch up with
  * changes made to the device by means outside of this framework).
  *
+ * There is no limit to the number of filedes in the framework. The
+ * settings structures are kept in tables indexed by filedes, which
+ * grow as needed, so finding those of a filedes takes constant time.
+ *
+ * The settings structures of a terminal can also be kept in a handle
+ * ("struct term_dev_s"), returned by term_dev_add(). The "term_dev_*"
+ * functions work like their "term_*" counterparts, on the handle they
+ * are given, and return the error condition (negated) instead of
+ * setting term_errno; they use no global state, so different threads
+ * may each manage their own terminals at the same time. A handle is
+ * not part of the framework: it is not reset at program termination,
+ * and needs no term_lib_init(). The "term_*" functions are built on
+ * top of the handles and are not reentrant.
+ *
  * Interface summary:
  *
  * F term_lib_init  - library initialization
@@ -51,6 +65,7 @@
  * F term_set_flowcntrl - set the flowcntl mode in "nexttermios"
  * F term_set_hupcl - enable or disable hupcl in "nexttermios"
  * F term_set_local - set "nexttermios" to local or non-local mode
+ * F term_set_vmin_vtime - set the read batching params in "nexttermios"
  * F term_set - set all params of "nexttermios" in a single stroke
  * F term_pulse_dtr - pulse the DTR line a device
  * F term_lower_dtr - lower the DTR line of a device
@@ -58,13 +73,19 @@
  * F term_drain - drain the output from the terminal buffer
  * F term_flush - discard terminal input and output queue contents
  * F term_break - generate a break condition on a device
+ * F term_dev_add - create a handle for a filedes
+ * F term_dev_remove - reset the device and release the handle
+ * F term_dev_erase - release the handle without reset
+ * F term_dev_replace - replace the filedes of a handle
+ * F term_dev_fd - return the filedes of a handle
+ * F term_dev_* - handle counterparts of the "term_*" functions
  * F term_strerror - return a string describing current error condition
+ * F term_strerror_r - reentrant version of term_strerror
  * F term_perror - print a string describing the current error condition
  * G term_errno - current error condition of the library
  * E term_errno_e - error condition codes
  * E parity_t - library supported parity types
  * E flocntrl_t - library supported folw-control modes
- * M MAX_TERM - maximum number of fds that can be managed
  *
  * by Nick Patavalis (npat@inaccessnetworks.com)
  *
@@ -92,13 +113,7 @@
 #ifndef TERM_H
 #define TERM_H
 
-/* M MAX_TERMS
- *
- * Maximum nuber of terminals that can be managed by the library. Keep
- * relatively low, since linear searches are used. Reasonable values
- * would be: 16, 32, 64, etc.
- */
-#define MAX_TERMS 16
+#include <stddef.h>
 
 /*
  * E term_errno_e
@@ -130,7 +145,8 @@ enum term_errno_e {
 	TERM_EDTRDOWN,
 	TERM_EDTRUP,
 	TERM_EDRAIN,     /* see errno */
-	TERM_EBREAK
+	TERM_EBREAK,
+	TERM_EVMINVTIME
 };
 
 /* E parity_e
@@ -188,6 +204,16 @@ extern int term_errno;
  */
 const char *term_strerror (int terrnum, int errnum);
 
+/*
+ * F term_strerror_r
+ *
+ * Like term_strerror(), but the string is stored in the buffer "buf"
+ * of "sz" bytes, instead of a static one.
+ *
+ * Returns "buf", or NULL if "terrnum" is not a valid error condition.
+ */
+const char *term_strerror_r (int terrnum, int errnum, char *buf, size_t sz);
+
 /*
  * F term_perror
  *
@@ -436,6 +462,30 @@ int term_set_hupcl (int fd, int on);
  */
 int term_set_local (int fd, int local);
 
+/* F term_set_vmin_vtime
+ *
+ * Sets the VMIN and VTIME parameters in the "nexttermios" structure
+ * associated with the managed filedes "fd" to "vmin" and "vtime"
+ * respectively. The effective settings of the device are not affected
+ * by this function. The parameters only matter in raw (non-canonical)
+ * mode; term_set_raw() sets them to min=1 time=0.
+ *
+ * "vmin" is the number of bytes the driver collects before a read
+ * completes, or the device is reported readable by poll(2) and
+ * friends. "vtime" is in tenths of a second; for a blocking read it
+ * is the inter-byte timeout after which the read completes with fewer
+ * than "vmin" bytes. Pollers are *not* woken-up by this timer, and
+ * (on Linux at least) if "vtime" is non-zero they are woken-up as soon
+ * as a single byte arrives, regardless of "vmin". So event-driven
+ * programs wanting batching should set "vtime" to zero, and implement
+ * the timeout themselves. Both must be in the range 0..255.
+ *
+ * Returns negative on failure, non negative on success. Returns
+ * failure only to indicate invalid arguments, so the return value can
+ * be safely ignored.
+ */
+int term_set_vmin_vtime (int fd, int vmin, int vtime);
+
 /* F temr_set
  *
  * Sets most of the parameters in the "nexttermios" structure
@@ -530,6 +580,88 @@ int term_break(int fd);
 
 /***************************************************************************/
 
+/* T term_dev_s
+ *
+ * Handle of a terminal: the filedes and its settings structures. The
+ * structure is opaque.
+ */
+struct term_dev_s;
+
+/* F term_dev_add
+ *
+ * Create a handle for the filedes "fd", which must be opened on a
+ * terminal device. The settings of the device are read and stored in
+ * the origtermios structure of the handle.
+ *
+ * Returns the handle, or NULL on failure. If "err" is not NULL, the
+ * error condition is stored there (TERM_EOK on success).
+ */
+struct term_dev_s *term_dev_add (int fd, int *err);
+
+/* F term_dev_remove
+ *
+ * Reset the device of the handle "t" to its original settings and
+ * release the handle. The handle is released even if the reset
+ * fails.
+ *
+ * Returns 0 on success, or the error condition negated.
+ */
+int term_dev_remove (struct term_dev_s *t);
+
+/* F term_dev_erase
+ *
+ * Release the handle "t" without resetting its device.
+ */
+void term_dev_erase (struct term_dev_s *t);
+
+/* F term_dev_replace
+ *
+ * Make "newfd" the filedes of the handle "t", and configure its
+ * device with the current settings of the handle; see term_replace().
+ *
+ * Returns 0 on success, or the error condition negated. On failure
+ * the handle keeps its old filedes.
+ */
+int term_dev_replace (struct term_dev_s *t, int newfd);
+
+/* F term_dev_fd
+ *
+ * Returns the filedes of the handle "t".
+ */
+int term_dev_fd (const struct term_dev_s *t);
+
+/* F term_dev_*
+ *
+ * The functions below do for the handle "t" what their "term_*"
+ * counterparts do for a filedes in the framework. They return 0 on
+ * success, or the error condition negated (e.g. -TERM_EBAUD) on
+ * failure; term_errno is not touched.
+ */
+int term_dev_apply (struct term_dev_s *t);
+int term_dev_revert (struct term_dev_s *t);
+int term_dev_reset (struct term_dev_s *t);
+int term_dev_refresh (struct term_dev_s *t);
+int term_dev_set_raw (struct term_dev_s *t);
+int term_dev_set_baudrate (struct term_dev_s *t, int baudrate);
+int term_dev_set_parity (struct term_dev_s *t, enum parity_e parity);
+int term_dev_set_databits (struct term_dev_s *t, int databits);
+int term_dev_set_flowcntrl (struct term_dev_s *t, enum flowcntrl_e flowcntl);
+int term_dev_set_hupcl (struct term_dev_s *t, int on);
+int term_dev_set_local (struct term_dev_s *t, int local);
+int term_dev_set_vmin_vtime (struct term_dev_s *t, int vmin, int vtime);
+int term_dev_set (struct term_dev_s *t,
+				  int raw,
+				  int baud, enum parity_e parity, int bits, enum flowcntrl_e fc,
+				  int local, int hupcl);
+int term_dev_pulse_dtr (struct term_dev_s *t);
+int term_dev_lower_dtr (struct term_dev_s *t);
+int term_dev_raise_dtr (struct term_dev_s *t);
+int term_dev_drain (struct term_dev_s *t);
+int term_dev_flush (struct term_dev_s *t);
+int term_dev_break (struct term_dev_s *t);
+
+/***************************************************************************/
+
 #endif /* of TERM_H */
 
 /***************************************************************************/
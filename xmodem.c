@@ -0,0 +1,904 @@
+/* vi: set sw=4 ts=4:
+ *
+ * xmodem.c
+ *
+ * Built-in XMODEM and YMODEM file transfers.
+ *
+ * Documentation can be found in the header file "xmodem.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "crc.h"
+#include "xmodem.h"
+
+/**********************************************************************/
+
+#define SOH 0x01
+#define STX 0x02
+#define EOT 0x04
+#define ACK 0x06
+#define NAK 0x15
+#define CAN 0x18
+#define SUB 0x1a        /* pads the last block of a file */
+
+/* largest block: header, data, CRC */
+#define XM_BLK_MAX (3 + 1024 + 2)
+/* cancel characters sent to abort */
+#define XM_NCAN 8
+
+/* timeouts, msec */
+#define XM_TMO 10000            /* for an answer */
+#define XM_START_TMO 60000      /* for the receiver to start */
+#define XM_START_IVL 3000       /* between the receiver's 'C's */
+#define XM_PURGE_MS 200         /* of quiet, after a bad block */
+
+/* tries per block */
+#define XM_RETRIES 10
+
+enum xm_state_e {
+	XS_START,       /* sender: waiting for the receiver to ask */
+	XS_HDR,         /* sender: header sent, waiting for its ACK */
+	XS_HDR_START,   /* sender: header acknowledged, waiting for 'C' */
+	XS_DATA,        /* sender: sending the blocks of a file */
+	XS_EOT,         /* sender: EOT sent, waiting for its ACK */
+	XS_FIN,         /* sender: empty header sent, waiting for its ACK */
+	XR_START,       /* receiver: asking for a file */
+	XR_DATA,        /* receiver: waiting for a block */
+	XR_BLOCK,       /* receiver: in a block */
+	XR_PURGE,       /* receiver: after a bad block, waiting for quiet */
+	X_END           /* ended; what is left to send is being queued */
+};
+
+static struct {
+	int open;
+	int send;                   /* sending, else receiving */
+	enum xm_proto_e proto;
+	enum xm_state_e state;
+	int tfd;                    /* timerfd */
+	uint64_t deadline;          /* nsec, of the current wait */
+	int tries;                  /* of the current block */
+	int cans;                   /* consecutive CANs received */
+	unsigned char out[XM_BLK_MAX + 16];     /* to be queued */
+	size_t out_len, out_off;
+	/* sender */
+	char **files;
+	int nfiles;
+	int fidx;                   /* current file */
+	int window;
+	int due;                    /* the header or EOT is to be sent */
+	int crc;                    /* CRC-16, else checksum */
+	size_t bsz;                 /* block size */
+	unsigned char *map;
+	size_t size;
+	time_t mtime;
+	mode_t mode;
+	unsigned long nblk;         /* blocks of the current file */
+	unsigned long next;         /* next block to queue */
+	unsigned long acked;        /* blocks acknowledged */
+	/* receiver */
+	char *dir;
+	int fd;
+	unsigned char blk[XM_BLK_MAX];
+	size_t blen, boff;
+	unsigned char expect;       /* number of the next block */
+	int hdr;                    /* YMODEM: a header is expected */
+	int eot;                    /* YMODEM: an EOT was NAK'ed */
+	unsigned long long fsize;   /* announced size, or ~0 */
+	unsigned long long fdone;   /* bytes written */
+	/* statistics */
+	struct xm_stats_s st;
+	uint64_t t0, t1;
+} xm = { .tfd = -1, .fd = -1 };
+
+static char xm_errbuf[256];
+
+static uint64_t
+xm_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* set the timer for the deadline */
+static void
+xm_settimer (void)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = xm.deadline / 1000000000;
+	its.it_value.tv_nsec = xm.deadline % 1000000000;
+	timerfd_settime(xm.tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* start a wait of "ms" msec */
+static void
+xm_arm (long ms)
+{
+	xm.deadline = xm_now() + (uint64_t)ms * 1000000;
+	xm_settimer();
+}
+
+static void
+xm_put (const void *buff, size_t len)
+{
+	if ( xm.out_off == xm.out_len )
+		xm.out_off = xm.out_len = 0;
+	/* cannot happen: at most a block, and a few characters */
+	if ( len > sizeof(xm.out) - xm.out_len ) return;
+	memcpy(xm.out + xm.out_len, buff, len);
+	xm.out_len += len;
+}
+
+static void
+xm_putc (unsigned char c)
+{
+	xm_put(&c, 1);
+}
+
+/* Put block number "num", with the "len" bytes at "buff", padded with
+   "pad" to 128 bytes, or to 1024 if "len" is larger */
+static void
+xm_block (unsigned char num, const unsigned char *buff, size_t len,
+		  unsigned char pad)
+{
+	unsigned char b[XM_BLK_MAX];
+	unsigned int sum;
+	size_t sz, i;
+	uint16_t c;
+
+	sz = ( len > 128 ) ? 1024 : 128;
+	b[0] = ( sz == 1024 ) ? STX : SOH;
+	b[1] = num;
+	b[2] = ~num;
+	memcpy(b + 3, buff, len);
+	memset(b + 3 + len, pad, sz - len);
+	if ( xm.crc ) {
+		c = crc16(0, b + 3, sz);
+		b[3 + sz] = c >> 8;
+		b[4 + sz] = c & 0xff;
+		xm_put(b, sz + 5);
+	} else {
+		for (sum = 0, i = 0; i < sz; i++)
+			sum += b[3 + i];
+		b[3 + sz] = sum;
+		xm_put(b, sz + 4);
+	}
+}
+
+/* End the transfer, as failed with "why" unless NULL */
+static void
+xm_end (const char *why)
+{
+	if ( xm.state == X_END ) return;
+	xm.st.err = why;
+	xm.state = X_END;
+	xm.t1 = xm_now();
+}
+
+/* Fail with "why", and have the remote side cancel too */
+static void
+xm_fail (const char *why)
+{
+	unsigned char can[XM_NCAN];
+
+	if ( xm.state == X_END ) return;
+	memset(can, CAN, sizeof(can));
+	xm_put(can, sizeof(can));
+	xm_end(why);
+}
+
+/* Fail with the name of file "name", and errno */
+static void
+xm_fail_errno (const char *name)
+{
+	snprintf(xm_errbuf, sizeof(xm_errbuf), "%s: %s", name, strerror(errno));
+	xm_fail(xm_errbuf);
+}
+
+/**********************************************************************/
+
+/* Sender */
+
+static void
+xs_unmap (void)
+{
+	if ( xm.map ) munmap(xm.map, xm.size);
+	xm.map = NULL;
+	xm.size = 0;
+}
+
+/* map the current file */
+static int
+xs_open (void)
+{
+	struct stat st;
+	int fd, e;
+
+	fd = open(xm.files[xm.fidx], O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 ) return -1;
+	if ( fstat(fd, &st) < 0 ) goto fail;
+	if ( ! S_ISREG(st.st_mode) ) { errno = EINVAL; goto fail; }
+
+	xm.size = st.st_size;
+	xm.mtime = st.st_mtime;
+	xm.mode = st.st_mode;
+	if ( xm.size ) {
+		xm.map = mmap(NULL, xm.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( xm.map == MAP_FAILED ) {
+			xm.map = NULL;
+			goto fail;
+		}
+		madvise(xm.map, xm.size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	return 0;
+
+fail:
+	e = errno;
+	close(fd);
+	errno = e;
+	return -1;
+}
+
+/* length of the data in block "n" of the current file */
+static size_t
+xs_blklen (unsigned long n)
+{
+	size_t off = (n - 1) * xm.bsz;
+
+	return ( xm.size - off < xm.bsz ) ? xm.size - off : xm.bsz;
+}
+
+/* Put the header of the current file, or the empty header that ends
+   the batch */
+static void
+xs_header (void)
+{
+	char h[1024];
+	const char *name;
+	int len;
+
+	len = 0;
+	if ( xm.state == XS_HDR ) {
+		name = strrchr(xm.files[xm.fidx], '/');
+		name = name ? name + 1 : xm.files[xm.fidx];
+		len = snprintf(h, sizeof(h), "%s%c%llu %lo %lo", name, 0,
+					   (unsigned long long)xm.size,
+					   (unsigned long)xm.mtime, (unsigned long)xm.mode);
+		/* with its terminating NUL */
+		if ( len < 0 || len >= (int)sizeof(h) ) len = sizeof(h) - 1;
+		len++;
+	}
+	xm_block(0, (unsigned char *)h, len, 0);
+}
+
+/* start the data of the current file, as asked by "c" */
+static void
+xs_data (unsigned char c)
+{
+	xm.crc = ( c == 'C' );
+	xm.bsz = xm.crc ? 1024 : 128;
+	xm.nblk = ( xm.size + xm.bsz - 1 ) / xm.bsz;
+	xm.next = 1;
+	xm.acked = 0;
+	xm.tries = 0;
+	if ( xm.nblk ) {
+		xm.state = XS_DATA;
+	} else {
+		xm.state = XS_EOT;
+		xm.due = 1;
+	}
+}
+
+/* Send the current block (or header, or EOT) again, and, with a
+   window, the ones after it */
+static void
+xs_retry (void)
+{
+	if ( ++xm.tries > XM_RETRIES ) {
+		xm_fail("too many retries");
+		return;
+	}
+	xm.st.retries++;
+	if ( xm.state == XS_DATA )
+		xm.next = xm.acked + 1;
+	else
+		xm.due = 1;
+}
+
+/* Put what is to be sent next, if anything. Returns non-zero if
+   something was put. */
+static int
+xs_next (void)
+{
+	unsigned long n;
+
+	switch ( xm.state ) {
+	case XS_HDR:
+	case XS_FIN:
+		if ( ! xm.due ) return 0;
+		xs_header();
+		break;
+	case XS_EOT:
+		if ( ! xm.due ) return 0;
+		xm_putc(EOT);
+		break;
+	case XS_DATA:
+		n = xm.next;
+		if ( n > xm.nblk || n - 1 - xm.acked >= (unsigned long)xm.window )
+			return 0;
+		xm_block(n & 0xff, xm.map + (n - 1) * xm.bsz, xs_blklen(n), SUB);
+		/* the timeout is for the oldest block not acknowledged */
+		if ( n - 1 == xm.acked ) xm_arm(XM_TMO);
+		xm.next++;
+		return 1;
+	default:
+		return 0;
+	}
+	xm.due = 0;
+	xm_arm(XM_TMO);
+
+	return 1;
+}
+
+static void
+xs_input (unsigned char c)
+{
+	if ( c == CAN ) {
+		if ( ++xm.cans >= 2 ) xm_end("cancelled by the receiver");
+		return;
+	}
+	xm.cans = 0;
+
+	switch ( xm.state ) {
+	case XS_START:
+		if ( c != 'C' && c != NAK ) break;
+		if ( ! xm.t0 ) xm.t0 = xm_now();
+		xm.crc = ( c == 'C' );
+		xm.tries = 0;
+		if ( xm.fidx == xm.nfiles ) {
+			/* YMODEM: end the batch */
+			xm.state = XS_FIN;
+			xm.due = 1;
+			break;
+		}
+		if ( xs_open() < 0 ) {
+			xm_fail_errno(xm.files[xm.fidx]);
+			break;
+		}
+		if ( xm.proto == XM_YMODEM ) {
+			xm.state = XS_HDR;
+			xm.due = 1;
+		} else {
+			xs_data(c);
+		}
+		break;
+	case XS_HDR:
+		if ( c == ACK ) {
+			xm.state = XS_HDR_START;
+			xm_arm(XM_TMO);
+		} else if ( c == NAK ) {
+			xs_retry();
+		}
+		break;
+	case XS_HDR_START:
+		if ( c == 'C' || c == NAK ) xs_data(c);
+		break;
+	case XS_DATA:
+		/* answers when nothing is outstanding are stale */
+		if ( xm.acked + 1 == xm.next ) break;
+		if ( c == ACK ) {
+			xm.acked++;
+			xm.st.bytes += xs_blklen(xm.acked);
+			xm.tries = 0;
+			if ( xm.acked == xm.nblk ) {
+				xm.state = XS_EOT;
+				xm.due = 1;
+			} else if ( xm.acked + 1 < xm.next ) {
+				xm_arm(XM_TMO);
+			}
+		} else if ( c == NAK ) {
+			xs_retry();
+		}
+		break;
+	case XS_EOT:
+		if ( c == ACK ) {
+			xs_unmap();
+			xm.st.files++;
+			xm.fidx++;
+			if ( xm.proto == XM_XMODEM ) {
+				xm_end(NULL);
+			} else {
+				xm.state = XS_START;
+				xm_arm(XM_TMO);
+			}
+		} else if ( c == NAK ) {
+			/* YMODEM receivers NAK the first EOT: not a retry */
+			if ( ++xm.tries > XM_RETRIES )
+				xm_fail("too many retries");
+			else
+				xm.due = 1;
+		}
+		break;
+	case XS_FIN:
+		if ( c == ACK )
+			xm_end(NULL);
+		else if ( c == NAK )
+			xs_retry();
+		break;
+	default:
+		break;
+	}
+}
+
+/**********************************************************************/
+
+/* Receiver */
+
+/* After a bad block: wait for the line to be quiet, then NAK */
+static void
+xr_purge (void)
+{
+	if ( ++xm.tries > XM_RETRIES ) {
+		xm_fail("too many errors");
+		return;
+	}
+	xm.st.retries++;
+	xm.state = XR_PURGE;
+	xm_arm(XM_PURGE_MS);
+}
+
+static int
+xr_write (const unsigned char *buff, size_t len)
+{
+	ssize_t n;
+
+	if ( xm.fsize != ~0ULL && len > xm.fsize - xm.fdone )
+		len = xm.fsize - xm.fdone;
+	xm.fdone += len;
+	xm.st.bytes += len;
+	while ( len ) {
+		n = write(xm.fd, buff, len);
+		if ( n < 0 ) {
+			if ( errno == EINTR ) continue;
+			xm_fail_errno("write");
+			return -1;
+		}
+		buff += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Handle the YMODEM header in the "len" bytes at "buff": create the
+   file, or end the batch if the name is empty. Returns negative if
+   the transfer has failed, or ended. */
+static int
+xr_header (const unsigned char *buff, size_t len)
+{
+	char name[1024 + 1], path[2048];
+	const char *base, *s;
+	char *e;
+	size_t l;
+
+	if ( ! buff[0] ) {
+		xm_putc(ACK);
+		xm_end(NULL);
+		return -1;
+	}
+
+	l = strnlen((const char *)buff, len);
+	memcpy(name, buff, l);
+	name[l] = '\0';
+	base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	if ( ! base[0] || strcmp(base, ".") == 0 || strcmp(base, "..") == 0 ) {
+		xm_fail("bad file name");
+		return -1;
+	}
+
+	xm.fsize = ~0ULL;
+	if ( l + 1 < len ) {
+		s = (const char *)buff + l + 1;
+		xm.fsize = strtoull(s, &e, 10);
+		if ( e == s ) xm.fsize = ~0ULL;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", xm.dir, base);
+	xm.fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if ( xm.fd < 0 ) {
+		xm_fail_errno(path);
+		return -1;
+	}
+	xm.fdone = 0;
+	xm.eot = 0;
+	xm.hdr = 0;
+
+	return 0;
+}
+
+/* handle the block just received */
+static void
+xr_block (void)
+{
+	unsigned char num = xm.blk[1];
+	size_t sz = xm.blen - 5;
+	uint16_t c;
+	int hdr;
+
+	c = crc16(0, xm.blk + 3, sz);
+	if ( (unsigned char)~num != xm.blk[2]
+		 || xm.blk[3 + sz] != ( c >> 8 ) || xm.blk[4 + sz] != ( c & 0xff ) ) {
+		xr_purge();
+		return;
+	}
+
+	hdr = xm.hdr;
+	if ( num == xm.expect ) {
+		if ( hdr ) {
+			if ( xr_header(xm.blk + 3, sz) < 0 ) return;
+		} else {
+			if ( xr_write(xm.blk + 3, sz) < 0 ) return;
+		}
+		xm.expect++;
+		xm.tries = 0;
+	} else if ( ! hdr && num == (unsigned char)(xm.expect - 1) ) {
+		/* our ACK was lost: the block is sent again */
+		hdr = ( xm.proto == XM_YMODEM && num == 0 );
+	} else {
+		xr_purge();
+		return;
+	}
+	xm_putc(ACK);
+	/* ask for the data of the file */
+	if ( hdr ) xm_putc('C');
+	xm.state = XR_DATA;
+	xm_arm(XM_TMO);
+}
+
+/* handle an EOT */
+static void
+xr_eot (void)
+{
+	/* YMODEM: confirm the end of file by having the EOT sent again */
+	if ( xm.proto == XM_YMODEM && ! xm.eot ) {
+		xm.eot = 1;
+		xm_putc(NAK);
+		xm_arm(XM_TMO);
+		return;
+	}
+	xm_putc(ACK);
+	close(xm.fd);
+	xm.fd = -1;
+	xm.st.files++;
+	if ( xm.proto == XM_XMODEM ) {
+		xm_end(NULL);
+		return;
+	}
+	/* ask for the next file */
+	xm.hdr = 1;
+	xm.expect = 0;
+	xm.eot = 0;
+	xm.tries = 0;
+	xm.state = XR_START;
+	xm_putc('C');
+	xm_arm(XM_START_IVL);
+}
+
+/* Returns the number of the "len" bytes at "buff" taken: all of them,
+   unless the transfer ends (after the last EOT, or the empty YMODEM
+   header) */
+static size_t
+xr_input (const unsigned char *buff, size_t len)
+{
+	unsigned char c;
+	size_t n, left;
+
+	for (left = len; left; ) {
+		switch ( xm.state ) {
+		case XR_START:
+		case XR_DATA:
+			c = *buff++;
+			left--;
+			if ( c == CAN ) {
+				if ( ++xm.cans >= 2 ) xm_end("cancelled by the sender");
+				break;
+			}
+			xm.cans = 0;
+			if ( c == SOH || c == STX ) {
+				if ( ! xm.t0 ) xm.t0 = xm_now();
+				xm.blk[0] = c;
+				xm.boff = 1;
+				xm.blen = ( ( c == SOH ) ? 128 : 1024 ) + 5;
+				xm.state = XR_BLOCK;
+			} else if ( c == EOT ) {
+				if ( xm.state == XR_DATA )
+					xr_eot();
+				else if ( xm.hdr && xm.st.files )
+					/* our ACK of the last EOT was lost */
+					xm_putc(ACK);
+			}
+			break;
+		case XR_BLOCK:
+			n = xm.blen - xm.boff;
+			if ( n > left ) n = left;
+			memcpy(xm.blk + xm.boff, buff, n);
+			xm.boff += n;
+			buff += n;
+			left -= n;
+			if ( xm.boff == xm.blen ) xr_block();
+			break;
+		case XR_PURGE:
+			/* the quiet starts after this; the rest is discarded */
+			xm.deadline = xm_now() + (uint64_t)XM_PURGE_MS * 1000000;
+			return len;
+		default:
+			/* ended */
+			return len - left;
+		}
+	}
+
+	return len;
+}
+
+/**********************************************************************/
+
+/* start a transfer */
+static int
+xm_init (enum xm_proto_e proto)
+{
+	if ( xm.open ) { errno = EBUSY; return -1; }
+
+	memset(&xm, 0, sizeof(xm));
+	xm.fd = -1;
+	xm.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if ( xm.tfd < 0 ) return -1;
+	xm.proto = proto;
+	xm.open = 1;
+
+	return 0;
+}
+
+int
+xm_send (enum xm_proto_e proto, char *const files[], int nfiles,
+		 int window)
+{
+	int i;
+
+	if ( nfiles < 1 ) { errno = EINVAL; return -1; }
+	if ( xm_init(proto) < 0 ) return -1;
+
+	if ( proto == XM_XMODEM ) nfiles = 1;
+	xm.files = calloc(nfiles, sizeof(*xm.files));
+	if ( ! xm.files ) goto nomem;
+	xm.nfiles = nfiles;
+	for (i = 0; i < nfiles; i++)
+		if ( ! (xm.files[i] = strdup(files[i])) ) goto nomem;
+	if ( window < 1 ) window = 1;
+	if ( window > XM_WINDOW_MAX ) window = XM_WINDOW_MAX;
+	xm.window = window;
+
+	xm.send = 1;
+	xm.state = XS_START;
+	xm_arm(XM_START_TMO);
+
+	return 0;
+
+nomem:
+	xm_close(NULL);
+	errno = ENOMEM;
+	return -1;
+}
+
+int
+xm_receive (enum xm_proto_e proto, const char *path)
+{
+	int e;
+
+	if ( xm_init(proto) < 0 ) return -1;
+
+	if ( proto == XM_XMODEM ) {
+		xm.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if ( xm.fd < 0 ) goto fail;
+		xm.expect = 1;
+	} else {
+		xm.dir = strdup(( path && path[0] ) ? path : ".");
+		if ( ! xm.dir ) goto fail;
+		xm.hdr = 1;
+		xm.expect = 0;
+	}
+	xm.fsize = ~0ULL;
+
+	xm.state = XR_START;
+	xm_putc('C');
+	xm_arm(XM_START_IVL);
+
+	return 0;
+
+fail:
+	e = errno;
+	xm_close(NULL);
+	errno = e;
+	return -1;
+}
+
+int
+xm_timer_fd (void)
+{
+	return xm.open ? xm.tfd : -1;
+}
+
+void
+xm_tick (void)
+{
+	uint64_t exp;
+
+	if ( ! xm.open ) return;
+	while ( read(xm.tfd, &exp, sizeof(exp)) < 0 && errno == EINTR )
+		/* nothing */ ;
+	if ( xm.state == X_END ) return;
+	/* the deadline may have moved */
+	if ( xm_now() < xm.deadline ) {
+		xm_settimer();
+		return;
+	}
+
+	switch ( xm.state ) {
+	case XS_START:
+	case XS_HDR_START:
+		xm_fail("no answer from the receiver");
+		break;
+	case XS_HDR:
+	case XS_DATA:
+	case XS_EOT:
+	case XS_FIN:
+		xs_retry();
+		xm_arm(XM_TMO);
+		break;
+	case XR_START:
+		if ( ++xm.tries > XM_START_TMO / XM_START_IVL ) {
+			xm_fail("no answer from the sender");
+			break;
+		}
+		xm_putc('C');
+		xm_arm(XM_START_IVL);
+		break;
+	case XR_DATA:
+	case XR_BLOCK:
+		if ( ++xm.tries > XM_RETRIES ) {
+			xm_fail("no answer from the sender");
+			break;
+		}
+		xm.st.retries++;
+		xm.state = XR_DATA;
+		xm_putc(NAK);
+		xm_arm(XM_TMO);
+		break;
+	case XR_PURGE:
+		xm.state = xm.hdr ? XR_START : XR_DATA;
+		xm_putc(NAK);
+		xm_arm(xm.hdr ? XM_START_IVL : XM_TMO);
+		break;
+	default:
+		break;
+	}
+}
+
+size_t
+xm_input (const unsigned char *buff, size_t len)
+{
+	size_t i;
+
+	if ( ! xm.open || xm.state == X_END ) return 0;
+
+	if ( xm.send ) {
+		for (i = 0; i < len && xm.state != X_END; i++)
+			xs_input(buff[i]);
+		return i;
+	}
+
+	return xr_input(buff, len);
+}
+
+int
+xm_fill (struct ring *q)
+{
+	size_t n;
+
+	if ( ! xm.open ) return 0;
+
+	for (;;) {
+		if ( xm.out_off < xm.out_len ) {
+			n = ring_space(q);
+			if ( n > xm.out_len - xm.out_off )
+				n = xm.out_len - xm.out_off;
+			ring_put(q, xm.out + xm.out_off, n);
+			xm.out_off += n;
+			if ( xm.out_off < xm.out_len ) break;
+		}
+		xm.out_off = xm.out_len = 0;
+		if ( xm.state == X_END ) return 0;
+		if ( ! xm.send || ! xs_next() ) break;
+	}
+
+	/* the receiver cannot answer what it has not been sent yet */
+	if ( xm.send && xm.state != XS_START && xm.state != X_END
+		 && ring_len(q) )
+		xm.deadline = xm_now() + (uint64_t)XM_TMO * 1000000;
+
+	return 1;
+}
+
+void
+xm_cancel (void)
+{
+	if ( xm.open ) xm_fail("aborted");
+}
+
+void
+xm_close (struct xm_stats_s *st)
+{
+	int i;
+
+	if ( ! xm.open ) return;
+
+	if ( st ) {
+		*st = xm.st;
+		st->elapsed_ns = 0;
+		if ( xm.t0 )
+			st->elapsed_ns = ( xm.state == X_END ? xm.t1 : xm_now() ) - xm.t0;
+	}
+	xs_unmap();
+	for (i = 0; i < xm.nfiles; i++)
+		free(xm.files[i]);
+	free(xm.files);
+	xm.files = NULL;
+	xm.nfiles = 0;
+	free(xm.dir);
+	xm.dir = NULL;
+	if ( xm.fd >= 0 ) close(xm.fd);
+	xm.fd = -1;
+	if ( xm.tfd >= 0 ) close(xm.tfd);
+	xm.tfd = -1;
+	xm.open = 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
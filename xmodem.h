@@ -0,0 +1,188 @@
+/* vi: set sw=4 ts=4:
+ *
+ * xmodem.h
+ *
+ * Built-in XMODEM and YMODEM file transfers. Files are sent and
+ * received from within the event loop, while picocom keeps the port
+ * and the terminal: no process is spawned, and nothing is reset.
+ *
+ * Principles of operation:
+ *
+ * The protocol is a state machine, driven by three calls from the
+ * loop: xm_input() with the data read from the port, xm_tick() when
+ * the timer returned by xm_timer_fd() is readable (every wait for the
+ * remote side has a timeout), and xm_fill(), which moves what the
+ * machine has to send into the transmit queue of the port (a "struct
+ * ring", see "ring.h"). Nothing blocks.
+ *
+ * Sending: XMODEM sends a single file, YMODEM a batch of files, each
+ * preceded by a header block with its name and size. Blocks of 1024
+ * bytes (XMODEM-1K) are sent, with a CRC-16, if the receiver asks for
+ * CRCs (with 'C'); blocks of 128 bytes with a checksum if it asks for
+ * checksums (with NAK). The last block of a file is sent as a 128-byte
+ * block if the data fit. Files are mapped with mmap(2).
+ *
+ * With a window of one, every block waits for its ACK, as the
+ * protocol says. With a larger window, up to that many blocks are sent
+ * ahead of the ACKs, so that the turnaround of the receiver is not
+ * paid on every block. On a NAK, the sender goes back to the oldest
+ * block not acknowledged, and sends it and the following ones again.
+ * This works with receivers that, after a bad block, ignore what they
+ * receive until the line is quiet, and then NAK (as lrzsz does, and as
+ * the receiver here does); with other receivers, use a window of one.
+ *
+ * Receiving: the receiver asks for CRCs. XMODEM stores the data in the
+ * file given, padding of the last block included. YMODEM creates the
+ * files named by the header blocks (the last component of the name
+ * only) in the directory given, and cuts them to the size announced;
+ * existing files are not overwritten (the transfer fails).
+ *
+ * Timeouts are counted from when the data sent have all left the
+ * queue, so that a slow line, or a large window, does not cause
+ * spurious retries.
+ *
+ * Interface summary:
+ *
+ * F xm_send - start sending files
+ * F xm_receive - start receiving files
+ * F xm_timer_fd - the protocol timer
+ * F xm_tick - handle the protocol timer
+ * F xm_input - handle data received from the port
+ * F xm_fill - queue what there is to send
+ * F xm_cancel - abort the transfer
+ * F xm_close - end the transfer, and get the statistics
+ * T xm_proto_e - protocols
+ * T xm_stats_s - statistics of a transfer
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef XMODEM_H
+#define XMODEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ring.h"
+
+/* largest window accepted: block numbers are sent modulo 256 */
+#define XM_WINDOW_MAX 64
+
+/* T xm_proto_e
+ *
+ * The protocols.
+ */
+enum xm_proto_e {
+	XM_XMODEM,
+	XM_YMODEM
+};
+
+/* T xm_stats_s
+ *
+ * Statistics of a transfer, as filled-in by xm_close() (and by
+ * zm_close() and frecv_close(), see "zmodem.h" and "frecv.h").
+ */
+struct xm_stats_s {
+	int files;                   /* files transferred completely */
+	int skipped;                 /* files refused by the receiver */
+	unsigned long long bytes;    /* of file data, acknowledged */
+	unsigned long retries;       /* blocks sent or requested again */
+	uint64_t elapsed_ns;         /* from the start of the first file */
+	const char *err;             /* why it failed, or NULL */
+	const char *end;             /* how a raw receive ended (frecv.h) */
+};
+
+/* F xm_send
+ *
+ * Start sending the "nfiles" files named in "files" (XMODEM sends
+ * only the first) with protocol "proto", and a window of "window"
+ * blocks. The names are copied. The receiver is waited for, for a
+ * minute.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success. Files that cannot be read make the transfer fail later.
+ */
+int xm_send (enum xm_proto_e proto, char *const files[], int nfiles,
+			 int window);
+
+/* F xm_receive
+ *
+ * Start receiving with protocol "proto": with XMODEM, into file
+ * "path" (created, or truncated), with YMODEM, into directory "path"
+ * (the current one if NULL or empty).
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int xm_receive (enum xm_proto_e proto, const char *path);
+
+/* F xm_timer_fd
+ *
+ * Returns the filedes of the protocol timer, to be watched for
+ * reading by the caller, or negative if no transfer is in progress.
+ */
+int xm_timer_fd (void);
+
+/* F xm_tick
+ *
+ * Called when the protocol timer is readable: handles the timeouts.
+ */
+void xm_tick (void);
+
+/* F xm_input
+ *
+ * Handle the "len" bytes at "buff", received from the port.
+ *
+ * Returns the number of bytes taken. Fewer than "len" are taken once
+ * the transfer has ended: the rest are not part of it.
+ */
+size_t xm_input (const unsigned char *buff, size_t len);
+
+/* F xm_fill
+ *
+ * Copy what there is to send to ring "q", as much as it has room for.
+ *
+ * Returns 1 while the transfer is in progress, 0 once it has ended
+ * (successfully or not; see xm_close) and all there was to send has
+ * been queued.
+ */
+int xm_fill (struct ring *q);
+
+/* F xm_cancel
+ *
+ * Abort the transfer: the remote side is sent cancel characters (by
+ * xm_fill), and the transfer fails.
+ */
+void xm_cancel (void);
+
+/* F xm_close
+ *
+ * End the transfer, and release its resources. If "st" is not NULL,
+ * the statistics of the transfer are stored there.
+ */
+void xm_close (struct xm_stats_s *st);
+
+#endif /* of XMODEM_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
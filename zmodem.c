@@ -0,0 +1,1398 @@
+/* vi: set sw=4 ts=4:
+ *
+ * zmodem.c
+ *
+ * Built-in ZMODEM file transfers.
+ *
+ * Documentation can be found in the header file "zmodem.h".
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "crc.h"
+#include "zmodem.h"
+
+/**********************************************************************/
+
+#define ZPAD '*'
+#define ZDLE 0x18       /* escapes; also CAN */
+#define ZBIN 'A'        /* binary header, CRC-16 */
+#define ZHEX 'B'        /* hex header */
+#define ZBIN32 'C'      /* binary header, CRC-32 */
+#define XON 0x11
+#define XOFF 0x13
+#define BS 0x08
+
+/* frame types */
+#define ZRQINIT 0
+#define ZRINIT 1
+#define ZSINIT 2
+#define ZACK 3
+#define ZFILE 4
+#define ZSKIP 5
+#define ZNAK 6
+#define ZABORT 7
+#define ZFIN 8
+#define ZRPOS 9
+#define ZDATA 10
+#define ZEOF 11
+#define ZFERR 12
+#define ZCAN 16
+
+/* ends of data subpackets */
+#define ZCRCE 'h'       /* end of frame, header follows */
+#define ZCRCG 'i'       /* frame continues */
+#define ZCRCQ 'j'       /* frame continues, ZACK expected */
+#define ZCRCW 'k'       /* end of frame, ZACK expected */
+#define ZRUB0 'l'       /* escaped 0x7f */
+#define ZRUB1 'm'       /* escaped 0xff */
+
+/* header bytes: positions are ZP0 (low) to ZP3, flags ZF3 to ZF0 */
+#define ZF0 3
+/* ZRINIT flags, in ZF0 */
+#define CANFDX 0x01
+#define CANOVIO 0x02
+#define CANFC32 0x20
+#define ESCCTL 0x40
+/* ZFILE conversion, in ZF0 */
+#define ZCBIN 1
+#define ZCRESUM 3
+
+/* data per subpacket, sent; largest accepted */
+#define ZM_SUB 1024
+#define ZM_SUB_MAX 8192
+/* cancel characters sent to abort (then as many backspaces) */
+#define ZM_NCAN 10
+/* consecutive CANs that cancel */
+#define ZM_CANS 5
+
+/* timeouts, msec */
+#define ZM_TMO 10000            /* for an answer */
+#define ZM_START_TMO 60000      /* for the other side to start */
+#define ZM_START_IVL 3000       /* between ZRINITs, or ZRQINITs */
+#define ZM_OO_MS 1000           /* for the "OO" that ends a session */
+#define ZM_QUIET_MS 2000        /* for ZFILE to be answered, after ZRINIT */
+
+/* tries per header, or position */
+#define ZM_RETRIES 10
+
+enum zm_state_e {
+	ZS_START,       /* sender: waiting for ZRINIT */
+	ZS_FILE,        /* sender: ZFILE sent, waiting for ZRPOS */
+	ZS_DATA,        /* sender: streaming the data of a file */
+	ZS_ACK,         /* sender: end of a segment sent, waiting for ZACK */
+	ZS_EOF,         /* sender: ZEOF sent, waiting for ZRINIT */
+	ZS_FIN,         /* sender: ZFIN sent, waiting for ZFIN */
+	ZR_INIT,        /* receiver: ZRINIT sent, waiting for a file */
+	ZR_POS,         /* receiver: waiting for data, at a position */
+	ZR_DATA,        /* receiver: in the data of a file */
+	ZR_OO,          /* receiver: ZFIN sent, waiting for "OO" */
+	Z_END           /* ended; what is left to send is being queued */
+};
+
+/* what the reader is doing */
+enum zm_rd_e {
+	RD_SEEK,        /* looking for a header */
+	RD_PAD,         /* after ZPAD */
+	RD_FRAME,       /* after ZPAD ZDLE */
+	RD_BIN,         /* in a binary header */
+	RD_HEX,         /* in a hex header */
+	RD_DATA,        /* in a data subpacket */
+	RD_CRC          /* in the CRC of a data subpacket */
+};
+
+/* results of zm_unesc(), besides bytes */
+#define ZM_NONE (-1)            /* nothing yet */
+#define ZM_BAD (-2)             /* bad escape */
+#define ZM_GOT 0x100            /* or'ed with the end of a subpacket */
+
+static struct {
+	int open;
+	int send;                   /* sending, else receiving */
+	enum zm_state_e state;
+	int tfd;                    /* timerfd */
+	uint64_t deadline;          /* nsec, of the current wait */
+	int tries;                  /* of the current header, or position */
+	int cans;                   /* consecutive CANs received */
+	unsigned char out[4 * ZM_SUB];      /* to be queued */
+	size_t out_len, out_off;
+	int flush;                  /* drop what is queued */
+	/* reader */
+	enum zm_rd_e rd;
+	int esc;                    /* after ZDLE */
+	int hcrc32;                 /* the header being read has CRC-32 */
+	int rxcrc32;                /* subpackets received have CRC-32 */
+	unsigned char hbuf[16];     /* header being read: type, data, CRC */
+	int hlen;                   /* bytes, or hex digits, in "hbuf" */
+	int subtype;                /* header the subpacket belongs to */
+	unsigned char sub[ZM_SUB_MAX];      /* data subpacket being read */
+	size_t sublen;
+	int subend;                 /* how it ended */
+	/* sender */
+	char **files;
+	int nfiles;
+	int fidx;                   /* current file */
+	int txcrc32;                /* send CRC-32 */
+	int escctl;                 /* escape all control characters */
+	unsigned char last;         /* last character sent */
+	unsigned long rxbuf;        /* receiver's buffer, or 0: streaming */
+	unsigned long seg;          /* sent since the last ZACK */
+	unsigned char *map;
+	size_t size;
+	time_t mtime;
+	mode_t mode;
+	unsigned long pos;          /* next byte to send */
+	unsigned long start;        /* first position asked for */
+	unsigned long lastpos;      /* position of the last ZRPOS */
+	/* receiver */
+	char *dir;
+	int fd;
+	int zconv;                  /* ZFILE conversion asked */
+	unsigned long rxpos;        /* bytes of the file written */
+	time_t rxmtime;             /* sent, or 0 */
+	int oo;                     /* 'O's of the final "OO" */
+	/* statistics */
+	struct xm_stats_s st;
+	uint64_t t0, t1;
+} zm = { .tfd = -1, .fd = -1 };
+
+static char zm_errbuf[256];
+
+/* characters to be escaped: 1 always, 2 after '@' */
+static unsigned char zm_esctab[256];
+
+static uint64_t
+zm_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* set the timer for the deadline */
+static void
+zm_settimer (void)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = zm.deadline / 1000000000;
+	its.it_value.tv_nsec = zm.deadline % 1000000000;
+	timerfd_settime(zm.tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* start a wait of "ms" msec */
+static void
+zm_arm (long ms)
+{
+	zm.deadline = zm_now() + (uint64_t)ms * 1000000;
+	zm_settimer();
+}
+
+static void
+zm_put (const void *buff, size_t len)
+{
+	if ( zm.out_off == zm.out_len )
+		zm.out_off = zm.out_len = 0;
+	/* cannot happen: at most a subpacket, and a header */
+	if ( len > sizeof(zm.out) - zm.out_len ) return;
+	memcpy(zm.out + zm.out_len, buff, len);
+	zm.out_len += len;
+}
+
+static void
+zm_mkesctab (void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		zm_esctab[i] = 0;
+		/* printable characters are never escaped */
+		if ( i & 0x60 ) continue;
+		switch ( i ) {
+		case ZDLE:
+		case 0x10: case 0x90:
+		case XON: case XON | 0x80:
+		case XOFF: case XOFF | 0x80:
+			zm_esctab[i] = 1;
+			break;
+		case '\r': case '\r' | 0x80:
+			/* "@\r" is an escape sequence of some modems */
+			zm_esctab[i] = zm.escctl ? 1 : 2;
+			break;
+		default:
+			zm_esctab[i] = zm.escctl;
+			break;
+		}
+	}
+}
+
+/* Escape the "len" bytes at "buff" into "o", which must have room for
+   twice as many. Returns the number of bytes stored. */
+static size_t
+zm_esc (unsigned char *o, const unsigned char *buff, size_t len)
+{
+	unsigned char *p = o;
+	unsigned char c;
+
+	while ( len-- ) {
+		c = *buff++;
+		if ( zm_esctab[c]
+			 && ( zm_esctab[c] == 1 || ( zm.last & 0x7f ) == '@' ) ) {
+			*p++ = ZDLE;
+			c ^= 0x40;
+		}
+		*p++ = zm.last = c;
+	}
+
+	return p - o;
+}
+
+/* header data for position "pos" */
+static void
+zm_poshdr (unsigned char *h, unsigned long pos)
+{
+	h[0] = pos;
+	h[1] = pos >> 8;
+	h[2] = pos >> 16;
+	h[3] = pos >> 24;
+}
+
+static unsigned long
+zm_hdrpos (const unsigned char *h)
+{
+	return h[0] | h[1] << 8 | h[2] << 16 | (unsigned long)h[3] << 24;
+}
+
+/* Put a hex header, of type "type", with data "h" */
+static void
+zm_hexhdr (int type, const unsigned char *h)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned char b[7], s[32];
+	uint16_t c;
+	int n, i;
+
+	b[0] = type;
+	memcpy(b + 1, h, 4);
+	c = crc16(0, b, 5);
+	b[5] = c >> 8;
+	b[6] = c & 0xff;
+
+	n = 0;
+	s[n++] = ZPAD;
+	s[n++] = ZPAD;
+	s[n++] = ZDLE;
+	s[n++] = ZHEX;
+	for (i = 0; i < 7; i++) {
+		s[n++] = hex[b[i] >> 4];
+		s[n++] = hex[b[i] & 0xf];
+	}
+	s[n++] = '\r';
+	s[n++] = '\n' | 0x80;
+	/* in case the other side was stopped by an XOFF in the noise */
+	if ( type != ZFIN && type != ZACK ) s[n++] = XON;
+	zm_put(s, n);
+	zm.last = s[n - 1];
+}
+
+/* Put a hex header for position "pos" */
+static void
+zm_hexpos (int type, unsigned long pos)
+{
+	unsigned char h[4];
+
+	zm_poshdr(h, pos);
+	zm_hexhdr(type, h);
+}
+
+/* Put a binary header, of type "type", with data "h", and the CRC the
+   receiver asked for */
+static void
+zm_binhdr (int type, const unsigned char *h)
+{
+	unsigned char b[9], s[3 + 2 * 9];
+	uint32_t c;
+	int n, len;
+
+	b[0] = type;
+	memcpy(b + 1, h, 4);
+	if ( zm.txcrc32 ) {
+		c = crc32(0, b, 5);
+		b[5] = c;
+		b[6] = c >> 8;
+		b[7] = c >> 16;
+		b[8] = c >> 24;
+		len = 9;
+	} else {
+		c = crc16(0, b, 5);
+		b[5] = c >> 8;
+		b[6] = c & 0xff;
+		len = 7;
+	}
+
+	n = 0;
+	s[n++] = ZPAD;
+	s[n++] = ZDLE;
+	s[n++] = zm.txcrc32 ? ZBIN32 : ZBIN;
+	zm.last = s[n - 1];
+	n += zm_esc(s + n, b, len);
+	zm_put(s, n);
+}
+
+/* Put a data subpacket, with the "len" bytes at "buff", and end "end" */
+static void
+zm_subpkt (const unsigned char *buff, size_t len, int end)
+{
+	unsigned char s[2 * ZM_SUB + 16], b[4], e = end;
+	uint32_t c;
+	size_t n;
+
+	n = zm_esc(s, buff, len);
+	s[n++] = ZDLE;
+	s[n++] = zm.last = e;
+	if ( zm.txcrc32 ) {
+		c = crc32(crc32(0, buff, len), &e, 1);
+		b[0] = c;
+		b[1] = c >> 8;
+		b[2] = c >> 16;
+		b[3] = c >> 24;
+		n += zm_esc(s + n, b, 4);
+	} else {
+		c = crc16(crc16(0, buff, len), &e, 1);
+		b[0] = c >> 8;
+		b[1] = c & 0xff;
+		n += zm_esc(s + n, b, 2);
+	}
+	if ( end == ZCRCW ) s[n++] = zm.last = XON;
+	zm_put(s, n);
+}
+
+/* End the transfer, as failed with "why" unless NULL */
+static void
+zm_end (const char *why)
+{
+	if ( zm.state == Z_END ) return;
+	zm.st.err = why;
+	zm.state = Z_END;
+	zm.t1 = zm_now();
+}
+
+/* Fail with "why", and have the remote side cancel too */
+static void
+zm_fail (const char *why)
+{
+	unsigned char can[2 * ZM_NCAN];
+
+	if ( zm.state == Z_END ) return;
+	memset(can, ZDLE, ZM_NCAN);
+	memset(can + ZM_NCAN, BS, ZM_NCAN);
+	zm_put(can, sizeof(can));
+	zm_end(why);
+}
+
+/* Fail with the name of file "name", and errno */
+static void
+zm_fail_errno (const char *name)
+{
+	snprintf(zm_errbuf, sizeof(zm_errbuf), "%s: %s", name, strerror(errno));
+	zm_fail(zm_errbuf);
+}
+
+/**********************************************************************/
+
+/* Sender */
+
+static void
+zs_unmap (void)
+{
+	if ( zm.map ) munmap(zm.map, zm.size);
+	zm.map = NULL;
+	zm.size = 0;
+}
+
+/* map the current file */
+static int
+zs_open (void)
+{
+	struct stat st;
+	int fd, e;
+
+	fd = open(zm.files[zm.fidx], O_RDONLY | O_CLOEXEC);
+	if ( fd < 0 ) return -1;
+	if ( fstat(fd, &st) < 0 ) goto fail;
+	if ( ! S_ISREG(st.st_mode) ) { errno = EINVAL; goto fail; }
+	if ( st.st_size > 0xffffffffL ) { errno = EFBIG; goto fail; }
+
+	zm.size = st.st_size;
+	zm.mtime = st.st_mtime;
+	zm.mode = st.st_mode;
+	if ( zm.size ) {
+		zm.map = mmap(NULL, zm.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( zm.map == MAP_FAILED ) {
+			zm.map = NULL;
+			goto fail;
+		}
+		madvise(zm.map, zm.size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	return 0;
+
+fail:
+	e = errno;
+	close(fd);
+	errno = e;
+	return -1;
+}
+
+/* Put ZFILE, with the name and size of the current file */
+static void
+zs_file (void)
+{
+	unsigned char h[4] = { 0, 0, 0, ZCBIN };
+	char info[1024];
+	const char *name;
+	int len;
+
+	name = strrchr(zm.files[zm.fidx], '/');
+	name = name ? name + 1 : zm.files[zm.fidx];
+	len = snprintf(info, sizeof(info), "%s%c%lu %lo %lo 0 %d", name, 0,
+				   (unsigned long)zm.size, (unsigned long)zm.mtime,
+				   (unsigned long)zm.mode, zm.nfiles - zm.fidx);
+	/* with its terminating NUL */
+	if ( len < 0 || len >= (int)sizeof(info) ) len = sizeof(info) - 1;
+	len++;
+
+	zm_binhdr(ZFILE, h);
+	zm_subpkt((unsigned char *)info, len, ZCRCW);
+	zm.state = ZS_FILE;
+	zm_arm(ZM_TMO);
+}
+
+/* Start the next file, or end the session if there is none */
+static void
+zs_next_file (void)
+{
+	unsigned char h[4] = { 0, 0, 0, 0 };
+
+	zs_unmap();
+	zm.tries = 0;
+	if ( zm.fidx == zm.nfiles ) {
+		zm_hexhdr(ZFIN, h);
+		zm.state = ZS_FIN;
+		zm_arm(ZM_TMO);
+		return;
+	}
+	if ( zs_open() < 0 ) {
+		zm_fail_errno(zm.files[zm.fidx]);
+		return;
+	}
+	zs_file();
+}
+
+/* Send the current file from position "pos": what is queued is dropped */
+static void
+zs_seek (unsigned long pos)
+{
+	unsigned char h[4];
+
+	zm.out_off = zm.out_len = 0;
+	zm.flush = 1;
+	if ( pos > zm.size ) pos = zm.size;
+	zm.pos = pos;
+	zm.seg = 0;
+	zm_poshdr(h, pos);
+	if ( pos < zm.size ) {
+		zm_binhdr(ZDATA, h);
+		zm.state = ZS_DATA;
+	} else {
+		zm_binhdr(ZEOF, h);
+		zm.state = ZS_EOF;
+		zm_arm(ZM_TMO);
+	}
+}
+
+/* Put the next subpacket of the current file, if it is being sent.
+   Returns non-zero if something was put. */
+static int
+zs_next (void)
+{
+	unsigned char h[4];
+	size_t n;
+	int end;
+
+	if ( zm.state != ZS_DATA ) return 0;
+
+	n = zm.size - zm.pos;
+	if ( n > ZM_SUB ) n = ZM_SUB;
+	if ( zm.pos + n == zm.size )
+		end = ZCRCE;
+	else if ( zm.rxbuf && zm.seg + n >= zm.rxbuf )
+		end = ZCRCW;
+	else
+		end = ZCRCG;
+	zm_subpkt(zm.map + zm.pos, n, end);
+	zm.pos += n;
+	zm.seg += n;
+
+	if ( end == ZCRCE ) {
+		zm_poshdr(h, zm.pos);
+		zm_binhdr(ZEOF, h);
+		zm.state = ZS_EOF;
+		zm_arm(ZM_TMO);
+	} else if ( end == ZCRCW ) {
+		zm.state = ZS_ACK;
+		zm_arm(ZM_TMO);
+	}
+
+	return 1;
+}
+
+/* Try again what was waited for */
+static void
+zs_retry (void)
+{
+	unsigned char h[4] = { 0, 0, 0, 0 };
+
+	if ( ++zm.tries > ZM_RETRIES ) {
+		zm_fail("too many retries");
+		return;
+	}
+	zm.st.retries++;
+	switch ( zm.state ) {
+	case ZS_FILE:
+		zs_file();
+		break;
+	case ZS_ACK:
+	case ZS_EOF:
+		/* where the receiver is, the data frame tells it */
+		zs_seek(zm.pos);
+		break;
+	case ZS_FIN:
+		zm_hexhdr(ZFIN, h);
+		zm_arm(ZM_TMO);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+zs_header (int type, const unsigned char *h)
+{
+	unsigned long pos;
+
+	switch ( type ) {
+	case ZRINIT:
+		if ( zm.state == ZS_START ) {
+			zm.t0 = zm_now();
+			zm.rxbuf = h[0] | h[1] << 8;
+			zm.txcrc32 = ( h[ZF0] & CANFC32 ) != 0;
+			if ( h[ZF0] & ESCCTL ) {
+				zm.escctl = 1;
+				zm_mkesctab();
+			}
+			/* a receiver that cannot overlap I/O gets segments */
+			if ( ! ( h[ZF0] & CANOVIO ) && ! zm.rxbuf ) zm.rxbuf = ZM_SUB;
+			zs_next_file();
+		} else if ( zm.state == ZS_EOF ) {
+			zm.st.files++;
+			zm.st.bytes += zm.size - zm.start;
+			zm.fidx++;
+			zs_next_file();
+		} else if ( zm.state == ZS_FIN ) {
+			/* our ZFIN was not seen */
+			zs_retry();
+		} else if ( zm.state == ZS_FILE ) {
+			/* an answer to our ZRQINIT, or our ZFILE was not seen:
+			   sent again once the line is quiet, if not answered */
+			if ( zm.deadline > zm_now() + (uint64_t)ZM_QUIET_MS * 1000000 )
+				zm_arm(ZM_QUIET_MS);
+		}
+		break;
+	case ZRPOS:
+		pos = zm_hdrpos(h);
+		if ( zm.state == ZS_FILE ) {
+			zm.start = zm.lastpos = pos;
+			zm.tries = 0;
+			zs_seek(pos);
+		} else if ( zm.state == ZS_DATA || zm.state == ZS_ACK
+					|| zm.state == ZS_EOF ) {
+			/* the same position again: no progress */
+			if ( pos == zm.lastpos ) {
+				if ( ++zm.tries > ZM_RETRIES ) {
+					zm_fail("too many retries");
+					break;
+				}
+			} else {
+				zm.tries = 0;
+			}
+			zm.lastpos = pos;
+			zm.st.retries++;
+			zs_seek(pos);
+		}
+		break;
+	case ZACK:
+		if ( zm.state == ZS_ACK && zm_hdrpos(h) == zm.pos ) {
+			zm.tries = 0;
+			zs_seek(zm.pos);
+		}
+		break;
+	case ZSKIP:
+		if ( zm.state == ZS_FILE || zm.state == ZS_DATA
+			 || zm.state == ZS_ACK || zm.state == ZS_EOF ) {
+			zm.flush = 1;
+			zm.out_off = zm.out_len = 0;
+			zm.st.skipped++;
+			zm.fidx++;
+			zs_next_file();
+		}
+		break;
+	case ZNAK:
+		if ( zm.state == ZS_FILE || zm.state == ZS_FIN ) zs_retry();
+		break;
+	case ZFIN:
+		if ( zm.state == ZS_FIN ) {
+			zm_put("OO", 2);
+			zm_end(NULL);
+		}
+		break;
+	case ZABORT:
+	case ZFERR:
+	case ZCAN:
+		zm_end("cancelled by the receiver");
+		break;
+	default:
+		break;
+	}
+}
+
+/**********************************************************************/
+
+/* Receiver */
+
+static void
+zr_rinit (void)
+{
+	unsigned char h[4] = { 0, 0, 0, CANFDX | CANOVIO | CANFC32 };
+
+	zm_hexhdr(ZRINIT, h);
+}
+
+/* Ask for the data of the current file from where it is, after an
+   error; "err" is 0 when there was none */
+static void
+zr_rpos (int err)
+{
+	if ( err ) {
+		if ( ++zm.tries > ZM_RETRIES ) {
+			zm_fail("too many errors");
+			return;
+		}
+		zm.st.retries++;
+	}
+	zm_hexpos(ZRPOS, zm.rxpos);
+	zm.state = ZR_POS;
+	zm.rd = RD_SEEK;
+	zm_arm(ZM_TMO);
+}
+
+/* Handle the ZFILE information in the subpacket: create the file, or
+   open it to resume it, or skip it */
+static void
+zr_file (void)
+{
+	char info[ZM_SUB_MAX + 1], path[PATH_MAX + 1];
+	unsigned long long fsize;
+	const char *base, *s;
+	struct stat st;
+	char *e;
+	size_t l;
+
+	/* the name, then the fields after its NUL; the sender may leave
+	   off the NUL that ends them */
+	memcpy(info, zm.sub, zm.sublen);
+	info[zm.sublen] = '\0';
+	l = strlen(info);
+	base = strrchr(info, '/');
+	base = base ? base + 1 : info;
+	if ( ! base[0] || strcmp(base, ".") == 0 || strcmp(base, "..") == 0 ) {
+		zm_fail("bad file name");
+		return;
+	}
+
+	fsize = ~0ULL;
+	zm.rxmtime = 0;
+	if ( l < zm.sublen ) {
+		s = info + l + 1;
+		fsize = strtoull(s, &e, 10);
+		if ( e == s ) fsize = ~0ULL;
+		else zm.rxmtime = strtoul(e, NULL, 8);
+	}
+
+	if ( snprintf(path, sizeof(path), "%s/%s", zm.dir, base)
+		 >= (int)sizeof(path) ) {
+		errno = ENAMETOOLONG;
+		zm_fail_errno(base);
+		return;
+	}
+	zm.rxpos = 0;
+	zm.fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if ( zm.fd < 0 && errno == EEXIST && zm.zconv == ZCRESUM ) {
+		/* crash recovery: go on from where the last transfer stopped */
+		zm.fd = open(path, O_WRONLY | O_CLOEXEC);
+		if ( zm.fd >= 0 ) {
+			if ( fstat(zm.fd, &st) < 0 ) {
+				zm_fail_errno(path);
+				return;
+			}
+			if ( ! S_ISREG(st.st_mode) || st.st_size > 0xffffffffL
+				 || (unsigned long long)st.st_size >= fsize ) {
+				close(zm.fd);
+				zm.fd = -1;
+				errno = EEXIST;
+			} else {
+				zm.rxpos = lseek(zm.fd, 0, SEEK_END);
+			}
+		}
+	}
+	if ( zm.fd < 0 ) {
+		if ( errno != EEXIST ) {
+			zm_fail_errno(path);
+			return;
+		}
+		zm.st.skipped++;
+		zm_hexpos(ZSKIP, 0);
+		zm.state = ZR_INIT;
+		zm_arm(ZM_TMO);
+		return;
+	}
+	zm.tries = 0;
+	zr_rpos(0);
+}
+
+/* End of the current file */
+static void
+zr_eof (void)
+{
+	struct timespec ts[2];
+
+	if ( zm.rxmtime ) {
+		ts[0].tv_sec = 0;
+		ts[0].tv_nsec = UTIME_OMIT;
+		ts[1].tv_sec = zm.rxmtime;
+		ts[1].tv_nsec = 0;
+		futimens(zm.fd, ts);
+	}
+	close(zm.fd);
+	zm.fd = -1;
+	zm.st.files++;
+	zm.tries = 0;
+	zm.state = ZR_INIT;
+	zr_rinit();
+	zm_arm(ZM_TMO);
+}
+
+static void
+zr_header (int type, const unsigned char *h)
+{
+	unsigned char z[4] = { 0, 0, 0, 0 };
+
+	switch ( type ) {
+	case ZRQINIT:
+		if ( zm.state == ZR_INIT ) zr_rinit();
+		break;
+	case ZSINIT:
+	case ZFILE:
+		/* a data subpacket follows */
+		if ( ! zm.t0 ) zm.t0 = zm_now();
+		zm.zconv = h[ZF0];
+		zm.subtype = type;
+		zm.rd = RD_DATA;
+		zm.sublen = 0;
+		break;
+	case ZDATA:
+		if ( zm.state != ZR_POS && zm.state != ZR_DATA ) break;
+		if ( zm_hdrpos(h) != zm.rxpos ) {
+			zr_rpos(1);
+			break;
+		}
+		zm.state = ZR_DATA;
+		zm.subtype = ZDATA;
+		zm.rd = RD_DATA;
+		zm.sublen = 0;
+		break;
+	case ZEOF:
+		/* at another position, it was sent before our ZRPOS was seen:
+		   the data frame that answers it is waited for */
+		if ( ( zm.state == ZR_POS || zm.state == ZR_DATA )
+			 && zm_hdrpos(h) == zm.rxpos )
+			zr_eof();
+		break;
+	case ZFIN:
+		if ( zm.state == ZR_INIT || zm.state == ZR_OO ) {
+			zm_hexhdr(ZFIN, z);
+			zm.state = ZR_OO;
+			zm_arm(ZM_OO_MS);
+		}
+		break;
+	case ZABORT:
+	case ZFERR:
+	case ZCAN:
+		zm_end("cancelled by the sender");
+		break;
+	default:
+		break;
+	}
+}
+
+/* Handle the data subpacket just read, "ok" if its CRC was right */
+static void
+zr_subpkt (int ok)
+{
+	unsigned char z[4] = { 0, 0, 0, 0 };
+	const unsigned char *p;
+	size_t len;
+	ssize_t n;
+
+	switch ( zm.subtype ) {
+	case ZSINIT:
+		/* the attention string is not used */
+		zm_hexhdr(ok ? ZACK : ZNAK, z);
+		break;
+	case ZFILE:
+		if ( ! ok )
+			zm_hexhdr(ZNAK, z);
+		else if ( zm.state == ZR_INIT )
+			zr_file();
+		else if ( zm.state == ZR_POS || zm.state == ZR_DATA )
+			/* our ZRPOS was not seen */
+			zr_rpos(0);
+		break;
+	case ZDATA:
+		if ( ! ok ) {
+			zr_rpos(1);
+			break;
+		}
+		p = zm.sub;
+		len = zm.sublen;
+		while ( len ) {
+			n = write(zm.fd, p, len);
+			if ( n < 0 ) {
+				if ( errno == EINTR ) continue;
+				zm_fail_errno("write");
+				return;
+			}
+			p += n;
+			len -= n;
+		}
+		zm.rxpos += zm.sublen;
+		zm.st.bytes += zm.sublen;
+		zm.tries = 0;
+		switch ( zm.subend ) {
+		case ZCRCG:
+			zm.rd = RD_DATA;
+			zm.sublen = 0;
+			break;
+		case ZCRCQ:
+			zm_hexpos(ZACK, zm.rxpos);
+			zm.rd = RD_DATA;
+			zm.sublen = 0;
+			break;
+		case ZCRCW:
+			zm_hexpos(ZACK, zm.rxpos);
+			/* fall through */
+		default:
+			/* a header follows */
+			zm.state = ZR_POS;
+			break;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**********************************************************************/
+
+/* Reader: splits what is received into headers and data subpackets */
+
+/* Decode "c" of the escaped stream of a binary header or subpacket */
+static int
+zm_unesc (unsigned char c)
+{
+	if ( ! zm.esc ) {
+		if ( c != ZDLE ) return c;
+		zm.esc = 1;
+		return ZM_NONE;
+	}
+	/* CANs are counted by the caller */
+	if ( c == ZDLE ) return ZM_NONE;
+	zm.esc = 0;
+	switch ( c ) {
+	case ZCRCE:
+	case ZCRCG:
+	case ZCRCQ:
+	case ZCRCW:
+		return ZM_GOT | c;
+	case ZRUB0:
+		return 0x7f;
+	case ZRUB1:
+		return 0xff;
+	default:
+		if ( ( c & 0x60 ) == 0x40 ) return c ^ 0x40;
+		return ZM_BAD;
+	}
+}
+
+static void
+zm_header (void)
+{
+	zm.rd = RD_SEEK;
+	zm.esc = 0;
+	if ( zm.send )
+		zs_header(zm.hbuf[0], zm.hbuf + 1);
+	else
+		zr_header(zm.hbuf[0], zm.hbuf + 1);
+}
+
+/* a header with a bad CRC, or badly escaped */
+static void
+zm_header_bad (void)
+{
+	zm.rd = RD_SEEK;
+	zm.esc = 0;
+	/* the sender has timeouts; the receiver asks again for its data */
+	if ( ! zm.send && ( zm.state == ZR_POS || zm.state == ZR_DATA ) )
+		zr_rpos(1);
+}
+
+static void
+zm_subpkt_end (int ok)
+{
+	zm.rd = RD_SEEK;
+	zm.esc = 0;
+	if ( ! zm.send ) zr_subpkt(ok);
+}
+
+static int
+zm_hexval (unsigned char c)
+{
+	if ( c >= '0' && c <= '9' ) return c - '0';
+	if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+	if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+	return -1;
+}
+
+/* check the CRC of the header in "hbuf" */
+static int
+zm_header_ok (void)
+{
+	const unsigned char *b = zm.hbuf;
+	uint32_t c;
+
+	if ( zm.rd == RD_BIN && zm.hcrc32 ) {
+		c = crc32(0, b, 5);
+		return b[5] == ( c & 0xff ) && b[6] == ( ( c >> 8 ) & 0xff )
+			&& b[7] == ( ( c >> 16 ) & 0xff ) && b[8] == ( c >> 24 );
+	}
+	c = crc16(0, b, 5);
+	return b[5] == ( c >> 8 ) && b[6] == ( c & 0xff );
+}
+
+/* check the CRC of the subpacket just read */
+static int
+zm_subpkt_ok (void)
+{
+	const unsigned char *b = zm.hbuf;
+	unsigned char e = zm.subend;
+	uint32_t c;
+
+	if ( zm.rxcrc32 ) {
+		c = crc32(crc32(0, zm.sub, zm.sublen), &e, 1);
+		return b[0] == ( c & 0xff ) && b[1] == ( ( c >> 8 ) & 0xff )
+			&& b[2] == ( ( c >> 16 ) & 0xff ) && b[3] == ( c >> 24 );
+	}
+	c = crc16(crc16(0, zm.sub, zm.sublen), &e, 1);
+	return b[0] == ( c >> 8 ) && b[1] == ( c & 0xff );
+}
+
+/* handle received character "c" */
+static void
+zm_rd (unsigned char c)
+{
+	int r;
+
+	if ( c == ZDLE ) {
+		if ( ++zm.cans >= ZM_CANS ) {
+			zm_end(zm.send ? "cancelled by the receiver"
+				   : "cancelled by the sender");
+			return;
+		}
+	} else {
+		zm.cans = 0;
+	}
+	/* flow control, not data */
+	if ( ( c & 0x7f ) == XON || ( c & 0x7f ) == XOFF ) return;
+
+	switch ( zm.rd ) {
+	case RD_SEEK:
+		if ( c == ZPAD )
+			zm.rd = RD_PAD;
+		else if ( zm.state == ZR_OO && c == 'O' && ++zm.oo == 2 )
+			zm_end(NULL);
+		break;
+	case RD_PAD:
+		if ( c == ZDLE )
+			zm.rd = RD_FRAME;
+		else if ( c != ZPAD )
+			zm.rd = RD_SEEK;
+		break;
+	case RD_FRAME:
+		zm.hlen = 0;
+		zm.esc = 0;
+		if ( c == ZBIN || c == ZBIN32 ) {
+			zm.hcrc32 = ( c == ZBIN32 );
+			zm.rd = RD_BIN;
+		} else if ( c == ZHEX ) {
+			zm.rd = RD_HEX;
+		} else if ( c != ZDLE ) {
+			zm.rd = RD_SEEK;
+		}
+		break;
+	case RD_BIN:
+		r = zm_unesc(c);
+		if ( r == ZM_NONE ) break;
+		if ( r < 0 || ( r & ZM_GOT ) ) {
+			zm_header_bad();
+			break;
+		}
+		zm.hbuf[zm.hlen++] = r;
+		if ( zm.hlen < ( zm.hcrc32 ? 9 : 7 ) ) break;
+		if ( ! zm_header_ok() ) {
+			zm_header_bad();
+			break;
+		}
+		/* the subpackets that follow have the same CRC */
+		zm.rxcrc32 = zm.hcrc32;
+		zm_header();
+		break;
+	case RD_HEX:
+		r = zm_hexval(c & 0x7f);
+		if ( r < 0 ) {
+			zm_header_bad();
+			break;
+		}
+		if ( zm.hlen & 1 )
+			zm.hbuf[zm.hlen / 2] |= r;
+		else
+			zm.hbuf[zm.hlen / 2] = r << 4;
+		if ( ++zm.hlen < 14 ) break;
+		if ( ! zm_header_ok() ) {
+			zm_header_bad();
+			break;
+		}
+		zm_header();
+		break;
+	case RD_DATA:
+		r = zm_unesc(c);
+		if ( r == ZM_NONE ) break;
+		if ( r == ZM_BAD ) {
+			zm_subpkt_end(0);
+		} else if ( r & ZM_GOT ) {
+			zm.subend = r & 0xff;
+			zm.hlen = 0;
+			zm.rd = RD_CRC;
+		} else if ( zm.sublen == sizeof(zm.sub) ) {
+			zm_subpkt_end(0);
+		} else {
+			zm.sub[zm.sublen++] = r;
+		}
+		break;
+	case RD_CRC:
+		r = zm_unesc(c);
+		if ( r == ZM_NONE ) break;
+		if ( r < 0 || ( r & ZM_GOT ) ) {
+			zm_subpkt_end(0);
+			break;
+		}
+		zm.hbuf[zm.hlen++] = r;
+		if ( zm.hlen == ( zm.rxcrc32 ? 4 : 2 ) )
+			zm_subpkt_end(zm_subpkt_ok());
+		break;
+	}
+}
+
+/**********************************************************************/
+
+/* start a transfer */
+static int
+zm_init (void)
+{
+	if ( zm.open ) { errno = EBUSY; return -1; }
+
+	memset(&zm, 0, sizeof(zm));
+	zm.fd = -1;
+	zm.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if ( zm.tfd < 0 ) return -1;
+	zm_mkesctab();
+	zm.open = 1;
+
+	return 0;
+}
+
+int
+zm_send (char *const files[], int nfiles)
+{
+	unsigned char h[4] = { 0, 0, 0, 0 };
+	int i;
+
+	if ( nfiles < 1 ) { errno = EINVAL; return -1; }
+	if ( zm_init() < 0 ) return -1;
+
+	zm.files = calloc(nfiles, sizeof(*zm.files));
+	if ( ! zm.files ) goto nomem;
+	zm.nfiles = nfiles;
+	for (i = 0; i < nfiles; i++)
+		if ( ! (zm.files[i] = strdup(files[i])) ) goto nomem;
+
+	zm.send = 1;
+	zm.state = ZS_START;
+	zm_put("rz\r", 3);
+	zm_hexhdr(ZRQINIT, h);
+	zm_arm(ZM_START_IVL);
+
+	return 0;
+
+nomem:
+	zm_close(NULL);
+	errno = ENOMEM;
+	return -1;
+}
+
+int
+zm_receive (const char *path)
+{
+	if ( zm_init() < 0 ) return -1;
+
+	zm.dir = strdup(( path && path[0] ) ? path : ".");
+	if ( ! zm.dir ) {
+		zm_close(NULL);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	zm.state = ZR_INIT;
+	zr_rinit();
+	zm_arm(ZM_START_IVL);
+
+	return 0;
+}
+
+int
+zm_timer_fd (void)
+{
+	return zm.open ? zm.tfd : -1;
+}
+
+void
+zm_tick (void)
+{
+	unsigned char h[4] = { 0, 0, 0, 0 };
+	uint64_t exp;
+
+	if ( ! zm.open ) return;
+	while ( read(zm.tfd, &exp, sizeof(exp)) < 0 && errno == EINTR )
+		/* nothing */ ;
+	if ( zm.state == Z_END ) return;
+	/* the deadline may have moved */
+	if ( zm_now() < zm.deadline ) {
+		zm_settimer();
+		return;
+	}
+
+	switch ( zm.state ) {
+	case ZS_START:
+		if ( ++zm.tries > ZM_START_TMO / ZM_START_IVL ) {
+			zm_fail("no answer from the receiver");
+			break;
+		}
+		zm_hexhdr(ZRQINIT, h);
+		zm_arm(ZM_START_IVL);
+		break;
+	case ZS_FILE:
+	case ZS_ACK:
+	case ZS_EOF:
+	case ZS_FIN:
+		zs_retry();
+		break;
+	case ZR_INIT:
+		/* until the first file, the sender may not have started */
+		if ( ! zm.t0 ) {
+			if ( ++zm.tries > ZM_START_TMO / ZM_START_IVL ) {
+				zm_fail("no answer from the sender");
+				break;
+			}
+			zm_arm(ZM_START_IVL);
+		} else {
+			if ( ++zm.tries > ZM_RETRIES ) {
+				zm_fail("no answer from the sender");
+				break;
+			}
+			zm.st.retries++;
+			zm_arm(ZM_TMO);
+		}
+		zm.rd = RD_SEEK;
+		zr_rinit();
+		break;
+	case ZR_POS:
+	case ZR_DATA:
+		zr_rpos(1);
+		break;
+	case ZR_OO:
+		zm_end(NULL);
+		break;
+	default:
+		break;
+	}
+}
+
+size_t
+zm_input (const unsigned char *buff, size_t len)
+{
+	const unsigned char *s = buff, *e = buff + len, *p;
+	size_t n;
+
+	if ( ! zm.open || zm.state == Z_END ) return 0;
+
+	/* the receiver's timeouts are for the sender going quiet */
+	if ( zm.state == ZR_POS || zm.state == ZR_DATA )
+		zm.deadline = zm_now() + (uint64_t)ZM_TMO * 1000000;
+
+	while ( buff < e && zm.state != Z_END ) {
+		if ( zm.rd == RD_DATA && ! zm.esc ) {
+			/* the bulk of the data: characters that are never
+			   escaped, nor ignored, go straight to the subpacket */
+			n = sizeof(zm.sub) - zm.sublen;
+			if ( n > (size_t)(e - buff) ) n = e - buff;
+			for (p = buff; p < buff + n && ( *p & 0x60 ); p++)
+				/* nothing */ ;
+			if ( p > buff ) {
+				memcpy(zm.sub + zm.sublen, buff, p - buff);
+				zm.sublen += p - buff;
+				zm.cans = 0;
+				buff = p;
+				continue;
+			}
+		}
+		zm_rd(*buff++);
+	}
+
+	return buff - s;
+}
+
+int
+zm_fill (struct ring *q)
+{
+	size_t n;
+	int r = 1;
+
+	if ( ! zm.open ) return 0;
+
+	if ( zm.flush ) {
+		ring_clear(q);
+		zm.flush = 0;
+		r = 2;
+	}
+	for (;;) {
+		if ( zm.out_off < zm.out_len ) {
+			n = ring_space(q);
+			if ( n > zm.out_len - zm.out_off )
+				n = zm.out_len - zm.out_off;
+			ring_put(q, zm.out + zm.out_off, n);
+			zm.out_off += n;
+			if ( zm.out_off < zm.out_len ) break;
+		}
+		zm.out_off = zm.out_len = 0;
+		if ( zm.state == Z_END ) return 0;
+		if ( ! zm.send || ! zs_next() ) break;
+	}
+
+	/* the receiver cannot answer what it has not been sent yet */
+	if ( zm.send && zm.state != ZS_START && zm.state != Z_END
+		 && ring_len(q) )
+		zm.deadline = zm_now() + (uint64_t)ZM_TMO * 1000000;
+
+	return r;
+}
+
+void
+zm_cancel (void)
+{
+	if ( zm.open ) zm_fail("aborted");
+}
+
+void
+zm_close (struct xm_stats_s *st)
+{
+	int i;
+
+	if ( ! zm.open ) return;
+
+	if ( st ) {
+		*st = zm.st;
+		st->elapsed_ns = 0;
+		if ( zm.t0 )
+			st->elapsed_ns = ( zm.state == Z_END ? zm.t1 : zm_now() ) - zm.t0;
+	}
+	zs_unmap();
+	for (i = 0; i < zm.nfiles; i++)
+		free(zm.files[i]);
+	free(zm.files);
+	zm.files = NULL;
+	zm.nfiles = 0;
+	free(zm.dir);
+	zm.dir = NULL;
+	if ( zm.fd >= 0 ) close(zm.fd);
+	zm.fd = -1;
+	if ( zm.tfd >= 0 ) close(zm.tfd);
+	zm.tfd = -1;
+	zm.open = 0;
+}
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */
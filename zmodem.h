@@ -0,0 +1,158 @@
+/* vi: set sw=4 ts=4:
+ *
+ * zmodem.h
+ *
+ * Built-in ZMODEM file transfers. Like the XMODEM and YMODEM ones (see
+ * "xmodem.h"), files are sent and received from within the event
+ * loop, while picocom keeps the port and the terminal.
+ *
+ * Principles of operation:
+ *
+ * The interface is that of the XMODEM module: the protocol is a state
+ * machine driven by zm_input() (data read from the port), zm_tick()
+ * (the timer returned by zm_timer_fd() is readable), and zm_fill()
+ * (moves what there is to send into the transmit queue of the port).
+ * Nothing blocks. The statistics are those of the XMODEM module, too.
+ *
+ * Transfers use full streaming: the sender sends the data of a file
+ * without waiting for any acknowledgement, as subpackets of 1024 bytes
+ * inside a single data frame, and the receiver only answers when
+ * something goes wrong, or at the end of the file. The data are
+ * checked with CRC-32 (see "crc.h") if the receiver can, with CRC-16
+ * otherwise. A receiver that asks for a limited buffer is sent the
+ * data in segments of that size, each one waiting for its ACK.
+ *
+ * Errors are recovered from by position: on a bad subpacket (or
+ * header), the receiver sends ZRPOS with the number of bytes it has
+ * written, and ignores what it receives until a new data frame. The
+ * sender, on ZRPOS, drops what it has queued and not yet sent (see
+ * zm_fill), and starts again from that position. Only the data lost
+ * are sent again, however long the file.
+ *
+ * Sending: a batch of files, announced with "rz\r" (which starts the
+ * receiver on most remote shells). Files are mapped with mmap(2); sizes
+ * and positions are sent in 32 bits, as the protocol says, so files
+ * must be smaller than 4GB.
+ *
+ * Receiving: the files are created in the directory given (the last
+ * component of the name only), and given the modification time sent.
+ * Existing files are skipped, except if the sender asks to resume
+ * them (ZCRESUM, e.g. "sz -r") and they are shorter than the file
+ * sent: the transfer then continues where it was interrupted, and the
+ * data already there are kept.
+ *
+ * Interface summary:
+ *
+ * F zm_send - start sending files
+ * F zm_receive - start receiving files
+ * F zm_timer_fd - the protocol timer
+ * F zm_tick - handle the protocol timer
+ * F zm_input - handle data received from the port
+ * F zm_fill - queue what there is to send
+ * F zm_cancel - abort the transfer
+ * F zm_close - end the transfer, and get the statistics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA
+ */
+
+#ifndef ZMODEM_H
+#define ZMODEM_H
+
+#include <stddef.h>
+
+#include "ring.h"
+#include "xmodem.h"
+
+/* F zm_send
+ *
+ * Start sending the "nfiles" files named in "files". The names are
+ * copied. The receiver is waited for, for a minute.
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success. Files that cannot be read make the transfer fail later.
+ */
+int zm_send (char *const files[], int nfiles);
+
+/* F zm_receive
+ *
+ * Start receiving files into directory "path" (the current one if
+ * NULL or empty).
+ *
+ * Returns negative on failure (errno is set), non-negative on
+ * success.
+ */
+int zm_receive (const char *path);
+
+/* F zm_timer_fd
+ *
+ * Returns the filedes of the protocol timer, to be watched for
+ * reading by the caller, or negative if no transfer is in progress.
+ */
+int zm_timer_fd (void);
+
+/* F zm_tick
+ *
+ * Called when the protocol timer is readable: handles the timeouts.
+ */
+void zm_tick (void);
+
+/* F zm_input
+ *
+ * Handle the "len" bytes at "buff", received from the port.
+ *
+ * Returns the number of bytes taken, as xm_input() does.
+ */
+size_t zm_input (const unsigned char *buff, size_t len);
+
+/* F zm_fill
+ *
+ * Copy what there is to send to ring "q", as much as it has room for.
+ * When the sender starts again from an earlier position, what "q"
+ * holds is dropped first.
+ *
+ * Returns 1 while the transfer is in progress, 2 if, besides, what "q"
+ * held has been dropped (what the port has not sent yet is just as
+ * stale, and should be dropped too), 0 once the transfer has ended
+ * (successfully or not; see zm_close) and all there was to send has
+ * been queued.
+ */
+int zm_fill (struct ring *q);
+
+/* F zm_cancel
+ *
+ * Abort the transfer: the remote side is sent cancel characters (by
+ * zm_fill), and the transfer fails.
+ */
+void zm_cancel (void);
+
+/* F zm_close
+ *
+ * End the transfer, and release its resources. If "st" is not NULL,
+ * the statistics of the transfer are stored there.
+ */
+void zm_close (struct xm_stats_s *st);
+
+#endif /* of ZMODEM_H */
+
+/**********************************************************************/
+
+/*
+ * Local Variables:
+ * mode:c
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ */